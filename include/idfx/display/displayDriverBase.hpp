@@ -1,16 +1,110 @@
 /**
  * Abstract base class for a display driver that can be used with LVGL
  *
+ * createLvglDisplay() sets up the LVGL display with two DMA capable draw buffers so that
+ * LVGL can render into one buffer while the other is being sent to the panel.
+ *
+ * Rendering on both cores is not set up by this library. The sdkconfig of this repo uses
+ * a single LVGL draw unit, so all rendering is done by one task and registerLvglDisplay()
+ * logs a warning. An application can set CONFIG_LV_OS_FREERTOS and
+ * CONFIG_LV_DRAW_SW_DRAW_UNIT_CNT=2 in its own sdkconfig so that LVGL creates two software
+ * draw units, each with its own worker task. LVGL creates these tasks without a core
+ * affinity, and ESP-IDF FreeRTOS cannot pin a task once created, so they are not pinned
+ * one per core and the scheduler decides where they run. The render statistics can be
+ * used to measure the effect on the actual hardware.
+ *
+ * To avoid tearing, the tearing effect (TE) output of the panel can be used via
+ * enableTearingEffectSync(). The TE pulse marks the start of vertical blanking. From the
+ * time since the last pulse the current scanline is estimated, and an area is only flushed
+ * right away if the write will stay clear of the scanline. Otherwise the flush waits for
+ * the next TE pulse. This gives tear free output without needing a full frame buffer.
+ *
  * SPDX-License-Identifier: MIT
  */
 
+#pragma once
+
+#include <atomic>
+
+#include "driver/spi_master.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "idfx/display/spiTransaction.hpp"
+#include "idfx/hardware/asyncCopy.hpp"
+#include "idfx/hardware/interrupts.hpp"
 #include "lvgl.h"
 
 class DisplayDriverBase {
    public:
+    // Frame render time statistics, so that can tell how long LVGL takes to render
+    typedef struct RenderStats {
+        uint32_t frames;       // number of frames rendered
+        uint64_t total_usec;   // total time spent rendering
+        uint32_t max_usec;     // longest time for rendering a frame
+        uint32_t last_usec;    // time for rendering the most recent frame
+    } render_stats_t;
+
+    // Statistics for flushes synchronized with the tearing effect (TE) signal
+    typedef struct VsyncStats {
+        uint32_t vsyncs;             // number of TE pulses received
+        uint32_t immediate_flushes;  // flushes started right away since clear of scanline
+        uint32_t synced_flushes;     // flushes that waited for a TE pulse
+        uint32_t missed_vsyncs;      // flushes where the TE pulse didn't arrive in time
+        uint32_t frame_period_usec;  // measured time between TE pulses
+    } vsync_stats_t;
+
     DisplayDriverBase(int width, int height);
 
-    virtual ~DisplayDriverBase() = default;
+    virtual ~DisplayDriverBase();
+
+    /**
+     * Returns the LVGL display created by createLvglDisplay(), or nullptr if not created yet
+     */
+    lv_display_t *lvglDisplay() const {
+        return lv_display_;
+    }
+
+    /**
+     * Returns the render time statistics accumulated since the display was created or since
+     * resetRenderStats() was called
+     */
+    render_stats_t renderStats() const {
+        return render_stats_;
+    }
+
+    /**
+     * Resets the render time statistics
+     */
+    void resetRenderStats();
+
+    /**
+     * Returns the sustained number of frames rendered per second since the display was
+     * created or since resetRenderStats() was called
+     */
+    float renderedFps() const;
+
+    /**
+     * Returns the number of LVGL software draw units, each with its own unpinned worker
+     * task. If only 1, as with the sdkconfig of this repo, then all rendering is done by a
+     * single task, and so on a single core.
+     */
+    static int parallelDrawUnits();
+
+    /**
+     * Synchronizes flushes with the tearing effect (TE) output of the panel. The TE pin is
+     * registered via GpioInterrupteHandler and configured as input only.
+     * @param te_pin The GPIO pin connected to the TE output of the panel
+     * @param nominal_refresh_hz Refresh rate of the panel, used until the actual rate
+     * has been measured from the TE pulses. Default is 60.
+     */
+    void enableTearingEffectSync(idfx::GPIONum te_pin, uint32_t nominal_refresh_hz = 60);
+
+    /**
+     * Returns the statistics for flushes synchronized with the TE signal
+     */
+    vsync_stats_t vsyncStats() const {
+        return vsync_stats_;
+    }
 
    protected:
     /**
@@ -51,7 +145,199 @@ class DisplayDriverBase {
      */
     virtual size_t getDispBufSize() = 0;
 
+    /**
+     * Creates the LVGL display along with two draw buffers in DMA capable memory. LVGL renders
+     * into one buffer while the other is being flushed. A buffer is only handed back to LVGL
+     * once flushReady() is called, which should be done when the DMA has completed.
+     * @param buffer_lines Height of each draw buffer in lines. Ignored for direct and full
+     * refresh modes since then the buffers are full frame, and are put in PSRAM if possible.
+     * @param color_format Color format of the display. Default is LV_COLOR_FORMAT_RGB565.
+     * @param render_mode Default is LV_DISPLAY_RENDER_MODE_PARTIAL.
+     * @return The LVGL display, or nullptr if the buffers could not be allocated
+     */
+    lv_display_t *createLvglDisplay(int buffer_lines,
+                                    lv_color_format_t color_format = LV_COLOR_FORMAT_RGB565,
+                                    lv_display_render_mode_t render_mode = LV_DISPLAY_RENDER_MODE_PARTIAL);
+
+    /**
+     * Creates the LVGL display using already allocated draw buffers. For drivers, like RGB
+     * panels, where the buffers are provided by the panel driver.
+     * @param buf1 First draw buffer
+     * @param buf2 Second draw buffer, or nullptr
+     * @param buf_size Size of each buffer in bytes
+     * @param render_mode How LVGL is to render into the buffers
+     * @param color_format Color format of the display
+     * @return The LVGL display
+     */
+    lv_display_t *registerLvglDisplay(void *buf1, void *buf2, size_t buf_size,
+                                      lv_display_render_mode_t render_mode,
+                                      lv_color_format_t color_format);
+
+    /**
+     * Returns size in bytes of each LVGL draw buffer
+     */
+    size_t drawBufSize() const {
+        return draw_buf_size_;
+    }
+
+    /**
+     * Sends the rendered pixels for an area to the panel. Called by LVGL. The default
+     * implementation is for SPI panels and uses sendArea(), calling flushReady() once
+     * the DMA has completed. Subclasses for other interfaces override this.
+     * @param area The area of the display to update
+     * @param px_map The rendered pixels. Owned by the driver until flushReady() is called.
+     */
+    virtual void flushArea(const lv_area_t *area, uint8_t *px_map);
+
+    /**
+     * If tearing effect sync is enabled, waits until the area can be written without
+     * racing the scanline of the panel. Called by flushArea() before sending the area.
+     * @param area The area about to be written
+     * @param length Number of bytes to be written, used to estimate how long the write takes
+     */
+    void waitForScanline(const lv_area_t *area, size_t length);
+
+    /**
+     * Tells LVGL that flushing is done and that the draw buffer can be used again. Only
+     * gives a semaphore, which LVGL waits on in its own task, so it is IRAM safe and can
+     * be called from an ISR even while the flash cache is disabled.
+     */
+    void flushReady();
+
+    /**
+     * For SPI panels that expect RGB565 pixels with the most significant byte first.
+     * If true, the default, the bytes are swapped by flushArea() before sending.
+     */
+    void setSwapBytes(bool swap) {
+        swap_bytes_ = swap;
+    }
+
+    /**
+     * Swaps the bytes of RGB565 pixels if setSwapBytes() is true
+     */
+    void swapBytesIfNeeded(uint8_t *px_map, size_t num_pixels);
+
+    /**
+     * For SPI based displays. Adds the display as a device on the SPI bus, which must
+     * already have been initialized with spi_bus_initialize(). The pre_cb and queue_size
+     * of dev_config are set so that the device works with SpiTransaction.
+     * @param host The SPI host the display is connected to
+     * @param dev_config Configuration of the SPI device, such as clock speed and CS pin
+     * @param dc_pin The data/command pin of the display
+     * @return ESP_OK if successful
+     */
+    esp_err_t attachSpi(spi_host_device_t host, spi_device_interface_config_t dev_config,
+                        gpio_num_t dc_pin);
+
+    /**
+     * Starts a new batch of command and data phases for the SPI display. If the previous
+     * batch is still in progress then first waits for it to complete.
+     * @return The transaction builder. Call submit() on it when all phases added.
+     */
+    idfx::SpiTransaction& beginTransaction();
+
+    /**
+     * Sends pixel data for an area of the display using the standard MIPI DCS set column
+     * address, set row address, and write memory commands. These are all sent as a single
+     * batch. The small command phases are sent with polling and the pixel data is queued
+     * for DMA, so this returns before the pixel data has been sent.
+     * @param area The area of the display to write to
+     * @param pixels The pixel data. Must stay valid until waitForTransaction() returns.
+     * @param length Number of bytes of pixel data
+     * @param complete_function Optional function to call, possibly from ISR, once the pixel
+     * data has been sent
+     * @param arg Argument passed to complete_function
+     * @return ESP_OK if successful
+     */
+    esp_err_t sendArea(const lv_area_t *area, const void *pixels, size_t length,
+                       idfx::spi_complete_function_t complete_function = nullptr,
+                       void *arg = nullptr);
+
+    /**
+     * Waits for the current SPI batch to complete
+     * @return ESP_OK if successful
+     */
+    esp_err_t waitForTransaction();
+
+    /**
+     * Copies the pixels of an area between buffers, such as from a PSRAM frame buffer into
+     * a DMA capable staging buffer. Uses the async memcpy engine when possible so that the
+     * CPU can continue while the copy runs. If a previous copy is still in progress then
+     * first waits for it to complete.
+     * @param area The area to copy, relative to the start of both buffers
+     * @param dest Destination buffer
+     * @param dest_stride Bytes per row of the destination buffer
+     * @param src Source buffer
+     * @param src_stride Bytes per row of the source buffer
+     * @param complete_function Optional function to call, possibly from ISR, once copied
+     * @param arg Argument passed to complete_function
+     * @return ESP_OK if successful
+     */
+    esp_err_t copyArea(const lv_area_t *area, void *dest, size_t dest_stride, const void *src,
+                       size_t src_stride, idfx::copy_complete_function_t complete_function = nullptr,
+                       void *arg = nullptr);
+
+    /**
+     * Waits for the copy started by copyArea() to complete. Rows that the DMA engine
+     * rejected are copied by the CPU here, so this should be called before the
+     * destination is used.
+     * @return ESP_OK if successful
+     */
+    esp_err_t waitForCopy();
+
    private:
+    /**
+     * The LVGL flush callback. Forwards to flushArea() of the driver.
+     */
+    static void lvglFlushCallback(lv_display_t *disp, const lv_area_t *area, uint8_t *px_map);
+
+    /**
+     * The LVGL flush wait callback. Called by LVGL, in its task, to wait until the
+     * previous flush has completed, as signaled by flushReady().
+     */
+    static void lvglFlushWaitCallback(lv_display_t *disp);
+
+    /**
+     * Called by SpiTransaction, from ISR, when the pixel data has been sent. In IRAM.
+     */
+    static void spiFlushComplete(void *arg);
+
+    /**
+     * LVGL display event callback for keeping track of render times
+     */
+    static void renderEventCallback(lv_event_t *event);
+
+    /**
+     * Called by the GPIO interrupt task for each TE pulse
+     * @param gpio_num The TE pin
+     */
+    static void tearingEffectHandler(int gpio_num);
+
     int width_;
     int height_;
+
+    lv_display_t *lv_display_;
+    void *draw_bufs_[2];
+    size_t draw_buf_size_;
+    bool swap_bytes_;
+    int64_t render_start_usec_;
+    render_stats_t render_stats_;
+    int64_t stats_start_usec_;
+    SemaphoreHandle_t flush_done_semaphore_;  // given by flushReady()
+
+    // For tearing effect sync. Times are 32 bit microseconds so that they can be read
+    // atomically. Differences are still correct when they wrap.
+    SemaphoreHandle_t vsync_semaphore_;
+    std::atomic<uint32_t> last_vsync_usec_;
+    std::atomic<uint32_t> frame_period_usec_;
+    uint32_t flush_start_usec_;
+    size_t flush_bytes_;
+    std::atomic<uint32_t> flush_done_usec_;
+    uint32_t usec_per_kbyte_;  // measured write speed
+    vsync_stats_t vsync_stats_;
+
+    spi_device_handle_t spi_device_;
+    gpio_num_t dc_pin_;
+    idfx::SpiTransaction transaction_;
+    idfx::AsyncCopy copy_;
 };
\ No newline at end of file
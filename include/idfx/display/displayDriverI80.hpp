@@ -0,0 +1,101 @@
+/**
+ * Display driver for panels connected via the Intel 8080 style 8 or 16 bit parallel
+ * interface, using the LCD peripheral through esp_lcd. Much higher bandwidth than SPI
+ * so is suited for larger panels such as 480x320.
+ *
+ * The pixel data is sent via DMA and LVGL is told that the draw buffer is free again
+ * from the transfer done callback. Works with partial, direct, and full refresh LVGL
+ * render modes. For direct and full refresh modes the full frame buffers are put in
+ * PSRAM if the DMA is able to read from PSRAM.
+ *
+ * init() sends a generic MIPI DCS initialization sequence. Subclasses for specific
+ * controllers can override sendInitCommands().
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "soc/soc_caps.h"
+
+#if SOC_LCD_I80_SUPPORTED
+
+#include "esp_lcd_io_i80.h"
+#include "esp_lcd_panel_io.h"
+#include "idfx/display/displayDriverBase.hpp"
+
+class DisplayDriverI80 : public DisplayDriverBase {
+   public:
+    /**
+     * Creates the driver. The bus and panel IO are not created until init() is called.
+     * @param width Width of the display in pixels
+     * @param height Height of the display in pixels
+     * @param bus_config Configuration of the i80 bus, such as the data pins and bus width
+     * @param io_config Configuration of the panel IO, such as CS pin and pixel clock. The
+     * on_color_trans_done, user_ctx, and flags.swap_color_bytes members are set by the driver.
+     */
+    DisplayDriverI80(int width, int height, const esp_lcd_i80_bus_config_t &bus_config,
+                     const esp_lcd_panel_io_i80_config_t &io_config);
+
+    ~DisplayDriverI80() override;
+
+    /**
+     * Returns the number of full frames sent to the panel
+     */
+    uint32_t framesFlushed() const {
+        return frames_flushed_;
+    }
+
+   protected:
+    /**
+     * Creates the i80 bus and panel IO, and then initializes the controller
+     */
+    void init() override;
+
+    /**
+     * Sends the commands to initialize the controller. The default is a generic MIPI DCS
+     * sequence of software reset, sleep out, 16 bit color, and display on.
+     */
+    virtual void sendInitCommands();
+
+    /**
+     * Forces LVGL to render and flush any invalidated areas now
+     */
+    void flush() override;
+
+    lv_disp_t *getDisp() override {
+        return lvglDisplay();
+    }
+
+    size_t getDispBufSize() override {
+        return drawBufSize();
+    }
+
+    /**
+     * Sends the area to the panel via DMA. For direct and full refresh modes only sends
+     * once the last area of the frame has been rendered, and then sends the whole frame.
+     */
+    void flushArea(const lv_area_t *area, uint8_t *px_map) override;
+
+    /**
+     * Returns the panel IO handle so that subclasses can send controller specific commands
+     */
+    esp_lcd_panel_io_handle_t panelIo() const {
+        return io_;
+    }
+
+   private:
+    /**
+     * Called from ISR when the pixel data has been sent
+     */
+    static bool colorTransDone(esp_lcd_panel_io_handle_t panel_io,
+                               esp_lcd_panel_io_event_data_t *edata, void *user_ctx);
+
+    esp_lcd_i80_bus_config_t bus_config_;
+    esp_lcd_panel_io_i80_config_t io_config_;
+    esp_lcd_i80_bus_handle_t bus_;
+    esp_lcd_panel_io_handle_t io_;
+    uint32_t frames_flushed_;
+};
+
+#endif  // SOC_LCD_I80_SUPPORTED
@@ -0,0 +1,98 @@
+/**
+ * Display driver for panels with an RGB interface, such as 800x480 panels, using the
+ * LCD peripheral through esp_lcd. The panel has no memory of its own so the frame buffers
+ * are in PSRAM and are continuously streamed to the panel. Since reading PSRAM via DMA
+ * directly can underrun when the PSRAM is busy, small bounce buffers in internal RAM are
+ * used. They are refilled from the frame buffer by the esp_lcd ISR.
+ *
+ * Two LVGL integrations are supported:
+ *  - Full refresh (the default). Two frame buffers. LVGL renders the whole frame into the
+ *    one not being displayed, and the panel switches to it at the next vsync. Tear free.
+ *  - Direct mode. A single frame buffer that LVGL renders only the changed areas into.
+ *    Uses less PSRAM and bandwidth, but can tear.
+ *
+ * Only available for targets that have an RGB LCD interface, such as the ESP32S3.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "soc/soc_caps.h"
+
+#if SOC_LCD_RGB_SUPPORTED
+
+#include <atomic>
+
+#include "esp_lcd_panel_ops.h"
+#include "esp_lcd_panel_rgb.h"
+#include "idfx/display/displayDriverBase.hpp"
+
+class DisplayDriverRgb : public DisplayDriverBase {
+   public:
+    /**
+     * Creates the driver. The panel is not created until init() is called.
+     * @param panel_config Configuration of the panel, such as the timings and pins. The
+     * num_fbs, bounce_buffer_size_px, and fb_in_psram members are set by the driver.
+     * @param full_refresh true for two frame buffers and full refresh mode, false for a
+     * single frame buffer and direct mode. Default is true.
+     * @param bounce_buffer_lines Height in lines of each bounce buffer. Should divide evenly
+     * into the height of the panel. Default is 10.
+     */
+    DisplayDriverRgb(const esp_lcd_rgb_panel_config_t &panel_config, bool full_refresh = true,
+                     int bounce_buffer_lines = 10);
+
+    ~DisplayDriverRgb() override;
+
+    /**
+     * Returns the measured rate at which the panel is refreshed from the frame buffer
+     */
+    float refreshHz() const;
+
+    /**
+     * Returns the measured PSRAM bandwidth used for the display. This is the frame buffer
+     * being read at the refresh rate plus the frames rendered by LVGL being written.
+     */
+    uint32_t psramBytesPerSecond() const;
+
+   protected:
+    /**
+     * Creates the RGB panel and the LVGL display that renders into its frame buffers
+     */
+    void init() override;
+
+    /**
+     * Forces LVGL to render and flush any invalidated areas now
+     */
+    void flush() override;
+
+    lv_disp_t *getDisp() override {
+        return lvglDisplay();
+    }
+
+    size_t getDispBufSize() override {
+        return drawBufSize();
+    }
+
+    /**
+     * In full refresh mode switches the panel to the newly rendered frame buffer. In
+     * direct mode LVGL has already rendered into the displayed frame buffer.
+     */
+    void flushArea(const lv_area_t *area, uint8_t *px_map) override;
+
+   private:
+    /**
+     * Called from ISR at each vsync. Used to hand the previous frame buffer back to LVGL.
+     */
+    static bool onVsync(esp_lcd_panel_handle_t panel, const esp_lcd_rgb_panel_event_data_t *edata,
+                        void *user_ctx);
+
+    esp_lcd_rgb_panel_config_t panel_config_;
+    const bool full_refresh_;
+    esp_lcd_panel_handle_t panel_;
+    std::atomic<bool> flush_pending_;
+    std::atomic<uint32_t> vsyncs_;
+    int64_t vsyncs_start_usec_;
+};
+
+#endif  // SOC_LCD_RGB_SUPPORTED
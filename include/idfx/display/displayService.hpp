@@ -0,0 +1,149 @@
+/**
+ * Runs LVGL in its own task, with an adaptive refresh rate. Normally the display refresh
+ * timer and the input device read timers run every LV_DEF_REFR_PERIOD msec even if the
+ * screen hasn't changed for minutes, which wastes CPU and battery.
+ *
+ * DisplayService keeps track of when the display was last invalidated. Once nothing has
+ * been invalidated for the idle timeout the display refresh timers are slowed down to the
+ * idle period. As soon as an area is invalidated, or wake() is called such as by an
+ * interrupt driven touch controller, the timers are returned to the active period and the
+ * task runs LVGL right away, so interaction latency is not affected. The read timers of
+ * input devices that call wake(), registered with addWakingInput(), are slowed down and
+ * sped up along with the refresh timers, so an idle screen with a touch controller
+ * doesn't wake up every LV_DEF_REFR_PERIOD. Other input devices keep their own period
+ * so that polled inputs, which cannot wake the service, are still read promptly.
+ *
+ * The task sleeps for as long as LVGL reports that no timer is due, instead of polling.
+ * The time spent in lv_timer_handler() versus sleeping is kept in stats() so that the
+ * effect can be measured.
+ *
+ * Other tasks that call LVGL functions need to hold the lock, via lock() and unlock().
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "lvgl.h"
+
+namespace idfx {
+
+class DisplayService {
+   public:
+    typedef struct Stats {
+        uint64_t render_usec;    // time spent in lv_timer_handler()
+        uint64_t idle_usec;      // time spent sleeping
+        uint32_t wakeups;        // times lv_timer_handler() was called
+        uint32_t idle_entries;   // times the refresh rate was lowered
+        bool idle;               // true if currently at the idle refresh rate
+    } stats_t;
+
+    /**
+     * Initializes LVGL, if not already done, and starts the LVGL task. Should be called
+     * before the displays are created, which then need to be created while holding lock().
+     * @param idle_timeout_msec How long without invalidations before the refresh rate is
+     * lowered. Default is 2000.
+     * @param idle_period_msec Refresh period while idle. Default is 500.
+     * @param active_period_msec Refresh period while active. Default is
+     * LV_DEF_REFR_PERIOD.
+     * @param task_priority Default is 4
+     * @param core_id Default is tskNO_AFFINITY
+     * @return ESP_OK if successful, or ESP_ERR_NO_MEM if the task could not be created
+     */
+    static esp_err_t start(uint32_t idle_timeout_msec = 2000, uint32_t idle_period_msec = 500,
+                      uint32_t active_period_msec = LV_DEF_REFR_PERIOD,
+                      UBaseType_t task_priority = 4, BaseType_t core_id = tskNO_AFFINITY);
+
+    /**
+     * Locks LVGL so that LVGL functions can be called from another task
+     * @param timeout_msec How long to wait for the lock. Default is to wait forever.
+     * @return true if locked
+     */
+    static bool lock(uint32_t timeout_msec = UINT32_MAX);
+
+    static void unlock();
+
+    /**
+     * Returns to the active refresh rate and runs LVGL right away. For interrupt driven
+     * input devices, so that a touch while idle is rendered without waiting for the slow
+     * refresh timer.
+     * Can be called from any task, but not from an ISR.
+     */
+    static void wake();
+
+    /**
+     * Registers an input device that calls wake() whenever there is new input, such as
+     * one for an interrupt driven touch controller. Its read timer then uses the idle
+     * period while idle and the active period otherwise. Polled input devices must not be
+     * registered. Needs to be called with the lock held.
+     * @param indev The LVGL input device
+     */
+    static void addWakingInput(lv_indev_t *indev);
+
+    /**
+     * Unregisters an input device, such as before it is deleted. Needs to be called with
+     * the lock held.
+     * @param indev The LVGL input device
+     */
+    static void removeWakingInput(lv_indev_t *indev);
+
+    /**
+     * Returns the statistics since start() or since resetStats() was called
+     */
+    static stats_t stats();
+
+    /**
+     * Returns the percentage of time that the LVGL task was sleeping
+     */
+    static float idlePercent();
+
+    static void resetStats();
+
+   private:
+    /**
+     * The task that calls lv_timer_handler() and then sleeps until the next LVGL timer is
+     * due or until it is woken
+     */
+    static void serviceTask(void *arg);
+
+    /**
+     * Sets the period of the refresh timers of all displays, and of the read timers of the
+     * inputs registered with addWakingInput(). The read timers of other input devices are
+     * not changed. Needs to be called with the lock held.
+     */
+    static void setTimerPeriods(uint32_t period_msec);
+
+    /**
+     * Display event callback for when an area is invalidated
+     */
+    static void invalidateCallback(lv_event_t *event);
+
+    /**
+     * Returns true if invalidateCallback() has already been added to the display
+     */
+    static bool hasInvalidateCallback(lv_display_t *disp);
+
+    /**
+     * Returns the LVGL tick from esp_timer so that a separate tick timer isn't needed
+     */
+    static uint32_t tickCallback();
+
+    static SemaphoreHandle_t mutex_;
+    static TaskHandle_t task_;
+    static uint32_t idle_timeout_usec_;
+    static uint32_t idle_period_msec_;
+    static uint32_t active_period_msec_;
+    static volatile int64_t last_activity_usec_;
+    static volatile bool idle_;
+    static std::vector<lv_indev_t *> waking_inputs_;  // inputs that call wake()
+    static stats_t stats_;
+};
+
+}  // namespace idfx
@@ -0,0 +1,162 @@
+/**
+ * Cache of rasterized glyphs for scalable fonts, such as ones created with lv_tiny_ttf or
+ * lv_freetype. Rasterizing glyphs on every redraw uses a lot of CPU on text heavy screens,
+ * so the GlyphCache keeps the bitmaps so that drawing text only requires a copy.
+ *
+ * A font is cached by calling cachedFont(), which returns a proxy lv_font_t that is to be
+ * used in styles instead of the original font. Glyphs are keyed by (font, size, codepoint)
+ * and stored as A4 or A8 bitmaps in a slab allocator in PSRAM with a fixed budget. Once
+ * the budget is used up a page holding no glyphs is reassigned to the size class that is
+ * needed, or else the least recently used glyph is evicted. If it is of a different
+ * size class than needed then its whole page is reclaimed and reassigned, so that memory
+ * isn't stuck with size classes that are no longer used.
+ *
+ * Usage:
+ *   GlyphCache glyph_cache(256 * 1024);
+ *   lv_font_t *ttf = lv_tiny_ttf_create_data(font_data, font_data_size, 24);
+ *   lv_font_t *font = glyph_cache.cachedFont(ttf, 24);
+ *   glyph_cache.prewarm(font, {"0123456789:.", "Settings", "Back"});
+ *   lv_obj_set_style_text_font(label, font, 0);
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "lvgl.h"
+
+namespace idfx {
+
+class GlyphCache {
+   public:
+    typedef struct Stats {
+        uint32_t hits;         // glyphs drawn from the cache
+        uint32_t misses;       // glyphs that had to be rasterized
+        uint32_t evictions;    // glyphs removed to make room
+        uint32_t uncacheable;  // glyphs too large or not a bitmap
+        uint32_t pages_reclaimed;  // pages reassigned to another size class
+        uint32_t glyphs;       // glyphs currently in the cache
+        size_t pages_used;     // slab pages assigned to size classes
+        size_t pages_total;    // slab pages in the budget
+    } stats_t;
+
+    // The budget is divided into pages of this size, which are assigned to size classes
+    // as needed
+    constexpr static size_t kPageSize = 4096;
+
+    /**
+     * Creates the glyph cache. The memory for the budget is allocated up front, from
+     * PSRAM if available.
+     * @param budget_bytes Memory to use for glyph bitmaps
+     * @param bpp Bits per pixel of stored bitmaps, 4 or 8. 4 halves the memory use at the
+     * cost of some anti-aliasing precision.
+     */
+    GlyphCache(size_t budget_bytes, uint8_t bpp = 4);
+
+    ~GlyphCache();
+
+    /**
+     * Returns a proxy font that draws glyphs of the specified font through the cache.
+     * The font must outlive the cache. Calling again for the same font and size returns
+     * the same proxy.
+     * @param font The scalable font, already created for the size
+     * @param size The size the font was created with. Part of the cache key.
+     */
+    lv_font_t *cachedFont(const lv_font_t *font, uint16_t size);
+
+    /**
+     * Rasterizes the glyphs of the strings into the cache, such as at boot for the
+     * strings that are known to be used often.
+     * @param cached_font A font returned by cachedFont()
+     * @param strings UTF-8 strings
+     */
+    void prewarm(const lv_font_t *cached_font, std::initializer_list<const char *> strings);
+    void prewarm(const lv_font_t *cached_font, const char *str);
+
+    /**
+     * Removes all glyphs from the cache
+     */
+    void clear();
+
+    stats_t stats();
+
+   private:
+    // A proxy font. The lv_font_t must be first so that the proxy can be found from it.
+    typedef struct ProxyFont {
+        lv_font_t font;
+        const lv_font_t *source;
+        uint16_t size;
+        GlyphCache *cache;
+    } proxy_font_t;
+
+    typedef struct GlyphKey {
+        const lv_font_t *font;
+        uint16_t size;
+        uint32_t codepoint;
+        bool operator==(const GlyphKey &other) const {
+            return font == other.font && size == other.size && codepoint == other.codepoint;
+        }
+    } glyph_key_t;
+
+    struct GlyphKeyHash {
+        size_t operator()(const glyph_key_t &key) const {
+            return (size_t)key.font ^ ((size_t)key.size << 21) ^ key.codepoint * 2654435761u;
+        }
+    };
+
+    typedef struct GlyphEntry {
+        glyph_key_t key;
+        uint8_t *bitmap;
+        uint16_t box_w;
+        uint16_t box_h;
+        uint8_t size_class;
+    } glyph_entry_t;
+
+    // Slab size classes. Glyph bitmaps larger than the largest class are not cached.
+    constexpr static size_t kSizeClasses[] = {32, 64, 128, 256, 512, 1024, 2048};
+    constexpr static int kNumSizeClasses = sizeof(kSizeClasses) / sizeof(kSizeClasses[0]);
+
+    // LVGL font callbacks for the proxy fonts
+    static bool getGlyphDscCallback(const lv_font_t *font, lv_font_glyph_dsc_t *g_dsc,
+                                    uint32_t letter, uint32_t letter_next);
+    static const void *getGlyphBitmapCallback(lv_font_glyph_dsc_t *g_dsc,
+                                              lv_draw_buf_t *draw_buf);
+
+    const void *glyphBitmap(proxy_font_t *proxy, uint32_t codepoint, lv_draw_buf_t *draw_buf);
+    uint8_t *allocate(int size_class);
+    void carvePage(size_t page_index, int size_class);
+    void reclaimPage(size_t page_index);
+    void store(const glyph_key_t &key, const lv_draw_buf_t *draw_buf, uint16_t box_w,
+               uint16_t box_h);
+    void copyOut(const glyph_entry_t &entry, lv_draw_buf_t *draw_buf);
+
+    // Disallow access to copy and assignment constructors since don't want
+    // constructor called inadvertantly
+    GlyphCache(const GlyphCache &) = delete;
+    GlyphCache &operator=(const GlyphCache &) = delete;
+
+    const uint8_t bpp_;
+    uint8_t *memory_;
+    size_t pages_total_;
+    size_t pages_used_;
+    std::vector<uint8_t> page_classes_;  // size class each used page is assigned to
+    std::vector<uint16_t> page_glyphs_;  // number of glyphs stored in each page
+    std::vector<uint8_t *> free_slots_[kNumSizeClasses];
+
+    // Most recently used glyph is at the front
+    std::list<glyph_entry_t> lru_;
+    std::unordered_map<glyph_key_t, std::list<glyph_entry_t>::iterator, GlyphKeyHash> index_;
+    std::list<proxy_font_t> proxies_;
+    std::mutex mutex_;
+    stats_t stats_;
+};
+
+}  // namespace idfx
@@ -0,0 +1,91 @@
+/**
+ * LVGL image decoder for compressed idfx images. Images that are stored as raw RGB565 take
+ * too much flash, and decoding PNGs at runtime is slow and needs a lot of memory. Therefore
+ * images are compressed on the host by tools/idfx_image_pack.py using a simple run length
+ * encoding of RGB565 pixels, plus an optional alpha plane, that is very fast to decode.
+ *
+ * The packer generates an lv_image_dsc_t with color format LV_COLOR_FORMAT_RAW or
+ * LV_COLOR_FORMAT_RAW_ALPHA whose data starts with an idfx_image_header_t. Such an image
+ * can be used with lv_image_set_src() like any other image once ImageDecoder::install()
+ * has been called.
+ *
+ * Decoded images are kept in an LRU cache with a memory budget, in PSRAM if available, so
+ * that switching back to a screen doesn't require decoding again. Images too large for the
+ * budget are instead decoded a few lines at a time straight into the draw buffer.
+ *
+ * Data layout:
+ *   idfx_image_header_t
+ *   uint32_t line_offsets[height]   Offset of each encoded line from the start of the lines
+ *   encoded lines                   For each line the RGB565 pixels, then the alpha values
+ *                                   if has_alpha. Both are run length encoded.
+ *
+ * Run length encoding: a control byte is followed by either one value that is repeated,
+ * if the high bit of the control byte is set, or by literal values. The number of values
+ * is (control & 0x7F) + 1. A value is 2 bytes, little endian, for RGB565 and 1 byte for alpha.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "lvgl.h"
+
+namespace idfx {
+
+// Identifies the data as an idfx compressed image. "IDXI" in little endian.
+static const uint32_t kIdfxImageMagic = 0x49584449;
+
+typedef struct __attribute__((packed)) IdfxImageHeader {
+    uint32_t magic;
+    uint16_t width;
+    uint16_t height;
+    uint8_t has_alpha;    // 1 if there is an alpha plane
+    uint8_t compression;  // 0 for none, 1 for run length encoding
+    uint16_t reserved;
+} idfx_image_header_t;
+
+class ImageDecoder {
+   public:
+    // Cache statistics, so that the memory budget can be tuned
+    typedef struct CacheStats {
+        uint32_t hits;           // opens that found the decoded image in the cache
+        uint32_t misses;         // opens that had to decode the image
+        uint32_t line_decodes;   // opens for images too large to cache, decoded by lines
+        uint32_t evictions;      // decoded images removed to stay within the budget
+        size_t used_bytes;       // memory currently used by decoded images
+        size_t budget_bytes;     // maximum memory for decoded images
+    } cache_stats_t;
+
+    // Number of lines decoded at a time for images too large to be cached
+    static const int kLinesPerChunk = 8;
+
+    /**
+     * Registers the decoder with LVGL. Must be called after lv_init().
+     * @param cache_budget_bytes Maximum memory to use for caching decoded images
+     */
+    static void install(size_t cache_budget_bytes);
+
+    /**
+     * Returns the cache statistics
+     */
+    static cache_stats_t cacheStats();
+
+    /**
+     * Frees all decoded images that are not currently in use
+     */
+    static void clearCache();
+
+   private:
+    // LVGL decoder callbacks
+    static lv_result_t infoCallback(lv_image_decoder_t *decoder, lv_image_decoder_dsc_t *dsc,
+                                    lv_image_header_t *header);
+    static lv_result_t openCallback(lv_image_decoder_t *decoder, lv_image_decoder_dsc_t *dsc);
+    static lv_result_t getAreaCallback(lv_image_decoder_t *decoder, lv_image_decoder_dsc_t *dsc,
+                                       const lv_area_t *full_area, lv_area_t *decoded_area);
+    static void closeCallback(lv_image_decoder_t *decoder, lv_image_decoder_dsc_t *dsc);
+};
+
+}  // namespace idfx
@@ -0,0 +1,82 @@
+/**
+ * Memory backend for LVGL that uses pools of fixed size blocks instead of a general purpose
+ * heap. Over a long uptime the creating and deleting of widgets, styles, and draw tasks
+ * fragments LVGL's builtin TLSF heap, and allocation time grows as the heap fills up.
+ *
+ * Small allocations, which are most of what LVGL does, come from per size class slabs.
+ * Each size class has its own free list, so allocating and freeing is constant time and
+ * a freed block can always be reused for the same size class, so fragmentation doesn't
+ * grow. Slab pages are taken from internal RAM, since these small objects are accessed
+ * the most, until kMaxInternalSlabBytes is used, and then from PSRAM. Pages are never
+ * returned so that there is no allocation latency from repeatedly getting and releasing
+ * them. Allocations larger than the biggest size class, such as image and layer buffers,
+ * are taken from PSRAM if available.
+ *
+ * To use, set LV_USE_STDLIB_MALLOC to LV_STDLIB_CUSTOM, via CONFIG_LV_USE_CUSTOM_MALLOC in
+ * menuconfig. LVGL then calls lv_malloc_core() and the other functions defined in
+ * lvglAllocator.cpp. Nothing else needs to be done. stats() can be used to tune the size
+ * classes and to check for leaks.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace idfx {
+
+class LvglAllocator {
+   public:
+    // Block sizes, not including the 8 byte header each block has
+    constexpr static uint16_t kSizeClasses[] = {16, 32, 48, 64, 96, 128, 192, 256, 384, 512};
+    constexpr static int kNumSizeClasses = sizeof(kSizeClasses) / sizeof(kSizeClasses[0]);
+
+    // Size of the pages that are divided up into blocks of a size class
+    constexpr static size_t kPageSize = 4096;
+
+    // Slab pages are allocated from PSRAM once this much internal RAM is used for them
+    constexpr static size_t kMaxInternalSlabBytes = 64 * 1024;
+
+    typedef struct SizeClassStats {
+        uint16_t block_size;
+        uint16_t pages;
+        uint32_t blocks_total;
+        uint32_t blocks_used;
+        uint32_t blocks_used_max;
+        uint32_t allocs;
+    } size_class_stats_t;
+
+    typedef struct Stats {
+        size_class_stats_t classes[kNumSizeClasses];
+        size_t slab_bytes;            // memory in slab pages
+        size_t slab_internal_bytes;   // of which in internal RAM
+        size_t slab_used_bytes;       // requested bytes of the used blocks
+        uint32_t large_allocs;        // allocations larger than the biggest size class
+        uint32_t large_in_use;
+        size_t large_bytes;           // bytes currently in large allocations
+        size_t large_bytes_max;
+        size_t used_bytes_max;        // maximum requested bytes in use, slabs and large
+        uint32_t failures;            // allocations that returned nullptr
+    } stats_t;
+
+    /**
+     * Returns the allocation statistics
+     */
+    static stats_t stats();
+
+    /**
+     * Returns percentage of slab memory not used by the requested sizes. This is the
+     * fragmentation cost of using size classes instead of exact sizes, and includes free
+     * blocks. Does not increase with uptime since blocks are reused.
+     */
+    static float slabWastePercent();
+
+    /**
+     * Logs the statistics, one line per size class
+     */
+    static void logStats();
+};
+
+}  // namespace idfx
@@ -0,0 +1,126 @@
+/**
+ * Builder for sending a display update over SPI as a single batch of command and data
+ * phases. Display controllers need a data/command (DC) pin to be set for each phase,
+ * so each phase is a separate spi_transaction_t, but the bus is acquired only once while
+ * the batch is submitted. Small phases, like commands and their parameters, are sent using
+ * polling mode, which avoids the interrupt and semaphore overhead of queued transactions.
+ * Large phases, like the pixel data, are queued so that they are sent via DMA while the
+ * CPU continues rendering. The bus is released as soon as they are queued, so other
+ * devices on the bus are not blocked between display updates.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "freertos/FreeRTOS.h"
+
+namespace idfx {
+
+// Type definition for function called when the last phase of a batch has been sent.
+// Called from ISR for queued phases so must be short and IRAM safe.
+typedef void (*spi_complete_function_t)(void* arg);
+
+class SpiTransaction {
+   public:
+    // Maximum number of command and data phases in a batch. The SPI device must be
+    // configured with a queue_size of at least this.
+    static const size_t kMaxPhases = 8;
+
+    // Phases of up to this many bytes are sent with polling instead of being queued
+    static const size_t kPollingThresholdBytes = 32;
+
+    SpiTransaction();
+
+    /**
+     * Starts a new batch. Must not be called while a previous batch is still in progress.
+     * @param device The SPI device to send the batch to
+     * @param dc_pin The data/command pin of the display
+     */
+    void begin(spi_device_handle_t device, gpio_num_t dc_pin);
+
+    /**
+     * Adds a command phase, with the DC pin low
+     * @param cmd The command byte
+     */
+    SpiTransaction& command(uint8_t cmd);
+
+    /**
+     * Adds a data phase, with the DC pin high. If length is 4 bytes or less the data is
+     * copied. Otherwise the data must stay valid until wait() returns, and should be in
+     * DMA capable memory.
+     * @param data Pointer to the data
+     * @param length Number of bytes
+     */
+    SpiTransaction& data(const void* data, size_t length);
+
+    /**
+     * Specifies a function to be called once the last phase of the batch has been sent.
+     * For example, so that LVGL can be told that its draw buffer is free again.
+     * @param complete_function Function to call. Called from ISR if the phase was queued.
+     * @param arg Argument passed to the function
+     */
+    SpiTransaction& onComplete(spi_complete_function_t complete_function, void* arg);
+
+    /**
+     * Sends the phases of the batch. Returns once the small phases have been sent and the
+     * large ones have been queued, with the bus released again. wait() must be called
+     * before the next batch is begun.
+     * @return ESP_OK if successful
+     */
+    esp_err_t submit();
+
+    /**
+     * Waits for the queued phases to complete and collects their results.
+     * @param timeout How long to wait. Default is forever.
+     * @return ESP_OK if successful, or ESP_ERR_TIMEOUT
+     */
+    esp_err_t wait(TickType_t timeout = portMAX_DELAY);
+
+    /**
+     * Returns true if the batch has been submitted but wait() has not yet completed
+     */
+    bool inProgress() const {
+        return num_queued_ > 0;
+    }
+
+    /**
+     * Sets the DC pin for the phase. Must be configured as the pre_cb of the SPI device.
+     * Called from ISR for queued transactions.
+     * @param trans The transaction about to be sent
+     */
+    static void preTransferCallback(spi_transaction_t* trans);
+
+    /**
+     * Calls the onComplete() function once the last phase has been sent. Must be configured
+     * as the post_cb of the SPI device. Called from ISR for queued transactions.
+     * @param trans The transaction that was just sent
+     */
+    static void postTransferCallback(spi_transaction_t* trans);
+
+   private:
+    // Disallow access to copy and assignment constructors since queued transactions point into this object
+    SpiTransaction(const SpiTransaction& obj) = delete;
+    SpiTransaction& operator=(const SpiTransaction& obj) = delete;
+
+    /**
+     * Adds a phase to the batch. Returns nullptr if there are already kMaxPhases.
+     */
+    spi_transaction_t* addPhase(size_t length, bool is_data);
+
+    spi_device_handle_t device_;
+    gpio_num_t dc_pin_;
+    spi_transaction_t phases_[kMaxPhases];
+    uint8_t dc_levels_[kMaxPhases];  // level of DC pin for each phase
+    size_t num_phases_;
+    size_t num_queued_;
+    spi_complete_function_t complete_function_;
+    void* complete_arg_;
+};
+
+}  // namespace idfx
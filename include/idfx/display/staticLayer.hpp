@@ -0,0 +1,111 @@
+/**
+ * Caches the rendering of a container whose content rarely changes, such as a screen
+ * background with gradients, shadows and decorative widgets. Normally LVGL renders all of
+ * that again whenever something on top of it, such as a small animation, is invalidated.
+ *
+ * freeze() renders the container and its children once, using lv_snapshot, into a buffer
+ * in PSRAM if available. An lv_image sibling showing the buffer is placed at the same
+ * position and z-order, and the container is made fully transparent so that LVGL skips
+ * it when rendering. Redrawing the area is then just a blit of the cached buffer. The
+ * container keeps its place in any layout of its parent.
+ *
+ * Changes to the size, style or children of the container are detected and cause the
+ * cache to be re-rendered. Other changes, such as setting the text of a label within the
+ * container, require calling invalidate(). Elements that change often should be siblings
+ * on top of the container, not children of it.
+ *
+ * Requires LV_USE_SNAPSHOT. All methods must be called from the LVGL task.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "lvgl.h"
+
+namespace idfx {
+
+class StaticLayer {
+   public:
+    /**
+     * @param container The container whose rendering is to be cached
+     * @param has_alpha Set if the container is not fully opaque, so that what is behind it
+     * shows through. Uses ARGB8888 instead of RGB565, which doubles the memory needed.
+     */
+    StaticLayer(lv_obj_t *container, bool has_alpha = false);
+
+    ~StaticLayer();
+
+    /**
+     * Renders the container into the cache and shows the cached rendering instead of it
+     * @return True if successful. False if the buffer could not be allocated, in which
+     * case the container is rendered normally.
+     */
+    bool freeze();
+
+    /**
+     * Stops using the cache. The container is rendered normally again and the buffer freed.
+     */
+    void thaw();
+
+    /**
+     * Indicates that the content of the container has changed. The cache is re-rendered
+     * once, on the next LVGL timer cycle, no matter how many times this is called before.
+     */
+    void invalidate();
+
+    bool isFrozen() const {
+        return image_ != nullptr;
+    }
+
+    /**
+     * Number of times the container has been rendered into the cache
+     */
+    uint32_t renders() const {
+        return renders_;
+    }
+
+    /**
+     * Size in bytes of the cache buffer
+     */
+    size_t bufferBytes() const {
+        return buffer_size_;
+    }
+
+   private:
+    // Disallow access to copy and assignment constructors since the LVGL callbacks
+    // point to this object
+    StaticLayer(const StaticLayer &) = delete;
+    StaticLayer &operator=(const StaticLayer &) = delete;
+
+    /**
+     * Renders the container into the buffer and positions the image over it
+     */
+    bool render();
+
+    /**
+     * Container event callback for detecting changes
+     */
+    static void containerEventCallback(lv_event_t *event);
+
+    /**
+     * Called via lv_async_call() to re-render after invalidate()
+     */
+    static void asyncRender(void *arg);
+
+    lv_obj_t *container_;
+    lv_color_format_t color_format_;
+    lv_obj_t *image_;
+    lv_draw_buf_t draw_buf_;
+    void *buffer_;
+    size_t buffer_size_;
+    lv_opa_t container_opa_;
+    bool render_pending_;
+    bool rendering_;
+    uint32_t renders_;
+};
+
+}  // namespace idfx
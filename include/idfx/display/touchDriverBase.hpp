@@ -0,0 +1,194 @@
+/**
+ * Abstract base class for a touch controller driver that can be used as an LVGL input
+ * device
+ *
+ * Instead of LVGL polling the controller over I2C at the input device read rate, the INT
+ * output of the controller is registered via GpioInterrupteHandler. For each interrupt the
+ * GPIO interrupt task reads the coordinates from the controller in a single burst read and
+ * stores the latest point atomically. The LVGL read callback then only has to load the
+ * latest point, so it never blocks and there is no bus traffic while the panel isn't
+ * touched.
+ *
+ * Many controllers only pulse INT while touched and not when the finger is lifted. For
+ * these a release timeout is used: if no interrupt arrives within the timeout the touch
+ * is reported as released.
+ *
+ * A subclass implements init() to configure the controller and readTouch() to read the
+ * current touch point, typically using readRegisters().
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <atomic>
+
+#include "driver/i2c_master.h"
+#include "esp_timer.h"
+#include "idfx/hardware/interrupts.hpp"
+#include "lvgl.h"
+
+class TouchDriverBase {
+   public:
+    // A touch point in panel coordinates
+    typedef struct TouchPoint {
+        int16_t x;
+        int16_t y;
+        bool pressed;
+    } touch_point_t;
+
+    typedef struct TouchStats {
+        uint32_t interrupts;    // interrupts handled
+        uint32_t read_errors;   // reads of the controller that failed
+        uint32_t timeouts;      // releases detected by the release timeout
+        uint32_t max_read_usec; // longest time to read the controller
+    } touch_stats_t;
+
+    /**
+     * @param width Width of the display in pixels, for mirroring
+     * @param height Height of the display in pixels, for mirroring
+     */
+    TouchDriverBase(int width, int height);
+
+    virtual ~TouchDriverBase();
+
+    /**
+     * Creates the LVGL pointer input device for the touch controller. It is registered
+     * with DisplayService::addWakingInput() since each touch interrupt wakes the service.
+     * Needs to be called with the DisplayService lock held.
+     * @param display The display the input is for. Default is the default display.
+     * @return The LVGL input device
+     */
+    lv_indev_t *createLvglInput(lv_display_t *display = nullptr);
+
+    /**
+     * Specifies how controller coordinates map to display coordinates. Swapping is done
+     * before mirroring.
+     */
+    void setTransform(bool swap_xy, bool mirror_x, bool mirror_y);
+
+    /**
+     * Sets how long after the last interrupt a touch is reported as released. Use 0 for
+     * controllers that also interrupt on release. Default is 50 msec.
+     */
+    void setReleaseTimeout(uint32_t msec) {
+        release_timeout_usec_ = msec * 1000;
+    }
+
+    /**
+     * Returns the most recent touch point. Doesn't access the controller.
+     */
+    touch_point_t latestPoint() const;
+
+    touch_stats_t touchStats() const {
+        return stats_;
+    }
+
+   protected:
+    /**
+     * Configures the touch controller
+     */
+    virtual void init() = 0;
+
+    /**
+     * Reads the current touch point from the controller, in controller coordinates.
+     * Called from the GPIO interrupt task for each interrupt, so should use a single burst
+     * read. Must also clear the interrupt of the controller if it requires that.
+     * @param point Set to the touch point
+     * @return True if successfully read
+     */
+    virtual bool readTouch(touch_point_t &point) = 0;
+
+    /**
+     * Registers the INT pin of the controller via GpioInterrupteHandler. Most controllers
+     * pull INT low so the default is falling edge with the pull up enabled. For controllers
+     * that hold INT low until read use GPIO_INTR_LOW_LEVEL. A level interrupt is only
+     * re-armed once the controller has been read successfully. After a failed read it is
+     * re-armed after a backoff so that a stuck INT doesn't cause an interrupt storm. The
+     * pin is configured as input only.
+     * @param int_pin The GPIO pin connected to INT of the controller
+     * @param intr_type Type of interrupt
+     */
+    void attachInterrupt(idfx::GPIONum int_pin, gpio_int_type_t intr_type = GPIO_INTR_NEGEDGE);
+
+    /**
+     * For I2C controllers. Adds the controller as a device on the I2C bus, which must
+     * already have been created with i2c_new_master_bus().
+     * @param bus The I2C bus
+     * @param address 7 bit address of the controller
+     * @param scl_speed_hz Default is 400kHz
+     * @return ESP_OK if successful
+     */
+    esp_err_t attachI2c(i2c_master_bus_handle_t bus, uint16_t address,
+                        uint32_t scl_speed_hz = 400000);
+
+    /**
+     * Reads consecutive registers with a single I2C transaction: the register address is
+     * written and then the data read after a repeated start.
+     * @param reg The first register
+     * @param reg_len Size of register address, 1 or 2 bytes. 2 byte addresses are sent
+     * most significant byte first.
+     * @param data Where to put the data
+     * @param length Number of bytes to read
+     * @return ESP_OK if successful
+     */
+    esp_err_t readRegisters(uint16_t reg, size_t reg_len, uint8_t *data, size_t length);
+
+    /**
+     * Writes a register
+     * @param reg The register
+     * @param reg_len Size of register address, 1 or 2 bytes
+     * @param value The value to write
+     * @return ESP_OK if successful
+     */
+    esp_err_t writeRegister(uint16_t reg, size_t reg_len, uint8_t value);
+
+   private:
+    // Disallow access to copy and assignment constructors since don't want
+    // constructor called inadvertantly
+    TouchDriverBase(const TouchDriverBase &) = delete;
+    TouchDriverBase &operator=(const TouchDriverBase &) = delete;
+
+    /**
+     * Called by the GPIO interrupt task for each interrupt from the controller
+     * @param gpio_num The INT pin
+     */
+    static void interruptHandler(int gpio_num);
+
+    /**
+     * The LVGL read callback. Only loads the latest point so never blocks.
+     */
+    static void lvglReadCallback(lv_indev_t *indev, lv_indev_data_t *data);
+
+    /**
+     * Reads the controller and stores the transformed point
+     */
+    void handleInterrupt();
+
+    /**
+     * Re-arms the level interrupt once the backoff after a failed read has elapsed
+     */
+    static void rearmTimerCallback(void *arg);
+
+    // Point packed as x in bits 16-31, y in bits 1-15, and pressed in bit 0 so
+    // that it can be stored and loaded atomically
+    static uint32_t pack(const touch_point_t &point);
+    static touch_point_t unpack(uint32_t packed);
+
+    int width_;
+    int height_;
+    bool swap_xy_;
+    bool mirror_x_;
+    bool mirror_y_;
+    uint32_t release_timeout_usec_;
+    gpio_num_t int_pin_;
+    esp_timer_handle_t rearm_timer_;
+    uint32_t rearm_backoff_usec_;
+
+    std::atomic<uint32_t> latest_point_;
+    std::atomic<uint32_t> last_interrupt_usec_;
+    touch_stats_t stats_;
+
+    lv_indev_t *lv_indev_;
+    i2c_master_dev_handle_t i2c_device_;
+};
@@ -0,0 +1,140 @@
+/**
+ * Scheduler for changing outputs at exact future times, such as firing a solenoid 1250 usec
+ * after a zero-cross interrupt. Sleeping in a task until the time gives hundreds of usec of
+ * jitter due to task scheduling. Instead the actions are kept in a queue sorted by time and
+ * a single GPTimer alarm is set for the earliest one. The actions are done in the IRAM
+ * alarm ISR, so they happen within a few usec of the requested time, no matter how many
+ * actions are outstanding.
+ *
+ * An action can set or clear an OutputBit, set the duty of an OutputPWM, or call a function.
+ * Called functions run in the ISR so they need to be short and IRAM safe.
+ *
+ * Times are in usec of the scheduler's own timer, as returned by now(). Actions can be
+ * scheduled from tasks or from ISRs, such as from a GPIO interrupt handler.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "driver/gptimer.h"
+#include "freertos/FreeRTOS.h"
+#include "idfx/hardware/io.hpp"
+
+namespace idfx {
+
+class ActionScheduler {
+   public:
+    /* Function called from the ISR at the scheduled time */
+    typedef void (*action_function_t)(void *arg);
+
+    typedef struct Stats {
+        uint32_t scheduled;      // actions successfully added
+        uint32_t executed;       // actions done
+        uint32_t dropped;        // actions not added because the queue was full
+        uint32_t max_late_usec;  // latest an action was done compared to its time
+    } stats_t;
+
+    /**
+     * Creates the scheduler and starts its timer.
+     * @param capacity Maximum number of outstanding actions. The queue is allocated up
+     * front in internal RAM so that it can be used from ISRs. Default is 32.
+     */
+    ActionScheduler(uint16_t capacity = 32);
+
+    ~ActionScheduler();
+
+    /**
+     * Returns current time of the scheduler's timer, in usec
+     */
+    uint64_t now() const;
+
+    /**
+     * Schedules setting the output bit at the specified time. The bit must be a GPIO pin,
+     * not a pin on an IO expander. Returns false if queue is full.
+     * @param at_usec When to set the bit, in terms of now(). If already in the past then
+     * the bit is set as soon as possible.
+     */
+    bool setBitAt(uint64_t at_usec, const OutputBit &bit, bool on);
+
+    /**
+     * Schedules setting the duty value of the PWM output at the specified time. Returns
+     * false if queue is full.
+     */
+    bool setDutyAt(uint64_t at_usec, OutputPWM &pwm, uint32_t duty);
+
+    /**
+     * Schedules calling the function from the timer ISR at the specified time. Returns
+     * false if queue is full.
+     */
+    bool callAt(uint64_t at_usec, action_function_t function, void *arg = nullptr);
+
+    /**
+     * Removes all outstanding actions without doing them
+     */
+    void cancelAll();
+
+    /**
+     * Returns number of outstanding actions
+     */
+    uint16_t pending() const {
+        return size_;
+    }
+
+    stats_t stats() const {
+        return stats_;
+    }
+
+   private:
+    // Disallow access to copy and assignment constructors since don't want constructor called inadvertantly
+    ActionScheduler(const ActionScheduler &obj) = delete;
+    ActionScheduler &operator=(const ActionScheduler &obj) = delete;
+
+    typedef enum ActionType : uint8_t {
+        kSetBit,
+        kSetDuty,
+        kCall,
+    } action_type_t;
+
+    typedef struct Action {
+        uint64_t at_usec;
+        action_type_t type;
+        union {
+            const OutputBit *bit;
+            OutputPWM *pwm;
+            action_function_t function;
+        };
+        union {
+            uint32_t value;
+            void *arg;
+        };
+    } action_t;
+
+    /**
+     * Adds the action to the queue and, if it is now the earliest one, moves the alarm
+     */
+    bool push(const action_t &action);
+
+    /**
+     * Sets the alarm for the earliest action, or disables the alarm if there are none.
+     * Needs to be called with lock_ held.
+     */
+    void setAlarm();
+
+    static void doAction(const action_t &action);
+
+    static bool onAlarm(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata,
+                        void *user_ctx);
+
+    // Min-heap ordered by at_usec, in internal RAM
+    action_t *heap_;
+    const uint16_t capacity_;
+    volatile uint16_t size_;
+    portMUX_TYPE lock_;
+    gptimer_handle_t timer_;
+    stats_t stats_;
+};
+
+}  // namespace idfx
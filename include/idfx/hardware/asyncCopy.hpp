@@ -0,0 +1,192 @@
+/**
+ * Asynchronous memory copies using the DMA memory-to-memory engine (esp_async_memcpy), so
+ * that the CPU can continue rendering while bulk copies, such as between PSRAM frame
+ * buffers and internal staging buffers, run in hardware. A copy can consist of multiple
+ * segments, such as the rows of a rectangular area, which are all submitted at once.
+ *
+ * Segments that are small, or that the DMA engine can't handle because of the memory they
+ * are in, are copied by the CPU instead. Segments that the DMA engine rejects, such as
+ * because of their alignment, are also copied by the CPU, but by the submitting task in
+ * submit() or wait() and not in the ISR. If there are more DMA segments
+ * than the backlog of the driver, the rest are queued from the completion callback of
+ * earlier ones, so a large area with many rows is still copied entirely by DMA. With
+ * CONFIG_IDFX_IRAM_SAFE this requires CONFIG_MCP_CTRL_FUNC_IN_IRAM so that
+ * esp_async_memcpy() can be called from the ISR. On chips without an async
+ * memcpy engine, such as the original ESP32, all segments are copied by the CPU so code
+ * using AsyncCopy still works.
+ *
+ * Usage:
+ *   AsyncCopy::initialize();
+ *   AsyncCopy copy;
+ *   copy.begin().add(dest, src, size).submit();
+ *   ... do other work ...
+ *   copy.wait();
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "soc/soc_caps.h"
+
+#if SOC_ASYNC_MEMCPY_SUPPORTED
+#include "esp_async_memcpy.h"
+#endif
+
+namespace idfx {
+
+// Type definition for function called when all segments of a copy have completed.
+// Can be called from ISR so must be short and IRAM safe.
+typedef void (*copy_complete_function_t)(void* arg);
+
+class AsyncCopy {
+   public:
+    typedef struct Stats {
+        uint32_t dma_segments;  // segments copied by the DMA engine
+        uint32_t cpu_segments;  // segments copied by the CPU
+        uint64_t dma_bytes;
+        uint64_t cpu_bytes;
+    } stats_t;
+
+    // Segments smaller than this are copied by the CPU since the DMA setup costs more
+    constexpr static size_t kCpuThresholdBytes = 256;
+
+    /**
+     * Installs the async memcpy driver. Should be called once at startup. If not called,
+     * or if the chip doesn't support it, all copies are done by the CPU.
+     * @param backlog Maximum number of DMA segments that can be in flight at once
+     * @return ESP_OK if successful
+     */
+    static esp_err_t initialize(uint32_t backlog = 16);
+
+    /**
+     * Returns statistics for all copies
+     */
+    static stats_t stats();
+
+    /**
+     * Synchronous copy. Uses the DMA engine for large copies and waits for completion.
+     */
+    static void copy(void* dest, const void* src, size_t size);
+
+    AsyncCopy();
+
+    ~AsyncCopy();
+
+    /**
+     * Starts a new copy. Must not be called while a previous copy is still in progress.
+     */
+    AsyncCopy& begin();
+
+    /**
+     * Adds a segment to the copy. Source and destination must stay valid until wait()
+     * returns.
+     */
+    AsyncCopy& add(void* dest, const void* src, size_t size);
+
+    /**
+     * Adds the rows of a rectangular area as segments. If the rows are contiguous in both
+     * buffers then a single segment is added.
+     * @param dest Destination of first row
+     * @param dest_stride Bytes between rows of the destination
+     * @param src Source of first row
+     * @param src_stride Bytes between rows of the source
+     * @param row_bytes Bytes to copy per row
+     * @param rows Number of rows
+     */
+    AsyncCopy& addRect(void* dest, size_t dest_stride, const void* src, size_t src_stride,
+                       size_t row_bytes, size_t rows);
+
+    /**
+     * Specifies a function to be called once all segments have been copied. If the DMA
+     * engine rejected a segment after submit() returned then that is only once wait() has
+     * copied it.
+     * @param complete_function Function to call. Can be called from ISR.
+     * @param arg Argument passed to the function
+     */
+    AsyncCopy& onComplete(copy_complete_function_t complete_function, void* arg);
+
+    /**
+     * Starts the copy. The DMA segments are queued first, then the CPU segments are copied,
+     * so this returns once the CPU segments are done.
+     * @return ESP_OK if successful
+     */
+    esp_err_t submit();
+
+    /**
+     * Waits for all segments to complete. Segments that the DMA engine rejected after
+     * submit() returned are copied by the CPU here.
+     * @param timeout How long to wait. Default is forever.
+     * @return ESP_OK if successful, or ESP_ERR_TIMEOUT
+     */
+    esp_err_t wait(TickType_t timeout = portMAX_DELAY);
+
+    /**
+     * Returns true if submitted but wait() has not yet completed
+     */
+    bool inProgress() const {
+        return in_progress_;
+    }
+
+   private:
+    typedef struct Segment {
+        void* dest;
+        const void* src;
+        size_t size;
+        volatile bool rejected;  // rejected by the DMA engine so to be copied by the CPU
+    } segment_t;
+
+    // Disallow access to copy and assignment constructors since queued segments point to this object
+    AsyncCopy(const AsyncCopy& obj) = delete;
+    AsyncCopy& operator=(const AsyncCopy& obj) = delete;
+
+    /**
+     * Returns true if the DMA engine should be tried for the segment
+     */
+    static bool useDma(const segment_t& segment);
+
+    /**
+     * Queues the next DMA segment that hasn't been queued yet. If the DMA engine rejects
+     * it, it is marked for copyRejectedSegments() and the following one is tried, so that
+     * a segment completing always leads to the next one being queued. Returns true if a
+     * higher priority task was woken.
+     * @param from_isr True if called from the DMA completion ISR
+     */
+    bool queueNextDmaSegment(bool from_isr);
+
+    /**
+     * Copies the segments that the DMA engine rejected with the CPU. Called from the task
+     * by submit() and wait() since copying in the ISR would block interrupts for too long.
+     */
+    void copyRejectedSegments();
+
+    /**
+     * Marks one outstanding part of the copy as done. The last one calls the complete
+     * function and wakes up wait(). Returns true if a higher priority task was woken.
+     */
+    bool partDone(bool from_isr);
+
+#if SOC_ASYNC_MEMCPY_SUPPORTED
+    static bool dmaDoneCallback(async_memcpy_handle_t mcp, async_memcpy_event_t* event,
+                                void* arg);
+#endif
+
+    std::vector<segment_t> segments_;
+    std::vector<segment_t*> dma_segments_;
+    std::atomic<size_t> next_dma_segment_;  // index into dma_segments_ of next to queue
+    std::atomic<int> pending_;
+    bool in_progress_;
+    SemaphoreHandle_t done_semaphore_;
+    copy_complete_function_t complete_function_;
+    void* complete_arg_;
+};
+
+}  // namespace idfx
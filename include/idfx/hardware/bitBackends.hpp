@@ -0,0 +1,228 @@
+/**
+ * Backends for the statically dispatched StaticOutputBit and StaticInputBit. Each backend is
+ * a concrete class, without virtual functions, so that when a bit is templated on it the
+ * compiler can inline the accesses. All backends provide:
+ *   void configAsOutput(uint8_t bit)
+ *   void configAsInput(uint8_t bit)
+ *   void write(uint8_t bit, bool on)
+ *   bool read(uint8_t bit)
+ *   void beginBatch() and void endBatch()
+ *
+ * Writes done between beginBatch() and endBatch() are coalesced, so setting several bits on
+ * the same device results in a single I2C transaction, shift register update, or pair of
+ * GPIO register writes. Use BitBatch, in staticBits.hpp, to do this via RAII.
+ *
+ * The expander backends keep a shadow copy of the output register so that writes that
+ * don't change anything are skipped. As with the IOExpander based bits they are not
+ * thread safe, so a device should only be accessed from one task.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "driver/gpio.h"
+#include "driver/i2c_master.h"
+#include "esp_err.h"
+#include "hal/gpio_ll.h"
+#include "soc/gpio_struct.h"
+#include "soc/soc_caps.h"
+
+namespace idfx {
+
+/**
+ * Native ESP32 GPIO pins. Bits are the GPIO numbers. A batch of writes is applied using
+ * just the set and clear registers.
+ */
+class NativeGpio {
+   public:
+    NativeGpio() : set_mask_(0), clear_mask_(0), batch_depth_(0) {}
+
+    void configAsOutput(uint8_t bit);
+
+    void configAsInput(uint8_t bit);
+
+    void write(uint8_t bit, bool on) {
+        if (batch_depth_ == 0) {
+            gpio_ll_set_level(GPIO_LL_GET_HW(GPIO_PORT_0), (gpio_num_t)bit, on);
+            return;
+        }
+        const uint64_t mask = 1ULL << bit;
+        if (on) {
+            set_mask_ |= mask;
+            clear_mask_ &= ~mask;
+        } else {
+            clear_mask_ |= mask;
+            set_mask_ &= ~mask;
+        }
+    }
+
+    bool read(uint8_t bit) const {
+        return gpio_ll_get_level(GPIO_LL_GET_HW(GPIO_PORT_0), (gpio_num_t)bit);
+    }
+
+    void beginBatch() {
+        batch_depth_++;
+    }
+
+    void endBatch() {
+        if (--batch_depth_ > 0) return;
+
+        GPIO.out_w1tc = (uint32_t)clear_mask_;
+        GPIO.out_w1ts = (uint32_t)set_mask_;
+#if SOC_GPIO_PIN_COUNT > 32
+        GPIO.out1_w1tc.val = (uint32_t)(clear_mask_ >> 32);
+        GPIO.out1_w1ts.val = (uint32_t)(set_mask_ >> 32);
+#endif
+        set_mask_ = 0;
+        clear_mask_ = 0;
+    }
+
+   private:
+    uint64_t set_mask_;
+    uint64_t clear_mask_;
+    int batch_depth_;
+};
+
+/**
+ * Shadow copy and batching of an output register, shared by the expander backends. Uses
+ * CRTP so that Derived::writeOutputs() is called without a virtual call.
+ */
+template <typename Derived, typename Register>
+class ShadowedOutputs {
+   public:
+    void write(uint8_t bit, bool on) {
+        const Register mask = (Register)1 << bit;
+        const Register outputs = on ? outputs_ | mask : outputs_ & ~mask;
+        if (outputs == outputs_) return;
+
+        outputs_ = outputs;
+        if (batch_depth_ == 0) {
+            static_cast<Derived *>(this)->writeOutputs(outputs_);
+        } else {
+            dirty_ = true;
+        }
+    }
+
+    void beginBatch() {
+        batch_depth_++;
+    }
+
+    void endBatch() {
+        if (--batch_depth_ > 0 || !dirty_) return;
+
+        dirty_ = false;
+        static_cast<Derived *>(this)->writeOutputs(outputs_);
+    }
+
+   protected:
+    ShadowedOutputs(Register initial) : outputs_(initial), batch_depth_(0), dirty_(false) {}
+
+    Register outputs_;
+    int batch_depth_;
+    bool dirty_;
+};
+
+/**
+ * PCA9557 8 bit I2C IO expander. https://www.ti.com/lit/ds/symlink/pca9557.pdf
+ * The polarity inversion register is set to 0 instead of the hardware default of 0xF0.
+ */
+class Pca9557 : public ShadowedOutputs<Pca9557, uint8_t> {
+   public:
+    static const uint8_t kDefaultAddress = 0x18;
+
+    Pca9557(i2c_master_bus_handle_t bus, uint8_t address = kDefaultAddress,
+            uint32_t scl_speed_hz = 400000);
+
+    ~Pca9557();
+
+    void configAsOutput(uint8_t bit);
+
+    void configAsInput(uint8_t bit);
+
+    bool read(uint8_t bit);
+
+   private:
+    friend class ShadowedOutputs<Pca9557, uint8_t>;
+
+    // Disallow access to copy and assignment constructors since don't want constructor called inadvertantly
+    Pca9557(const Pca9557 &obj) = delete;
+    Pca9557 &operator=(const Pca9557 &obj) = delete;
+
+    void writeOutputs(uint8_t outputs);
+
+    i2c_master_dev_handle_t i2c_device_;
+    uint8_t config_;  // 1 bits are inputs
+};
+
+/**
+ * MCP23017 16 bit I2C IO expander. https://ww1.microchip.com/downloads/en/devicedoc/20001952c.pdf
+ * Bits 0-7 are port A and bits 8-15 are port B. Used with the default IOCON.BANK=0 so that
+ * both ports are written in a single transaction.
+ */
+class Mcp23017 : public ShadowedOutputs<Mcp23017, uint16_t> {
+   public:
+    static const uint8_t kDefaultAddress = 0x20;
+
+    Mcp23017(i2c_master_bus_handle_t bus, uint8_t address = kDefaultAddress,
+             uint32_t scl_speed_hz = 400000);
+
+    ~Mcp23017();
+
+    void configAsOutput(uint8_t bit);
+
+    void configAsInput(uint8_t bit);
+
+    bool read(uint8_t bit);
+
+   private:
+    friend class ShadowedOutputs<Mcp23017, uint16_t>;
+
+    // Disallow access to copy and assignment constructors since don't want constructor called inadvertantly
+    Mcp23017(const Mcp23017 &obj) = delete;
+    Mcp23017 &operator=(const Mcp23017 &obj) = delete;
+
+    void writeOutputs(uint16_t outputs);
+
+    void writeRegisterPair(uint8_t reg, uint16_t value);
+
+    i2c_master_dev_handle_t i2c_device_;
+    uint16_t iodir_;  // 1 bits are inputs
+};
+
+/**
+ * Chain of up to four 74HC595 serial-in parallel-out shift registers, driven by bit banging
+ * the data, clock, and latch pins. Bit 0 is output QA of the first register in the chain.
+ * Output only, so configAsInput() is not supported and read() returns the output state.
+ */
+class ShiftRegister595 : public ShadowedOutputs<ShiftRegister595, uint32_t> {
+   public:
+    ShiftRegister595(gpio_num_t data_pin, gpio_num_t clock_pin, gpio_num_t latch_pin,
+                     uint8_t num_chips = 1);
+
+    void configAsOutput(uint8_t bit) {}
+
+    void configAsInput(uint8_t bit);
+
+    bool read(uint8_t bit) const {
+        return (outputs_ >> bit) & 1;
+    }
+
+   private:
+    friend class ShadowedOutputs<ShiftRegister595, uint32_t>;
+
+    // Disallow access to copy and assignment constructors since don't want constructor called inadvertantly
+    ShiftRegister595(const ShiftRegister595 &obj) = delete;
+    ShiftRegister595 &operator=(const ShiftRegister595 &obj) = delete;
+
+    void writeOutputs(uint32_t outputs);
+
+    const gpio_num_t data_pin_;
+    const gpio_num_t clock_pin_;
+    const gpio_num_t latch_pin_;
+    const uint8_t num_chips_;
+};
+
+}  // namespace idfx
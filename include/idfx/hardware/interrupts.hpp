@@ -13,6 +13,8 @@
 #pragma once
 
 #include "driver/gpio.h"
+#include "esp_intr_alloc.h"
+#include "idfx/utils/iram.hpp"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
@@ -28,10 +30,34 @@ typedef void (*isr_function_t)(int);
  * For configuring an input GPIO bit as an interrupt so that a specified
  * static function is called.
  *
- * GpioInterrupteHandler is a singleton. Therefore all members are static.
+ * The GPIO interrupt is allocated on the core that installs the GPIO ISR service.
+ * By default this is the core that constructs the first GpioInterrupteHandler. To
+ * control which core and interrupt level is used call GpioInterrupteHandler::initialize()
+ * before any handlers are constructed. This way input latency can be isolated on the
+ * core that is not busy with WiFi or LVGL.
  */
 class GpioInterrupteHandler {
    public:
+    /**
+     * Installs the GPIO ISR service and starts the GPIO interrupt task, both pinned to the
+     * specified core. Blocks until the service has actually been installed so that handlers
+     * can be added deterministically afterwards. Should be called once, before the first
+     * GpioInterrupteHandler is constructed. If it is not called then the constructor does
+     * the initialization using the defaults.
+     * @param core_id Core that the interrupt is to be allocated on. Default of tskNO_AFFINITY
+     * means that the core of the calling task is used.
+     * @param intr_alloc_flags Flags for allocating the interrupt. Default is ESP_INTR_FLAG_LOWMED,
+     * plus ESP_INTR_FLAG_IRAM if CONFIG_IDFX_IRAM_SAFE is set so that the interrupt is still
+     * serviced while the flash cache is disabled. Note that cannot use a level higher than ESP_INTR_FLAG_LOWMED
+     * since then the ISR would have to be written in assembly language.
+     * @param task_priority Priority of the GPIO interrupt task. Default is 10.
+     * @return ESP_OK if successful, ESP_ERR_INVALID_STATE if already initialized, or the
+     * error returned by gpio_install_isr_service().
+     */
+    static esp_err_t initialize(BaseType_t core_id = tskNO_AFFINITY,
+                                int intr_alloc_flags = ESP_INTR_FLAG_LOWMED | IDFX_INTR_FLAG_IRAM,
+                                UBaseType_t task_priority = 10);
+
     /**
      * Configures the specified GPIO interrupt bit to call individual_isr_for_bit()
      * when triggered.
@@ -45,12 +71,44 @@ class GpioInterrupteHandler {
      * can be GPIO_PULLUP_DISABLE or GPIO_PULLUP_ENABLE. Default is GPIO_PULLUP_DISABLE
      * @param pull_down_en Whether pull down resister should be enabled. A gpio_pulldown_t so
      * can be GPIO_PULLDOWN_DISABLE or GPIO_PULLDOWN_ENABLE. Default is GPIO_PULLDOWN_ENABLE
+     * @param rearm_after_handler Only used for GPIO_INTR_LOW_LEVEL and GPIO_INTR_HIGH_LEVEL.
+     * A level interrupt is masked in the ISR so that it doesn't keep refiring while the level
+     * holds. If true (the default) it is re-armed once individual_isr_for_bit() returns. If
+     * false then individual_isr_for_bit(), or something it triggers, must call acknowledge()
+     * once the source of the interrupt has been cleared.
      */
     GpioInterrupteHandler(GPIONum gpio_num,
                           isr_function_t individual_isr_for_bit,
                           gpio_int_type_t intr_type = GPIO_INTR_POSEDGE,
                           gpio_pullup_t pull_up_en = GPIO_PULLUP_DISABLE,
-                          gpio_pulldown_t pull_down_en = GPIO_PULLDOWN_ENABLE);
+                          gpio_pulldown_t pull_down_en = GPIO_PULLDOWN_ENABLE,
+                          bool rearm_after_handler = true);
+
+    /**
+     * Re-arms a level triggered interrupt that was masked by the ISR. Only needs to be
+     * called if the handler was created with rearm_after_handler set to false. Does
+     * nothing for edge triggered interrupts.
+     * @param gpio_num The GPIO pin number, as passed to the handler function.
+     */
+    static void acknowledge(int gpio_num);
+
+    /**
+     * @return Number of interrupt events that the ISR couldn't queue because the queue to
+     * the GPIO task was full. These are still handled, once the task has caught up, but
+     * several events for the same pin are then handled only once. A non-zero value means
+     * the handlers are not keeping up.
+     */
+    static uint32_t droppedEvents();
+
+    /**
+     * Returns when the ISR was most recently called for the pin. Since it is recorded in the
+     * ISR it is more accurate than reading the time in the handler function, which is called
+     * later by the GPIO task. If several interrupts occur before the handler runs then this
+     * is the time of the latest one.
+     * @param gpio_num The GPIO pin number, as passed to the handler function.
+     * @return Time in microseconds, as esp_timer_get_time() truncated to 32 bits
+     */
+    static uint32_t interruptTimeUsec(int gpio_num);
 };
 
 }  // end of namespace idfx
\ No newline at end of file
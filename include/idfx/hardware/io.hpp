@@ -6,12 +6,17 @@
 
 #pragma once
 
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "driver/ledc.h"
 #include "esp_err.h"
+#include "esp_timer.h"
 #include "esp-idf-cxx/gpio_cxx.hpp"
 #include "idfx/hardware/ioExpander.hpp"
+#include "idfx/hardware/outputPWMBase.hpp"
 #include "idfx/utils/log.hpp"
 
 namespace idfx {
@@ -81,11 +86,20 @@ class OutputBit {
      */
     bool get() const;
 
+    /**
+     * Sets a native GPIO output directly, without logging. Safe to call from an ISR, and if
+     * CONFIG_IDFX_IRAM_SAFE is set also while the flash cache is disabled. Does nothing for
+     * IO expander bits since those need the I2C bus.
+     * @param on true to set HIGH, false to set LOW.
+     */
+    void setFast(bool on) const;
+
    private:
     const GPIONum pin_;
     const std::string bit_name_;
     const GPIO_Output* gpio_output_ptr_;
     const IOExpander* io_expander_ptr_;
+    const gpio_num_t gpio_num_;  // GPIO_NUM_NC if on an IO expander
 };
 
 /**
@@ -120,39 +134,82 @@ class InputBit {
      */
     bool get() const;
 
+    /**
+     * Reads a native GPIO input directly, without logging. Safe to call from an ISR, and if
+     * CONFIG_IDFX_IRAM_SAFE is set also while the flash cache is disabled. Returns false for
+     * IO expander bits since those need the I2C bus.
+     * @return true if the pin is HIGH, false if it is LOW.
+     */
+    bool getFast() const;
+
+    /**
+     * Returns the GPIO number, or GPIO_NUM_NC if the bit is on an IO expander
+     */
+    gpio_num_t gpioNum() const {
+        return gpio_num_;
+    }
+
    private:
     const GPIONum pin_;
     const std::string bit_name_;
     const GPIOInput* gpio_input_ptr_;
     const IOExpander* io_expander_ptr_;
+    const gpio_num_t gpio_num_;  // GPIO_NUM_NC if on an IO expander
 };
 
+// Forward declaration since PWMTimer keeps track of the OutputPWMs that use it
+class OutputPWM;
+
 /**
  * There are multiple timers built into the ESP32. The number is specified by LEDC_TIMER_MAX,
  * which is 4 for the ES32S3. Timers can be shared between GPIO outputs, but since the timer
  * sets the frequency of the output all of the GPIO outputs will share that frequency. If
  * specific timer not specified then LEDC_TIMER_0 will be used. And if the frequency is not
  * specified then the default of kDefaultFrequency=1000hz will be used.
+ *
+ * The original ESP32 has, in addition to the low speed group, a high speed group with its
+ * own timers and channels, where duty updates are latched by hardware at the end of the
+ * period and are therefore glitch free. The speed modes are treated as separate pools of
+ * timers and channels, which doubles the number of PWM outputs. getAvailableTimer() uses
+ * the high speed group first. On chips with only low speed mode, LEDC_SPEED_MODE_MAX is 1
+ * so there is just the one pool.
+ *
+ * By default the outputs that share a timer have their phases staggered. Instead of all
+ * switching on at the start of the period, at the same instant, the start points (hpoint)
+ * are spread evenly across the period. This reduces the peak current drawn, and therefore
+ * supply ripple and EMI, while not changing the duty of any output.
+ *
+ * The timer also drives the temporal dithering of its outputs. When any of its outputs
+ * have dithering enabled a shared esp_timer steps through the precomputed dither patterns
+ * at the PWM frequency, limited to kMaxDitherRateHz.
  */
 class PWMTimer {
-    const static uint32_t kDefaultFrequency = 1000;
+    // Dither steps are done by an esp_timer, so limit the rate to keep the CPU cost low
+    constexpr static uint32_t kMaxDitherRateHz = 2000;
 
    public:
+    const static uint32_t kDefaultFrequency = 1000;
+
     /**
      * Provides a timer that isn't already being used. If none available then returns nullptr.
      * Intended to be easier to use than the constructor.
      * @param freq_hz the initial frequency for the timer
+     * @param speed_mode the speed mode group to use. Default of LEDC_SPEED_MODE_MAX means
+     * any group, with the high speed group, if the chip has one, tried first.
      * @return pointer to a PWMTimer, or nullptr if none are available
      */
-    static PWMTimer* getAvailableTimer(const uint32_t freq_hz = kDefaultFrequency);
+    static PWMTimer* getAvailableTimer(const uint32_t freq_hz = kDefaultFrequency,
+                                       const ledc_mode_t speed_mode = LEDC_SPEED_MODE_MAX);
 
     /**
      * For if one wants a specific timer, one that already might be in use.
      * @param timer_num the number of the timer to use
      * @param freq_hz the initial frequency for the timer
+     * @param speed_mode the speed mode group of the timer. Default is LEDC_LOW_SPEED_MODE.
      * @return pointer to a PWMTimer
      */
-    static PWMTimer* getTimer(const ledc_timer_t timer_num, const uint32_t freq_hz = kDefaultFrequency);
+    static PWMTimer* getTimer(const ledc_timer_t timer_num, const uint32_t freq_hz = kDefaultFrequency,
+                              const ledc_mode_t speed_mode = LEDC_LOW_SPEED_MODE);
 
     /**
      * Releases reference to timer. Will destruct timer if there are no more references to it
@@ -166,6 +223,31 @@ class PWMTimer {
      */
     void setFrequency(const uint32_t freq_hz);
 
+    /**
+     * Enables or disables staggering the phases of the outputs that use this timer.
+     * Enabled by default. When disabled all outputs switch on at start of the period.
+     * @param enabled true to spread the start points of the outputs across the period
+     */
+    void setPhaseStaggering(const bool enabled);
+
+    /**
+     * Registers an output as using this timer so that the phases of all the outputs
+     * can be redistributed. Called by OutputPWM.
+     */
+    void addOutput(OutputPWM* output_ptr);
+
+    /**
+     * Unregisters an output so that the phases of the remaining outputs can be
+     * redistributed. Called by OutputPWM.
+     */
+    void removeOutput(OutputPWM* output_ptr);
+
+    /**
+     * Starts or stops stepping through the dither patterns depending on whether any of
+     * the outputs that use this timer have dithering enabled. Called by OutputPWM.
+     */
+    void updateDithering();
+
     /**
      * Returns which timer is used. Will be LEDC_TIMER_0 to LEDC_TIMER_3
      */
@@ -187,7 +269,7 @@ class PWMTimer {
     /**
      * Creates the timer. Private since should use get_available_timer() or get_timer() instead
      */
-    PWMTimer(const ledc_timer_t timer_num, const uint32_t freq_hz);
+    PWMTimer(const ledc_timer_t timer_num, const ledc_mode_t speed_mode, const uint32_t freq_hz);
 
     /**
      * Releases the timer. Private since should use done_with_timer() when done with a timer.
@@ -199,10 +281,40 @@ class PWMTimer {
     PWMTimer(const PWMTimer& obj) = delete;
     PWMTimer& operator=(const PWMTimer& obj) = delete;
 
+    /**
+     * Spreads the hpoints of the outputs evenly across the period, or sets them all to 0
+     * if phase staggering is disabled. Keeps the duty of each output the same.
+     */
+    void distributePhases();
+
+    /**
+     * Called periodically by the dither esp_timer to advance the outputs to the next
+     * step of their dither patterns.
+     * @param arg pointer to the PWMTimer
+     */
+    static void ditherTimerCallback(void* arg);
+
+    /**
+     * Stops and deletes the dither esp_timer. Must be called without outputs_mutex_ held
+     * since a callback that is running needs the mutex to finish. Only returns once no
+     * callback can still be running, so that the PWMTimer can safely be deleted.
+     */
+    static void stopDitherTimer(esp_timer_handle_t dither_timer);
+
+    /**
+     * Returns the period in microseconds for the dither esp_timer
+     */
+    uint64_t ditherPeriodUsec() const;
+
     const ledc_timer_t timer_num_;
     const ledc_mode_t speed_mode_;
-    const uint32_t freq_hz_;
+    uint32_t freq_hz_;
     uint32_t num_references_;
+    std::vector<OutputPWM*> outputs_;
+    std::mutex outputs_mutex_;  // since outputs_ also accessed by the dither timer callback
+    bool phase_staggering_;
+    esp_timer_handle_t dither_timer_;
+    uint32_t dither_step_;
 };
 
 /**
@@ -226,21 +338,36 @@ class PWMTimer {
  *
  * The LEDC channel controls the duty cycle for the PWM output.
  * Unlike Timers, LEDC channels are for a specific GPIO bit and therefore cannot be shared.
+ *
+ * The 12-bit duty is not fine enough for smooth dimming of LEDs at low intensity. Therefore
+ * temporal dithering can be enabled via setDithering(). A fractional duty is then realized
+ * by alternating between the two neighboring duty values over successive periods, giving
+ * up to kMaxDitherBits of additional effective resolution.
+ *
+ * Implements OutputPWMBase so that it can be used interchangeably with the channels of a
+ * PCA9685.
  */
-class OutputPWM {
+class OutputPWM : public OutputPWMBase {
    public:
+    // Maximum number of additional bits of resolution that dithering can provide. The dither
+    // pattern then repeats every 2^kMaxDitherBits=16 steps.
+    static constexpr uint8_t kMaxDitherBits = 4;
+
    /**
     * LEDC Channels are not shared, Therefore for each GPIO bit need a unique channel. Ane there
     * are only a few available. And it is difficult to keep track of whether one is still being
     * used or not. Therefore best to use get_available_channel() determine which channel to use
     * when calling OutputPWM() constructor.
+    * @param speed_mode The speed mode group, since each group has its own channels. Default
+    * is LEDC_LOW_SPEED_MODE.
     * @return the available channel to use, or LEDC_CHANNEL_MAX if there isn't one available
     */
-   static ledc_channel_t get_available_channel(void);
+   static ledc_channel_t get_available_channel(ledc_mode_t speed_mode = LEDC_LOW_SPEED_MODE);
 
    /**
     * Creates an output bit that can output a PWM signal of specific duty cycle and frequency.
-    * Uses get_available_channel() to determine channel number to use.
+    * Uses an available timer, from the high speed group first if the chip has one, and
+    * then get_available_channel() to determine channel number to use within that group.
     */
    OutputPWM(gpio_num_t gpio_num);
 
@@ -254,20 +381,75 @@ class OutputPWM {
      */
     OutputPWM(gpio_num_t gpio_num, ledc_channel_t channel);
 
-    ~OutputPWM();
+    /**
+     * Creates an output bit that shares the specified timer, and therefore the frequency,
+     * with other OutputPWMs. The phases of the outputs that share a timer are staggered.
+     * Uses get_available_channel() to determine channel number to use.
+     * @param gpio_num The number of the GPIO bit to control
+     * @param timer_num The LEDC timer to use
+     */
+    OutputPWM(gpio_num_t gpio_num, ledc_timer_t timer_num);
+
+    /**
+     * Creates an output bit that shares the specified timer, and therefore the frequency,
+     * with other OutputPWMs.
+     * @param gpio_num The number of the GPIO bit to control
+     * @param channel LEDC channel to use
+     * @param timer_num The LEDC timer to use
+     */
+    OutputPWM(gpio_num_t gpio_num, ledc_channel_t channel, ledc_timer_t timer_num);
+
+    ~OutputPWM() override;
 
     /**
      * Sets the duty cycle (power) of the output.
      * @param percentage The duty cycle of the output as a 0.0 - 100.0 percentage.
      */
-    void setDuty(const float percentage);
+    void setDuty(const float percentage) override;
 
     /**
      * Sets the duty cycle (power) of the output.
      * @param duty The duty cycle of the output. Since the timer has been configured for 12-bit
      * output the duty value can be set to between 0 (no power) and 4096 (full power).
      */
-    void setDutyValue(const uint32_t duty);
+    void setDutyValue(const uint32_t duty) override;
+
+    /**
+     * Sets the duty value without logging. Safe to call from an ISR, and if
+     * CONFIG_IDFX_IRAM_SAFE is set also while the flash cache is disabled. Values above
+     * MAX_DUTY are clamped.
+     * @param duty The duty value, between 0 and MAX_DUTY
+     */
+    void setDutyValueFast(const uint32_t duty);
+
+    /**
+     * Enables or disables temporal dithering. When enabled setDuty() uses the additional
+     * resolution and setDutyValueFine() can be used to set the duty directly.
+     * @param extra_bits Number of additional bits of resolution, 0 (disabled) to kMaxDitherBits
+     */
+    void setDithering(const uint8_t extra_bits);
+
+    /**
+     * Sets the duty cycle (power) of the output using the additional resolution provided
+     * by dithering. If dithering is not enabled then same as setDutyValue().
+     * @param fine_duty The duty cycle of the output, between 0 (no power) and
+     * PWMTimer::MAX_DUTY << extra_bits (full power).
+     */
+    void setDutyValueFine(const uint32_t fine_duty);
+
+    /**
+     * Returns true if dithering is enabled for this output
+     */
+    bool isDithering() const {
+        return dither_bits_ > 0;
+    }
+
+    /**
+     * Advances the output to the specified step of its dither pattern. Called periodically
+     * by PWMTimer. Only writes to the LEDC channel if the duty actually changes.
+     * @param step Counter that is incremented for each dither period
+     */
+    void ditherStep(const uint32_t step);
 
     /**
      * Sets frequency of timer to the new value. All output PWM bits that use the
@@ -275,18 +457,46 @@ class OutputPWM {
      * also change the duty of the signal proportionally, after the frequency is changed
      * the duty is reset to its previous value.
      */
-    void setFrequency(const uint32_t freq_hz);
+    void setFrequency(const uint32_t freq_hz) override;
+
+    /**
+     * Sets the point within the period at which the output switches on. Used by PWMTimer
+     * to stagger the phases of the outputs that share the timer. The duty is not changed.
+     * @param hpoint 0 to PWMTimer::MAX_DUTY-1
+     */
+    void setHpoint(const uint32_t hpoint);
 
    private:
     // Disallow access to copy & assignment constructors since don't want constructor called inadvertantly
     OutputPWM(const OutputPWM& obj) = delete;
     OutputPWM& operator=(const OutputPWM& obj) = delete;
 
+    /**
+     * Creates the output using the already obtained timer and an available channel in the
+     * speed mode group of the timer.
+     */
+    OutputPWM(gpio_num_t gpio_num, PWMTimer* timer_ptr);
+
+    /**
+     * Creates the output using the already obtained timer. Called by the public constructors.
+     */
+    OutputPWM(gpio_num_t gpio_num, ledc_channel_t channel, PWMTimer* timer_ptr);
+
     PWMTimer* timer_ptr_;
     const int gpio_num_;
     const ledc_channel_t channel_;
     const ledc_mode_t speed_mode_;
-    uint32_t duty_;  // not the percentage, but instead the integer value
+    uint32_t duty_;    // not the percentage, but instead the integer value
+    uint32_t hpoint_;  // where in the period the output switches on
+
+    uint8_t dither_bits_;     // additional bits of resolution. 0 if not dithering
+    uint32_t fine_duty_;      // duty including the dither bits
+    // Duty currently written to the LEDC channel. Atomic since also written by ditherStep()
+    // from the esp_timer task.
+    std::atomic<uint32_t> applied_duty_;
+    // Base duty in the upper 16 bits and dither pattern in the lower 16 bits. Combined
+    // into a single atomic so that ditherStep() always sees a consistent pair.
+    std::atomic<uint32_t> dither_state_;
 };
 
 }  // namespace idfx
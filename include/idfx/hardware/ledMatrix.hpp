@@ -0,0 +1,129 @@
+/**
+ * Driver for an LED matrix where the LEDs are connected to row and column GPIO pins
+ * and the rows are multiplexed. The scanning is done from a GPTimer ISR instead of from
+ * a task so that it is not affected by task scheduling. Therefore the brightness doesn't
+ * flicker when other tasks are busy and very little CPU is used.
+ *
+ * Per LED brightness is provided by Binary Code Modulation (BCM). For each row, each bit
+ * of the brightness (each bit-plane) is displayed for a time proportional to the weight
+ * of the bit. This only requires rows * brightness_bits interrupts per frame, many fewer
+ * than would be needed for PWM.
+ *
+ * When the frame is shown the GPIO register masks for each row and bit-plane are precomputed
+ * so that the ISR only needs to write them to the GPIO set and clear registers. The masks are
+ * double buffered. The application writes pixels and then calls show(). The ISR switches to
+ * the new masks at the start of the next frame so that there is no tearing.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "driver/gpio.h"
+#include "driver/gptimer.h"
+
+namespace idfx {
+
+class LedMatrix {
+   public:
+    /**
+     * Creates the LED matrix and configures the row and column pins as outputs. The
+     * scanning is not started until start() is called.
+     * @param row_pins The GPIO pins for the rows. Only one row is active at a time.
+     * @param column_pins The GPIO pins for the columns.
+     * @param rows_active_high true if a row is activated by setting its pin high
+     * @param columns_active_high true if an LED is lit by setting its column pin high
+     * @param refresh_hz How many times per second the whole matrix is scanned. Default is 100.
+     * @param brightness_bits Number of bits of brightness per LED, 1 to 8. Default is 6.
+     */
+    LedMatrix(const std::vector<gpio_num_t>& row_pins, const std::vector<gpio_num_t>& column_pins,
+              bool rows_active_high = true, bool columns_active_high = true,
+              uint32_t refresh_hz = 100, uint8_t brightness_bits = 6);
+
+    ~LedMatrix();
+
+    /**
+     * Starts scanning the matrix from the timer ISR
+     */
+    void start();
+
+    /**
+     * Stops scanning the matrix and turns all the LEDs off
+     */
+    void stop();
+
+    /**
+     * Sets the brightness of an LED. Doesn't take effect until show() is called.
+     * @param row The row of the LED
+     * @param column The column of the LED
+     * @param brightness 0 (off) to 255 (full). Reduced to brightness_bits of resolution.
+     */
+    void setPixel(uint8_t row, uint8_t column, uint8_t brightness);
+
+    /**
+     * Sets all the LEDs to off. Doesn't take effect until show() is called.
+     */
+    void clear();
+
+    /**
+     * Precomputes the GPIO register masks for the pixels that have been set and hands
+     * them to the ISR, which starts using them at the start of the next frame. Never
+     * blocks: if the previously shown frame hasn't yet been picked up by the ISR, for
+     * example because scanning is stopped, then it is replaced by the new one.
+     */
+    void show();
+
+   private:
+    // Disallow access to copy and assignment constructors since don't want constructor called inadvertantly
+    LedMatrix(const LedMatrix& obj) = delete;
+    LedMatrix& operator=(const LedMatrix& obj) = delete;
+
+    // The values to write to the GPIO set and clear registers for a row and bit-plane.
+    // The hi masks are for GPIO pins 32 and above.
+    typedef struct Masks {
+        uint32_t set_lo;
+        uint32_t set_hi;
+        uint32_t clear_lo;
+        uint32_t clear_hi;
+    } masks_t;
+
+    /**
+     * Adds the GPIO pin to either the set or clear masks
+     */
+    static void addToMasks(masks_t& masks, gpio_num_t pin, bool high);
+
+    /**
+     * The GPTimer alarm callback that does the actual scanning. Outputs the masks for the
+     * current row and bit-plane and then sets the next alarm based on the weight of the
+     * bit-plane.
+     */
+    static bool onAlarm(gptimer_handle_t timer, const gptimer_alarm_event_data_t* edata,
+                        void* user_ctx);
+
+    const std::vector<gpio_num_t> row_pins_;
+    const std::vector<gpio_num_t> column_pins_;
+    const bool rows_active_high_;
+    const bool columns_active_high_;
+    const uint8_t brightness_bits_;
+    const uint8_t num_rows_;  // so that ISR doesn't need to call row_pins_.size()
+    uint32_t tick_usec_;  // how long the least significant bit-plane is displayed
+
+    std::vector<uint8_t> pixels_;  // brightness of each LED, row major
+
+    // Double buffered masks. Each frame has rows * brightness_bits entries.
+    std::vector<masks_t> frames_[2];
+    masks_t all_off_masks_;
+    masks_t* front_;                    // masks being displayed by the ISR
+    std::atomic<masks_t*> pending_;     // masks to switch to at start of next frame
+    int back_index_;                    // which of frames_ the next show() writes into
+
+    gptimer_handle_t timer_;
+    uint8_t current_row_;
+    uint8_t current_plane_;
+};
+
+}  // namespace idfx
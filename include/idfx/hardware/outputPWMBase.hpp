@@ -0,0 +1,41 @@
+/**
+ * Interface for a PWM output, so that code can control dimmable outputs the same way
+ * whether they are LEDC channels (OutputPWM) or channels of an external PWM chip such
+ * as the PCA9685.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace idfx {
+
+class OutputPWMBase {
+   public:
+    // Duty values are 12-bit, with kMaxDuty meaning fully on
+    static const uint32_t kMaxDuty = 4096;
+
+    virtual ~OutputPWMBase() = default;
+
+    /**
+     * Sets the duty cycle (power) of the output.
+     * @param percentage The duty cycle of the output as a 0.0 - 100.0 percentage.
+     */
+    virtual void setDuty(const float percentage) = 0;
+
+    /**
+     * Sets the duty cycle (power) of the output.
+     * @param duty The duty value, between 0 (no power) and kMaxDuty (full power).
+     */
+    virtual void setDutyValue(const uint32_t duty) = 0;
+
+    /**
+     * Sets the PWM frequency. Depending on the hardware this can also change the frequency
+     * of other outputs, such as the ones sharing an LEDC timer or on the same PCA9685.
+     */
+    virtual void setFrequency(const uint32_t freq_hz) = 0;
+};
+
+}  // namespace idfx
@@ -0,0 +1,151 @@
+/**
+ * Driver for the PCA9685, a 16 channel 12-bit PWM controller that is communicated with
+ * via I2C. Used when more dimmable outputs are needed than the LEDC provides. Several
+ * chips can be put on the same bus, using different addresses.
+ * Documentation is at https://www.nxp.com/docs/en/data-sheet/PCA9685.pdf
+ *
+ * Each channel is provided as an OutputPWMBase, via output(), so it can be used just like
+ * an LEDC OutputPWM. To keep the I2C traffic low:
+ *  - A shadow copy of the channel registers is kept and only channels whose registers
+ *    actually change are written.
+ *  - Changed channels are written using auto-increment, so adjacent channels are written
+ *    in a single burst transaction instead of a transaction per channel.
+ *  - beginGroup() and commit() defer the writes so that many channels can be updated
+ *    with just one or a few transactions.
+ *
+ * Like with PWMTimer, the phases of the channels are staggered across the period so that
+ * they don't all switch on at the same instant, which reduces the peak current.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+
+#include "driver/i2c_master.h"
+#include "esp_err.h"
+#include "idfx/hardware/outputPWMBase.hpp"
+
+namespace idfx {
+
+class Pca9685;
+
+/**
+ * A single channel of a PCA9685. Obtained via Pca9685::output().
+ */
+class Pca9685Output : public OutputPWMBase {
+   public:
+    void setDuty(const float percentage) override;
+
+    void setDutyValue(const uint32_t duty) override;
+
+    /* Sets the frequency of the whole chip, so affects all 16 channels */
+    void setFrequency(const uint32_t freq_hz) override;
+
+   private:
+    friend class Pca9685;
+
+    Pca9685Output() : chip_ptr_(nullptr), channel_(0) {}
+
+    // Disallow access to copy and assignment constructors since don't want constructor called inadvertantly
+    Pca9685Output(const Pca9685Output& obj) = delete;
+    Pca9685Output& operator=(const Pca9685Output& obj) = delete;
+
+    Pca9685* chip_ptr_;
+    uint8_t channel_;
+};
+
+class Pca9685 {
+   public:
+    static const int kNumChannels = 16;
+    static const uint8_t kDefaultAddress = 0x40;
+
+    typedef struct Stats {
+        uint32_t transactions;     // I2C writes of channel registers
+        uint32_t channel_writes;   // channels written
+        uint32_t skipped_writes;   // duty changes not written since registers unchanged
+        uint32_t errors;           // failed I2C writes
+    } stats_t;
+
+    /**
+     * Adds the chip to the I2C bus and initializes it, with all channels off.
+     * @param bus The I2C master bus, as created by i2c_new_master_bus()
+     * @param address 7-bit address of the chip. Default is 0x40.
+     * @param freq_hz The PWM frequency, 24 to 1526 Hz. Default is 1000.
+     * @param open_drain true if outputs are open drain instead of totem pole, such as
+     * when LEDs are connected directly to the outputs with their anodes to the supply.
+     * @param scl_speed_hz I2C clock. The PCA9685 supports up to 1MHz. Default is 400kHz.
+     */
+    Pca9685(i2c_master_bus_handle_t bus, uint8_t address = kDefaultAddress,
+            uint32_t freq_hz = 1000, bool open_drain = false, uint32_t scl_speed_hz = 400000);
+
+    ~Pca9685();
+
+    /**
+     * Returns the specified channel as an output
+     * @param channel 0 to kNumChannels-1
+     */
+    Pca9685Output& output(uint8_t channel);
+
+    /**
+     * Sets the duty value of a channel. Written right away unless within a group.
+     * @param channel 0 to kNumChannels-1
+     * @param duty 0 (off) to OutputPWMBase::kMaxDuty (fully on)
+     */
+    void setDutyValue(uint8_t channel, uint32_t duty);
+
+    /**
+     * Sets the PWM frequency for all the channels. The chip needs to be put to sleep to
+     * change the prescaler, so the outputs briefly stop.
+     * @param freq_hz 24 to 1526 Hz
+     */
+    void setFrequency(uint32_t freq_hz);
+
+    /**
+     * Starts a group of changes. The channel registers are not written until the matching
+     * commit(). Groups can be nested, in which case writing happens at the outermost commit().
+     */
+    void beginGroup();
+
+    /**
+     * Ends a group of changes and, if it was the outermost group, writes all the channels
+     * that changed using as few burst transactions as possible.
+     */
+    void commit();
+
+    stats_t stats() const {
+        return stats_;
+    }
+
+   private:
+    // Disallow access to copy and assignment constructors since don't want constructor called inadvertantly
+    Pca9685(const Pca9685& obj) = delete;
+    Pca9685& operator=(const Pca9685& obj) = delete;
+
+    /**
+     * Returns the 4 register bytes (ON_L, ON_H, OFF_L, OFF_H), as a little-endian word, for
+     * the channel to output the duty
+     */
+    static uint32_t channelRegisters(uint8_t channel, uint32_t duty);
+
+    /**
+     * Writes the channels whose pending registers differ from the shadow copy. Needs to
+     * be called with mutex_ held.
+     */
+    void flush();
+
+    esp_err_t writeRegister(uint8_t reg, uint8_t value);
+
+    i2c_master_dev_handle_t i2c_device_;
+    Pca9685Output outputs_[kNumChannels];
+    uint32_t pending_[kNumChannels];  // registers to be written
+    uint32_t written_[kNumChannels];  // registers as they are on the chip
+    uint8_t mode1_;
+    int group_depth_;
+    std::mutex mutex_;
+    stats_t stats_;
+};
+
+}  // namespace idfx
@@ -0,0 +1,201 @@
+/**
+ * Decoders for timing based protocols, such as IR remotes and single wire sensors. The
+ * pulse trains are captured by PulseReceiver using RMT and then handed to a decoder.
+ *
+ * The decoders have no ESP-IDF dependencies, so they can also be compiled on the host and
+ * fed recorded pulse trains for testing.
+ *
+ * Pulses are in terms of the signal, not the pin: level 1 is a mark, meaning carrier on for
+ * IR or the line high for sensors. For active low IR receivers set invert for PulseReceiver.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace idfx {
+
+// A single level of a pulse train and how long it lasted
+typedef struct Pulse {
+    uint8_t level;
+    uint16_t usec;
+} pulse_t;
+
+class PulseDecoder {
+   public:
+    virtual ~PulseDecoder() = default;
+
+    /**
+     * Name of the protocol, for logging
+     */
+    virtual const char *name() const = 0;
+
+    /**
+     * Resolution for capturing the pulses. Default of 1MHz allows pulses of up to 32 msec.
+     */
+    virtual uint32_t resolutionHz() const {
+        return 1000000;
+    }
+
+    /**
+     * Pulses shorter than this are glitches and are filtered out by the receiver
+     */
+    virtual uint32_t minPulseNsec() const {
+        return 1000;
+    }
+
+    /**
+     * If the signal doesn't change for this long then the pulse train has ended
+     */
+    virtual uint32_t maxIdleNsec() const = 0;
+
+    /**
+     * Decodes a captured pulse train. If successful the decoded values are available
+     * through the accessors of the subclass until the next call.
+     * @param pulses The pulses
+     * @param count Number of pulses
+     * @return True if a valid frame was decoded
+     */
+    virtual bool decode(const pulse_t *pulses, size_t count) = 0;
+
+   protected:
+    /**
+     * Returns true if usec is within tolerance_pct percent of expected_usec
+     */
+    static bool matches(uint32_t usec, uint32_t expected_usec, uint32_t tolerance_pct = 25) {
+        const uint32_t tolerance = expected_usec * tolerance_pct / 100;
+        return usec + tolerance >= expected_usec && usec <= expected_usec + tolerance;
+    }
+};
+
+/**
+ * NEC IR protocol, including extended addresses and repeat codes
+ */
+class NecDecoder : public PulseDecoder {
+   public:
+    const char *name() const override {
+        return "NEC";
+    }
+    uint32_t maxIdleNsec() const override {
+        return 12000000;
+    }
+    bool decode(const pulse_t *pulses, size_t count) override;
+
+    // 8 bit address, or 16 bits for extended NEC
+    uint16_t address() const {
+        return address_;
+    }
+    uint8_t command() const {
+        return command_;
+    }
+    // True if the frame was a repeat code, sent while the button is held
+    bool isRepeat() const {
+        return repeat_;
+    }
+
+   private:
+    uint16_t address_ = 0;
+    uint8_t command_ = 0;
+    bool repeat_ = false;
+};
+
+/**
+ * Philips RC5 IR protocol
+ */
+class Rc5Decoder : public PulseDecoder {
+   public:
+    const char *name() const override {
+        return "RC5";
+    }
+    uint32_t maxIdleNsec() const override {
+        return 3000000;
+    }
+    bool decode(const pulse_t *pulses, size_t count) override;
+
+    uint8_t address() const {
+        return address_;
+    }
+    // 7 bit command, including the extended RC5 bit
+    uint8_t command() const {
+        return command_;
+    }
+    // Flips each time a button is pressed again, so that a held button can be told apart
+    bool toggle() const {
+        return toggle_;
+    }
+
+   private:
+    uint8_t address_ = 0;
+    uint8_t command_ = 0;
+    bool toggle_ = false;
+};
+
+/**
+ * DHT11 and DHT22 (AM2302) temperature and humidity sensors. The receiver captures the
+ * start signal sent by the trigger function as well as the response, so only the last
+ * 40 bits are used.
+ */
+class DhtDecoder : public PulseDecoder {
+   public:
+    enum Model { DHT11, DHT22 };
+
+    DhtDecoder(Model model = DHT22) : model_(model) {}
+
+    const char *name() const override {
+        return model_ == DHT11 ? "DHT11" : "DHT22";
+    }
+    uint32_t maxIdleNsec() const override {
+        // Longer than the start signal so that the capture isn't ended by it. The DHT11
+        // needs a start signal of at least 18 msec, the DHT22 only 1 msec.
+        return model_ == DHT11 ? 25000000 : 2000000;
+    }
+    bool decode(const pulse_t *pulses, size_t count) override;
+
+    float temperatureC() const {
+        return temperature_c_;
+    }
+    float humidityPct() const {
+        return humidity_pct_;
+    }
+
+   private:
+    Model model_;
+    float temperature_c_ = 0.0f;
+    float humidity_pct_ = 0.0f;
+};
+
+/**
+ * Ultrasonic distance sensors with an echo output, like the HC-SR04. The echo pulse lasts
+ * for the round trip time of the sound.
+ */
+class UltrasonicDecoder : public PulseDecoder {
+   public:
+    const char *name() const override {
+        return "Ultrasonic";
+    }
+    uint32_t resolutionHz() const override {
+        // Lower resolution since the 38 msec echo pulse is too long for 1MHz
+        return 500000;
+    }
+    uint32_t maxIdleNsec() const override {
+        // Longer than the 38 msec echo pulse that means nothing was detected
+        return 40000000;
+    }
+    bool decode(const pulse_t *pulses, size_t count) override;
+
+    uint32_t echoUsec() const {
+        return echo_usec_;
+    }
+    // Distance in mm, using the speed of sound at 20C
+    uint32_t distanceMm() const {
+        return echo_usec_ * 343 / 2000;
+    }
+
+   private:
+    uint32_t echo_usec_ = 0;
+};
+
+}  // namespace idfx
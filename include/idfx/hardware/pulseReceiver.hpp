@@ -0,0 +1,149 @@
+/**
+ * Captures pulse trains with the RMT peripheral and decodes them with a PulseDecoder on a
+ * task. Instead of busy-waiting or handling an interrupt per edge, the RMT hardware records
+ * the duration of each level into a buffer, via DMA on chips that support it, and an
+ * interrupt only occurs once the whole pulse train has been received.
+ *
+ * For IR receivers use startContinuous(), which re-arms the receiver for the next frame
+ * right away. Sensors that need to be triggered use measure():
+ *
+ *   static void dhtStart(void *arg) {
+ *       // Drive the open drain data pin low for the start signal, then release it.
+ *       // DHT22 needs at least 1 msec, DHT11 at least 18 msec.
+ *       gpio_set_level(DHT_PIN, 0);
+ *       idfx::sleep(1100us);
+ *       gpio_set_level(DHT_PIN, 1);
+ *   }
+ *   DhtDecoder dht(DhtDecoder::DHT22);
+ *   PulseReceiver receiver(DHT_PIN, dht, dhtDecoded);
+ *   // The RMT channel only connects the pin to its input. Also enable the pin's open
+ *   // drain output, released high, so that the trigger can pull the line low without
+ *   // fighting the sensor.
+ *   gpio_set_level(DHT_PIN, 1);
+ *   gpio_set_direction(DHT_PIN, GPIO_MODE_INPUT_OUTPUT_OD);
+ *   receiver.measure(dhtStart);
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "driver/rmt_rx.h"
+#include "esp-idf-cxx/gpio_cxx.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "idfx/hardware/pulseDecoders.hpp"
+
+namespace idfx {
+
+// Type definition for function called by the decode task when a frame has been decoded.
+// The decoded values are read from the decoder.
+typedef void (*pulse_decoded_function_t)(PulseDecoder &decoder, void *arg);
+
+// Type definition for function that triggers a sensor to send its pulse train
+typedef void (*pulse_trigger_function_t)(void *arg);
+
+class PulseReceiver {
+   public:
+    typedef struct Stats {
+        uint32_t frames;     // pulse trains received
+        uint32_t decoded;    // pulse trains successfully decoded
+        uint32_t failures;   // pulse trains the decoder rejected
+    } stats_t;
+
+    // Default maximum number of RMT symbols, each of which is two pulses, per frame.
+    // Enough for NEC and DHT.
+    static const size_t kDefaultMaxSymbols = 64;
+
+    /**
+     * Creates the RMT receive channel and the decode task
+     * @param gpio_num The pin the signal is received on
+     * @param decoder Decoder for the protocol. Must outlive the receiver.
+     * @param decoded_function Called by the decode task for each decoded frame
+     * @param arg Argument passed to decoded_function
+     * @param invert Set for active low signals, such as from most IR receivers
+     * @param max_symbols Maximum symbols per frame
+     * @param task_priority Priority of the decode task
+     */
+    PulseReceiver(GPIONum gpio_num, PulseDecoder &decoder,
+                  pulse_decoded_function_t decoded_function, void *arg = nullptr,
+                  bool invert = false, size_t max_symbols = kDefaultMaxSymbols,
+                  UBaseType_t task_priority = 5);
+
+    ~PulseReceiver();
+
+    /**
+     * Receives frames continuously, re-arming after each one. For IR receivers.
+     * @return ESP_OK if successful
+     */
+    esp_err_t startContinuous();
+
+    /**
+     * Arms the receiver for a single frame and then calls the trigger function, if any,
+     * so that the sensor sends its pulse train. The result is delivered via the decoded
+     * function.
+     * @param trigger_function Function that triggers the sensor
+     * @param arg Argument passed to trigger_function
+     * @return ESP_OK if successful
+     */
+    esp_err_t measure(pulse_trigger_function_t trigger_function = nullptr, void *arg = nullptr);
+
+    /**
+     * Stops continuous receiving after the current frame
+     */
+    void stop() {
+        continuous_ = false;
+    }
+
+    stats_t stats() const {
+        return stats_;
+    }
+
+   private:
+    // Disallow access to copy and assignment constructors since the RMT callback
+    // points to this object
+    PulseReceiver(const PulseReceiver &) = delete;
+    PulseReceiver &operator=(const PulseReceiver &) = delete;
+
+    /**
+     * Starts receiving into the next buffer
+     */
+    esp_err_t arm();
+
+    /**
+     * Called by RMT driver from ISR when a frame has been received
+     */
+    static bool receiveDoneCallback(rmt_channel_handle_t channel,
+                                    const rmt_rx_done_event_data_t *edata, void *user_ctx);
+
+    /**
+     * Task that re-arms the receiver and decodes received frames. Exits once it receives
+     * the exit message sent by the destructor.
+     */
+    static void decodeTask(void *arg);
+
+    PulseDecoder &decoder_;
+    pulse_decoded_function_t decoded_function_;
+    void *decoded_arg_;
+    size_t max_symbols_;
+    rmt_channel_handle_t channel_;
+    rmt_receive_config_t receive_config_;
+
+    // Double buffered so the next frame can be received while decoding
+    rmt_symbol_word_t *buffers_[2];
+    int next_buffer_;
+    pulse_t *pulses_;
+
+    QueueHandle_t done_queue_;
+    TaskHandle_t task_;
+    SemaphoreHandle_t task_exited_;
+    volatile bool continuous_;
+    stats_t stats_;
+};
+
+}  // namespace idfx
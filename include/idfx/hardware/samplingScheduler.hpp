@@ -0,0 +1,170 @@
+/**
+ * Reads sensors, such as I2C and SPI sensors on shared buses, at their specified rates but
+ * aligned to common time slots. Instead of each sensor being read by its own task, waking
+ * the CPU at scattered times and with reads colliding on the bus, a single task wakes only
+ * for slots in which at least one sensor is due. The due sensors are then read back-to-back,
+ * grouped by bus, and the results are delivered through a single callback per slot.
+ *
+ * The slot length is the greatest common divisor of all the sensor periods and phases, so
+ * every sensor is read exactly on its schedule. Since periods such as 10000 and 33333 usec
+ * have a divisor of only 1 usec, the slot is at least a minimum length, 1 msec by default.
+ * Due times are then rounded to the nearest slot, so a read is off by at most half a slot,
+ * but they are computed from the exact period so that the rate doesn't drift. Wakeups are done with an esp_timer aimed at
+ * the absolute slot time, so there is no drift. The difference between when a slot was due
+ * and when its reads started is tracked as the jitter.
+ *
+ * Usage:
+ *   SamplingScheduler scheduler(handleSamples);
+ *   scheduler.addSensor("imu", readImu, &imu, 10000);               // 100Hz
+ *   scheduler.addSensor("baro", readBaro, &baro, 50000, 5000);      // 20Hz, 5ms after imu
+ *   scheduler.start();
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+namespace idfx {
+
+class SamplingScheduler {
+   public:
+    // Maximum number of values a sensor can return per read
+    static const int kMaxValues = 4;
+
+    // The result of reading a sensor
+    typedef struct Sample {
+        int sensor_id;            // as returned by addSensor()
+        bool ok;                  // false if the read failed
+        uint8_t num_values;
+        float values[kMaxValues];
+        int64_t timestamp_usec;   // when the read started
+    } sample_t;
+
+    typedef struct Stats {
+        uint32_t wakeups;           // slots in which sensors were read
+        uint32_t reads;             // sensor reads
+        uint32_t failures;          // sensor reads that failed
+        uint32_t overruns;          // due slots skipped since the previous slot took too long
+        uint32_t max_jitter_usec;   // latest start of a slot compared to its schedule
+        uint64_t total_jitter_usec;
+    } stats_t;
+
+    // Type definition for function that reads a sensor. Called from the scheduler task.
+    // Sets num_values and fills in values. Returns false if the read failed.
+    typedef bool (*sensor_read_function_t)(void *arg, float *values, uint8_t &num_values);
+
+    // Type definition for function called with the samples of all sensors read in a slot
+    typedef void (*sample_batch_function_t)(const sample_t *samples, size_t count, void *arg);
+
+    /**
+     * @param batch_function Called from the scheduler task with the samples of each slot
+     * @param arg Argument passed to batch_function
+     * @param min_slot_usec Shortest slot length. If the sensor periods and phases have no
+     * common divisor this long then slots of this length are used and due times are
+     * rounded to the nearest slot, so this is the maximum jitter that is accepted for
+     * fewer wakeups. Limited to the shortest sensor period. Default is 1000.
+     */
+    SamplingScheduler(sample_batch_function_t batch_function, void *arg = nullptr,
+                      uint32_t min_slot_usec = 1000);
+
+    ~SamplingScheduler();
+
+    /**
+     * Adds a sensor to be read periodically. Must be called before start().
+     * @param name Name of the sensor, for logging
+     * @param read_function Function that reads the sensor
+     * @param arg Argument passed to read_function
+     * @param period_usec How often to read the sensor
+     * @param phase_usec Offset of the reads within the period. Default is 0.
+     * @param bus Identifies the bus of the sensor. Due sensors on the same bus are read
+     * consecutively so that the bus is only arbitrated for once per slot.
+     * @return The sensor ID, used in the samples
+     */
+    int addSensor(const char *name, sensor_read_function_t read_function, void *arg,
+                  uint32_t period_usec, uint32_t phase_usec = 0, int bus = 0);
+
+    /**
+     * Starts the scheduler task
+     * @param task_priority Priority of the scheduler task
+     * @param core_id Core to pin the task to. Default is no affinity.
+     * @return ESP_OK if successful
+     */
+    esp_err_t start(UBaseType_t task_priority = 10, BaseType_t core_id = tskNO_AFFINITY);
+
+    /**
+     * Stops the scheduler task. If a slot is being read then waits until it is done, so
+     * that the task is never deleted while in the middle of a read, such as when holding
+     * a bus lock.
+     */
+    void stop();
+
+    /**
+     * Length of the common time slot in microseconds. Valid once start() has been called.
+     */
+    uint32_t slotUsec() const {
+        return slot_usec_;
+    }
+
+    stats_t stats() const {
+        return stats_;
+    }
+
+   private:
+    typedef struct Sensor {
+        int id;
+        const char *name;
+        sensor_read_function_t read_function;
+        void *arg;
+        uint32_t period_usec;
+        uint32_t phase_usec;
+        int bus;
+    } sensor_t;
+
+    // Disallow access to copy and assignment constructors since the task and timer
+    // point to this object
+    SamplingScheduler(const SamplingScheduler &) = delete;
+    SamplingScheduler &operator=(const SamplingScheduler &) = delete;
+
+    /**
+     * Returns the first slot at or after the specified one in which the sensor is due
+     */
+    uint64_t nextDueSlot(const sensor_t &sensor, uint64_t slot) const;
+
+    /**
+     * Returns the first slot at or after the specified one in which any sensor is due
+     */
+    uint64_t nextBusySlot(uint64_t slot) const;
+
+    /**
+     * Reads the sensors due in the slot and delivers the batch
+     */
+    void runSlot(uint64_t slot);
+
+    static void schedulerTask(void *arg);
+    static void timerCallback(void *arg);
+
+    sample_batch_function_t batch_function_;
+    void *batch_arg_;
+    const uint32_t min_slot_usec_;
+    std::vector<sensor_t> sensors_;   // sorted by bus once started
+    std::vector<sample_t> samples_;
+    uint32_t slot_usec_;
+    int64_t start_usec_;
+    esp_timer_handle_t timer_;
+    TaskHandle_t task_;
+    SemaphoreHandle_t task_exited_;  // given by the task once it has stopped
+    volatile bool running_;
+    stats_t stats_;
+};
+
+}  // namespace idfx
@@ -0,0 +1,137 @@
+/**
+ * Output and input bits whose backend is a template parameter instead of being chosen at
+ * runtime. OutputBit and InputBit check whether they are a GPIO pin or an IOExpander pin on
+ * every access and then make a virtual call. With StaticOutputBit and StaticInputBit the
+ * backend type is known at compile time, so the accesses can be inlined. And since the
+ * backends support batching, consecutive operations on the same device can be combined:
+ *
+ *   Mcp23017 expander(bus);
+ *   StaticOutputBit<Mcp23017> red(expander, 0), green(expander, 1);
+ *   {
+ *       BitBatch<Mcp23017> batch(expander);
+ *       red.setOn();
+ *       green.setOff();
+ *   }  // single I2C write here
+ *
+ * The backends are in bitBackends.hpp. OutputBit and InputBit are still the ones to use when
+ * the configuration is only known at runtime. StaticIOExpander adapts a backend to the
+ * IOExpander interface so that the same device can also be used with those.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "idfx/hardware/bitBackends.hpp"
+#include "idfx/hardware/ioExpander.hpp"
+
+namespace idfx {
+
+template <typename Backend>
+class StaticOutputBit {
+   public:
+    /**
+     * Configures the bit of the backend as an output
+     * @param backend The device the bit is on
+     * @param bit The bit within the device. For NativeGpio this is the GPIO number.
+     */
+    StaticOutputBit(Backend &backend, uint8_t bit) : backend_(backend), bit_(bit) {
+        backend_.configAsOutput(bit_);
+    }
+
+    void setOn() const {
+        backend_.write(bit_, true);
+    }
+
+    void setOff() const {
+        backend_.write(bit_, false);
+    }
+
+    void set(bool on) const {
+        backend_.write(bit_, on);
+    }
+
+    bool get() const {
+        return backend_.read(bit_);
+    }
+
+   private:
+    Backend &backend_;
+    const uint8_t bit_;
+};
+
+template <typename Backend>
+class StaticInputBit {
+   public:
+    /**
+     * Configures the bit of the backend as an input
+     * @param backend The device the bit is on
+     * @param bit The bit within the device. For NativeGpio this is the GPIO number.
+     */
+    StaticInputBit(Backend &backend, uint8_t bit) : backend_(backend), bit_(bit) {
+        backend_.configAsInput(bit_);
+    }
+
+    bool get() const {
+        return backend_.read(bit_);
+    }
+
+   private:
+    Backend &backend_;
+    const uint8_t bit_;
+};
+
+/**
+ * Coalesces the writes to a backend for as long as it is in scope
+ */
+template <typename Backend>
+class BitBatch {
+   public:
+    BitBatch(Backend &backend) : backend_(backend) {
+        backend_.beginBatch();
+    }
+
+    ~BitBatch() {
+        backend_.endBatch();
+    }
+
+   private:
+    // Disallow access to copy and assignment constructors since don't want constructor called inadvertantly
+    BitBatch(const BitBatch &obj) = delete;
+    BitBatch &operator=(const BitBatch &obj) = delete;
+
+    Backend &backend_;
+};
+
+/**
+ * Adapts a backend to the runtime polymorphic IOExpander interface so that it can be used
+ * with OutputBit and InputBit
+ */
+template <typename Backend>
+class StaticIOExpander : public IOExpander {
+   public:
+    StaticIOExpander(Backend &backend) : backend_(backend) {}
+
+    void configAsOutput(int io_bit) const override {
+        backend_.configAsOutput(io_bit);
+    }
+
+    void configAsInput(int io_bit) const override {
+        backend_.configAsInput(io_bit);
+    }
+
+    void setBit(int io_bit, bool on) const override {
+        backend_.write(io_bit, on);
+    }
+
+    uint8_t getBit(int io_bit) const override {
+        return backend_.read(io_bit);
+    }
+
+   private:
+    Backend &backend_;
+};
+
+}  // namespace idfx
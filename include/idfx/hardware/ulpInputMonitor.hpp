@@ -0,0 +1,127 @@
+/**
+ * Monitors inputs with the ULP coprocessor while the main cores are in deep sleep, so that
+ * the SoC is only woken for events that matter instead of the CPU staying awake to poll
+ * the inputs or to run the interrupt task.
+ *
+ * The inputs are InputBits on RTC capable GPIO pins. Each has a wake condition of rising,
+ * falling, or either edge. From these a small ULP FSM program is generated at runtime and
+ * loaded into RTC slow memory, so no ULP assembler build step is needed. The ULP wakes up
+ * every sample period and reads all the inputs at once:
+ *  - If any input differs from the previous sample the inputs are bouncing, so the stable
+ *    count is reset.
+ *  - Once the inputs have been the same for debounce_samples samples they are compared with
+ *    the last debounced state. If an input changed in a way that matches its wake condition
+ *    then the event is recorded and the SoC is woken. Other changes just update the state.
+ * The debounced state, the accumulated events, and a wake count are kept in RTC slow memory
+ * so they are available after waking via takeEvents() and state().
+ *
+ * Limitations, due to the ULP FSM instruction set: the inputs must be RTC GPIOs 0-15, which
+ * excludes GPIO 14 and 27. The debouncing is done for the set of inputs as a whole.
+ *
+ * Requires CONFIG_ULP_COPROC_ENABLED with the FSM type and CONFIG_ULP_COPROC_RESERVE_MEM of
+ * at least 512 bytes. Otherwise start() returns ESP_ERR_NOT_SUPPORTED and takeEvents(),
+ * state(), and wakeCount() return 0.
+ *
+ * The monitor claims words 0-7 of the ULP reserved area of RTC slow memory for its data and
+ * loads its program right after. Therefore it cannot be combined with an application's own
+ * ULP program, which would be loaded at the same place.
+ *
+ * Typical use:
+ *   UlpInputMonitor monitor;
+ *   if (UlpInputMonitor::wokeByUlp()) handleEvents(UlpInputMonitor::takeEvents());
+ *   monitor.addInput(button, UlpInputMonitor::kFalling);
+ *   monitor.start(20000, 3);
+ *   esp_deep_sleep_start();
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "idfx/hardware/io.hpp"
+
+namespace idfx {
+
+class UlpInputMonitor {
+   public:
+    typedef enum WakeCondition : uint8_t {
+        kRising = 1,
+        kFalling = 2,
+        kAnyEdge = 3,
+    } wake_condition_t;
+
+    UlpInputMonitor();
+
+    /**
+     * Adds an input to be monitored. Must be called before start().
+     * @param input The input. Must be on an RTC capable GPIO, not on an IO expander.
+     * @param condition Which edges wake the SoC
+     * @param pullup Enables the RTC pull up, since the digital pull ups are not powered
+     * during deep sleep. Default is true.
+     * @return ESP_ERR_INVALID_ARG if input cannot be monitored by the ULP
+     */
+    esp_err_t addInput(const InputBit &input, wake_condition_t condition, bool pullup = true);
+
+    /**
+     * Generates and loads the ULP program, takes over the input pins as RTC GPIOs, enables
+     * ULP wakeup, and starts the ULP. The current input levels are taken as the initial
+     * debounced state so that there is no wakeup for them.
+     * @param sample_period_usec How often the ULP samples the inputs. Default is 10000.
+     * @param debounce_samples Number of consecutive identical samples before the inputs are
+     * considered stable. Default is 3.
+     * @return ESP_OK if successful
+     */
+    esp_err_t start(uint32_t sample_period_usec = 10000, uint16_t debounce_samples = 3);
+
+    /**
+     * Stops the ULP, and therefore the monitoring
+     */
+    void stop();
+
+    /**
+     * Returns true if woken from deep sleep by the ULP
+     */
+    static bool wokeByUlp();
+
+    /**
+     * Returns the inputs that had a qualifying event since the last call, as a mask of GPIO
+     * numbers, and clears them. Valid after waking, before start() is called again.
+     */
+    static uint64_t takeEvents();
+
+    /**
+     * Returns the debounced state of the inputs as a mask of GPIO numbers
+     */
+    static uint64_t state();
+
+    /**
+     * Returns number of times the ULP has woken the SoC since start()
+     */
+    static uint16_t wakeCount();
+
+   private:
+    // Disallow access to copy and assignment constructors since don't want constructor called inadvertantly
+    UlpInputMonitor(const UlpInputMonitor &obj) = delete;
+    UlpInputMonitor &operator=(const UlpInputMonitor &obj) = delete;
+
+    /**
+     * Converts a mask of RTC GPIO numbers, as used by the ULP, to a mask of GPIO numbers
+     */
+    static uint64_t rtcMaskToGpioMask(uint16_t rtc_mask);
+
+    typedef struct Input {
+        gpio_num_t gpio_num;
+        int rtc_num;
+        wake_condition_t condition;
+        bool pullup;
+    } input_t;
+
+    std::vector<input_t> inputs_;
+};
+
+}  // namespace idfx
@@ -0,0 +1,122 @@
+/*
+ * Per call site enabling of logging, similar to the dynamic debug feature of Linux. Only
+ * used if CONFIG_IDFX_DYNAMIC_DEBUG is set.
+ *
+ * Each VERBOSE(), DEBUG(), INFO(), WARN() and ERROR() statement gets a static descriptor
+ * containing its file, function, line, and format, plus a state byte. VERBOSE() and
+ * DEBUG() call sites start disabled, and once enabled are logged regardless of the log
+ * level of the tag. INFO(), WARN() and ERROR() call sites start enabled, so nothing
+ * changes unless they are disabled, and are still filtered by the log level. When a call site is disabled the only
+ * cost is loading the state byte and a branch. The tag string and the regular esp_log
+ * tag lookup are not done at all. Call sites register themselves the first time they are
+ * reached, at which point they are matched against the currently enabled rules. This way
+ * rules can be enabled for code that hasn't run yet.
+ *
+ * Call sites are listed and enabled at runtime using the "dyndbg" console command, which
+ * is registered via DynamicDebug::registerConsoleCommand(). Examples:
+ *   dyndbg list
+ *   dyndbg enable file io.cpp
+ *   dyndbg enable func setDuty* line 120-140
+ *   dyndbg disable format Sending*
+ *   dyndbg disable all
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "esp_compiler.h"
+
+namespace idfx {
+
+/* State of a call site. Unregistered is 0 so that the descriptors can be in .bss */
+enum call_site_state_t : uint8_t {
+    kCallSiteUnregistered = 0,
+    kCallSiteDisabled,
+    kCallSiteEnabled,
+};
+
+typedef struct LogCallSite {
+    const char *file;
+    const char *func;
+    const char *format;
+    uint16_t line;
+    char letter;  // 'V', 'D', 'I', 'W' or 'E'
+    volatile call_site_state_t state;
+    struct LogCallSite *next;
+} log_call_site_t;
+
+class DynamicDebug {
+   public:
+    /* Registers the "dyndbg" console command. Needs to be called after the console
+     * has been initialized, such as via esp_console_new_repl_uart() */
+    static void registerConsoleCommand();
+
+    /* Enables or disables the call sites matching the query, both the ones already
+     * registered and the ones that register later. The query is a sequence of keyword
+     * value pairs, each of which needs to match. Keywords are "file" (glob of just the
+     * file name), "func" (glob), "line" (number or range like 10-20) and "format" (glob).
+     * The single keyword "all" matches all call sites. Returns number of registered
+     * call sites that matched, or -1 if the query is invalid. */
+    static int setEnabled(const char *query, bool enabled);
+
+    /* Outputs the registered call sites that match the query, or all of them if
+     * query is empty */
+    static void list(const char *query = "");
+
+    /* Called when a call site is reached for the first time. Registers it and returns
+     * true if it should log */
+    static bool registerCallSite(log_call_site_t *site);
+
+    /* Does the actual logging for an enabled call site. DEBUG() and VERBOSE() call sites
+     * are logged regardless of the esp_log level of the tag since enabling them is an
+     * explicit request. The others are logged at their own level. */
+    static void log(const log_call_site_t *site, const char *format, ...)
+        __attribute__((format(printf, 2, 3)));
+
+   private:
+    typedef struct Query {
+        std::string file;
+        std::string func;
+        std::string format;
+        int first_line;
+        int last_line;
+    } query_t;
+
+    typedef struct Rule {
+        query_t query;
+        bool enabled;
+    } rule_t;
+
+    static bool parse(const char *query_str, query_t &query);
+    static bool matches(const query_t &query, const log_call_site_t *site);
+    static int consoleCommand(int argc, char **argv);
+
+    // Intrusive list of registered call sites, so no allocation needed when registering
+    static log_call_site_t *call_sites_;
+    // Rules in the order they were set, so that later ones take precedence for call sites
+    // that register later
+    static std::vector<rule_t> rules_;
+    static std::mutex mutex_;
+};
+
+}  // namespace idfx
+
+/* Declares the static descriptor for the call site and logs if it is enabled. The
+ * descriptor is constant initialized, so there is no guard variable */
+#define IDFX_DYNAMIC_LOG(letter_char, format, ...)                                          \
+    do {                                                                                    \
+        static idfx::log_call_site_t idfx_call_site_ = {                                   \
+            __FILE__, __func__, format, __LINE__, letter_char, idfx::kCallSiteUnregistered, \
+            nullptr};                                                                       \
+        if (unlikely(idfx_call_site_.state != idfx::kCallSiteDisabled) &&                   \
+            (idfx_call_site_.state == idfx::kCallSiteEnabled ||                             \
+             idfx::DynamicDebug::registerCallSite(&idfx_call_site_))) {                     \
+            idfx::DynamicDebug::log(&idfx_call_site_, format, ##__VA_ARGS__);              \
+        }                                                                                   \
+    } while (0)
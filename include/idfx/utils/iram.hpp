@@ -0,0 +1,32 @@
+/*
+ * Attributes for code and data that must keep working while the flash cache is disabled,
+ * such as during NVS commits and OTA writes. Only has an effect if CONFIG_IDFX_IRAM_SAFE is
+ * set, so that IRAM isn't used up when not needed.
+ *
+ * Functions marked IDFX_IRAM_ATTR must only call functions that are also in IRAM and must
+ * only access data in DRAM. Note that string literals, such as log formats, are in flash,
+ * so use ISR_DEBUG() for logging.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "esp_attr.h"
+#include "esp_intr_alloc.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#if CONFIG_IDFX_IRAM_SAFE
+#define IDFX_IRAM_ATTR IRAM_ATTR
+#define IDFX_DRAM_ATTR DRAM_ATTR
+#define IDFX_INTR_FLAG_IRAM ESP_INTR_FLAG_IRAM
+#else
+#define IDFX_IRAM_ATTR
+#define IDFX_DRAM_ATTR
+#define IDFX_INTR_FLAG_IRAM 0
+#endif
+
+/* Debug logging that is safe within an ISR, even while the flash cache is disabled,
+ * since the format string is placed in DRAM */
+#define ISR_DEBUG(format, ...) ESP_DRAM_LOGD(DRAM_STR("idfx"), format, ##__VA_ARGS__)
@@ -57,6 +57,28 @@ inline std::string lineNumber(int lineNumber) {
 /* Provides the thread name as the TAG used for logging */
 #define TAG_FOR_LOGGING (idfx::threadId()).c_str()
 
+#if CONFIG_IDFX_DYNAMIC_DEBUG
+/* With dynamic debug each log call site can be enabled and disabled individually at
+runtime. VERBOSE() and DEBUG() call sites start disabled and are then logged regardless
+of the log level of the tag. INFO(), WARN() and ERROR() call sites start enabled and are
+still filtered by the log level too. See dynamicDebug.hpp */
+#include "idfx/utils/dynamicDebug.hpp"
+
+#define VERBOSE(format, ...) IDFX_DYNAMIC_LOG('V', format, ##__VA_ARGS__)
+
+#define DEBUG(format, ...) IDFX_DYNAMIC_LOG('D', format, ##__VA_ARGS__)
+
+#define INFO(format, ...) IDFX_DYNAMIC_LOG('I', format, ##__VA_ARGS__)
+
+#define WARN(format, ...) IDFX_DYNAMIC_LOG('W', format, ##__VA_ARGS__)
+
+/* Also prints the stack trace, as the regular ERROR() does */
+#define ERROR(format, ...)                                  \
+    do {                                                    \
+        IDFX_DYNAMIC_LOG('E', format, ##__VA_ARGS__);       \
+        esp_backtrace_print(12);                            \
+    } while (0)
+#else
 /* Verbose macro. Uses ESP_LOGV() but adds additional info */
 #define VERBOSE(format, ...)                                                          \
     ESP_LOGV(TAG_FOR_LOGGING, "%s%s:%s" format, idfx::functionName(__func__).c_str(), \
@@ -67,6 +89,7 @@ line number, and function name */
 #define DEBUG(format, ...)                                                            \
     ESP_LOGD(TAG_FOR_LOGGING, "%s%s:%s" format, idfx::functionName(__func__).c_str(), \
              idfx::fileName(__FILE__).c_str(), idfx::lineNumber(__LINE__).c_str(), ##__VA_ARGS__)
+#endif
 
 /* For executing code, like timing code, only if in debug mode */
 #define DEBUGGING(code)                        \
@@ -74,6 +97,7 @@ line number, and function name */
             code;                              \
     } while (0)
 
+#if !CONFIG_IDFX_DYNAMIC_DEBUG
 /* Info macro. Uses ESP_LOGI() but adds additional info like thread id, filename,
 line number, and function name. At some point might not want this extra info for
 INFO logging and would then just call ESP_LOGI(). */
@@ -100,6 +124,7 @@ should be okay since likely always will have error logging enabled. */
                  ##__VA_ARGS__);                                                          \
         esp_backtrace_print(12);                                                          \
     } while (0)
+#endif
 
 /* For if wanted to use the filename of the current file as TAG. This function needs to be
    in the hpp file so that it uses the correct file name via the __FILE__ macro. */
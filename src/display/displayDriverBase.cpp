@@ -5,8 +5,374 @@
  */
 
 #include "idfx/display/displayDriverBase.hpp"
+
+#include <algorithm>
+
+#include "driver/gpio.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include "idfx/utils/log.hpp"
+#include "soc/soc_caps.h"
+
+// MIPI DCS commands used by most SPI display controllers
+static const uint8_t kCmdSetColumnAddress = 0x2A;
+static const uint8_t kCmdSetRowAddress = 0x2B;
+static const uint8_t kCmdWriteMemoryStart = 0x2C;
+
+// Initial estimate of how long it takes to write 1k bytes, for 40MHz SPI. Is
+// updated with the measured time once flushes have been done.
+static const uint32_t kInitialUsecPerKbyte = 205;
 
-DisplayDriverBase::DisplayDriverBase(int width, int height) : width_(width), height_(height) {
+// For finding the driver from the TE pin in tearingEffectHandler(). Indexed by GPIO number.
+static DisplayDriverBase *te_drivers_[GPIO_NUM_MAX] = {};
+
+DisplayDriverBase::DisplayDriverBase(int width, int height)
+    : width_(width),
+      height_(height),
+      lv_display_(nullptr),
+      draw_bufs_{nullptr, nullptr},
+      draw_buf_size_(0),
+      swap_bytes_(true),
+      render_start_usec_(0),
+      render_stats_({}),
+      stats_start_usec_(esp_timer_get_time()),
+      flush_done_semaphore_(nullptr),
+      vsync_semaphore_(nullptr),
+      last_vsync_usec_(0),
+      frame_period_usec_(0),
+      flush_start_usec_(0),
+      flush_bytes_(0),
+      flush_done_usec_(0),
+      usec_per_kbyte_(kInitialUsecPerKbyte),
+      vsync_stats_({}),
+      spi_device_(nullptr),
+      dc_pin_(GPIO_NUM_NC) {
     INFO("DisplayDriverBase constructor");
-}
\ No newline at end of file
+}
+
+DisplayDriverBase::~DisplayDriverBase() {
+    waitForTransaction();
+    waitForCopy();
+
+    if (lv_display_) {
+        lv_display_delete(lv_display_);
+    }
+    if (flush_done_semaphore_) {
+        vSemaphoreDelete(flush_done_semaphore_);
+    }
+    for (void *buf : draw_bufs_) {
+        heap_caps_free(buf);
+    }
+
+    // Make sure TE handler no longer refers to this driver
+    for (auto &driver : te_drivers_) {
+        if (driver == this) driver = nullptr;
+    }
+    if (vsync_semaphore_) {
+        vSemaphoreDelete(vsync_semaphore_);
+    }
+}
+
+/* static */
+int DisplayDriverBase::parallelDrawUnits() {
+#if LV_USE_OS == LV_OS_FREERTOS && LV_USE_DRAW_SW
+    return LV_DRAW_SW_DRAW_UNIT_CNT;
+#else
+    // Without an OS LVGL renders in the thread that calls lv_timer_handler()
+    return 1;
+#endif
+}
+
+lv_display_t *DisplayDriverBase::createLvglDisplay(int buffer_lines, lv_color_format_t color_format,
+                                                  lv_display_render_mode_t render_mode) {
+    // Full frame buffers are needed for direct and full refresh modes. These are too large
+    // for internal RAM so put them in PSRAM, if the DMA can read from PSRAM.
+    uint32_t caps = MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL;
+    if (render_mode != LV_DISPLAY_RENDER_MODE_PARTIAL) {
+        buffer_lines = height_;
+#if CONFIG_SPIRAM && SOC_PSRAM_DMA_CAPABLE
+        caps = MALLOC_CAP_SPIRAM;
+#endif
+    }
+    INFO("Creating LVGL display of %dx%d with buffers of %d lines", width_, height_, buffer_lines);
+
+    // Two buffers so that LVGL can render into one while the other is being sent via DMA
+    const size_t buf_size = width_ * buffer_lines * lv_color_format_get_size(color_format);
+    for (void *&buf : draw_bufs_) {
+        buf = heap_caps_malloc(buf_size, caps);
+        if (!buf) {
+            ERROR("Could not allocate LVGL draw buffer of %d bytes with caps 0x%lX", buf_size, caps);
+            return nullptr;
+        }
+    }
+
+    return registerLvglDisplay(draw_bufs_[0], draw_bufs_[1], buf_size, render_mode, color_format);
+}
+
+lv_display_t *DisplayDriverBase::registerLvglDisplay(void *buf1, void *buf2, size_t buf_size,
+                                                    lv_display_render_mode_t render_mode,
+                                                    lv_color_format_t color_format) {
+    if (parallelDrawUnits() < 2) {
+        WARN("LVGL has only a single draw unit so all rendering is done by one task. For "
+             "rendering by two tasks set CONFIG_LV_OS_FREERTOS and CONFIG_LV_DRAW_SW_DRAW_UNIT_CNT=2");
+    }
+
+    draw_buf_size_ = buf_size;
+    lv_display_ = lv_display_create(width_, height_);
+    lv_display_set_color_format(lv_display_, color_format);
+    lv_display_set_buffers(lv_display_, buf1, buf2, buf_size, render_mode);
+    lv_display_set_user_data(lv_display_, this);
+    lv_display_set_flush_cb(lv_display_, lvglFlushCallback);
+
+    // flushReady() is called from ISRs, possibly while the flash cache is disabled, so it
+    // can't call lv_display_flush_ready(). Instead it gives a semaphore that LVGL waits on
+    // via the flush wait callback, in the LVGL task.
+    if (!flush_done_semaphore_) {
+        flush_done_semaphore_ = xSemaphoreCreateBinary();
+    }
+    lv_display_set_flush_wait_cb(lv_display_, lvglFlushWaitCallback);
+
+    // So that can measure how long rendering takes
+    lv_display_add_event_cb(lv_display_, renderEventCallback, LV_EVENT_RENDER_START, this);
+    lv_display_add_event_cb(lv_display_, renderEventCallback, LV_EVENT_RENDER_READY, this);
+
+    return lv_display_;
+}
+
+void DisplayDriverBase::flushArea(const lv_area_t *area, uint8_t *px_map) {
+    const size_t num_pixels = lv_area_get_size(area);
+    swapBytesIfNeeded(px_map, num_pixels);
+
+    // flushReady() is called by spiFlushComplete() once the DMA is done
+    const size_t length = num_pixels * lv_color_format_get_size(lv_display_get_color_format(lv_display_));
+    waitForScanline(area, length);
+    sendArea(area, px_map, length, spiFlushComplete, this);
+}
+
+void DisplayDriverBase::enableTearingEffectSync(idfx::GPIONum te_pin, uint32_t nominal_refresh_hz) {
+    INFO("Enabling tearing effect sync using TE pin %d and nominal refresh of %ld Hz",
+         te_pin.get_value(), nominal_refresh_hz);
+
+    frame_period_usec_ = 1000000 / nominal_refresh_hz;
+    last_vsync_usec_ = esp_timer_get_time();
+    if (!vsync_semaphore_) {
+        vsync_semaphore_ = xSemaphoreCreateBinary();
+    }
+
+    // TE pulse is active high. The panel drives it so no pull resistors needed.
+    te_drivers_[te_pin.get_value()] = this;
+    idfx::GpioInterrupteHandler(te_pin, tearingEffectHandler, GPIO_INTR_POSEDGE,
+                                GPIO_PULLUP_DISABLE, GPIO_PULLDOWN_DISABLE);
+
+    // The handler configures the pin as in/out so that it can be tested by writing to it.
+    // The panel drives TE so it must be input only, else would fight the panel.
+    gpio_set_direction(static_cast<gpio_num_t>(te_pin.get_value()), GPIO_MODE_INPUT);
+}
+
+void DisplayDriverBase::waitForScanline(const lv_area_t *area, size_t length) {
+    // If tearing effect sync not enabled then can write right away
+    if (!vsync_semaphore_) return;
+
+    // Update the measured write speed using the previous flush, if it has completed
+    if (flush_bytes_ > 0 && (int32_t)(flush_done_usec_ - flush_start_usec_) > 0) {
+        usec_per_kbyte_ = (uint64_t)(flush_done_usec_ - flush_start_usec_) * 1024 / flush_bytes_;
+        flush_bytes_ = 0;
+    }
+
+    const uint32_t frame_usec = frame_period_usec_;
+    const uint32_t line_usec = std::max(frame_usec / height_, (uint32_t)1);
+    const uint32_t write_usec = (uint64_t)length * usec_per_kbyte_ / 1024;
+    const uint32_t since_vsync_usec = (uint32_t)esp_timer_get_time() - last_vsync_usec_;
+
+    // Estimate where the scanline is. If the write can finish before the scanline reaches
+    // the area, or if the scanline has already passed the area and the write can finish
+    // before the scanline wraps around to it again, then can write right away.
+    bool clear_of_scanline = false;
+    if (since_vsync_usec < frame_usec) {
+        const int line = since_vsync_usec / line_usec;
+        const bool ahead = line < area->y1 && write_usec < (area->y1 - line) * line_usec;
+        const bool behind =
+            line > area->y2 && write_usec < (height_ - line + area->y1) * line_usec;
+        clear_of_scanline = ahead || behind;
+    }
+
+    if (clear_of_scanline) {
+        vsync_stats_.immediate_flushes++;
+    } else {
+        // Wait for next TE pulse. First clear out a possibly stale one.
+        xSemaphoreTake(vsync_semaphore_, 0);
+        TickType_t timeout = pdMS_TO_TICKS(2 * frame_usec / 1000) + 1;
+        if (xSemaphoreTake(vsync_semaphore_, timeout) == pdTRUE) {
+            vsync_stats_.synced_flushes++;
+        } else {
+            vsync_stats_.missed_vsyncs++;
+            VERBOSE("TE pulse did not arrive within %ld ticks", timeout);
+        }
+    }
+    vsync_stats_.frame_period_usec = frame_usec;
+
+    // Remember when write started so that can measure the write speed
+    flush_start_usec_ = esp_timer_get_time();
+    flush_bytes_ = length;
+}
+
+void IRAM_ATTR DisplayDriverBase::flushReady() {
+    if (xPortInIsrContext()) {
+        BaseType_t higher_priority_task_woken = pdFALSE;
+        xSemaphoreGiveFromISR(flush_done_semaphore_, &higher_priority_task_woken);
+        if (higher_priority_task_woken) portYIELD_FROM_ISR();
+    } else {
+        xSemaphoreGive(flush_done_semaphore_);
+    }
+}
+
+void DisplayDriverBase::swapBytesIfNeeded(uint8_t *px_map, size_t num_pixels) {
+    if (swap_bytes_ && lv_display_get_color_format(lv_display_) == LV_COLOR_FORMAT_RGB565) {
+        lv_draw_sw_rgb565_swap(px_map, num_pixels);
+    }
+}
+
+void DisplayDriverBase::resetRenderStats() {
+    render_stats_ = {};
+    stats_start_usec_ = esp_timer_get_time();
+}
+
+float DisplayDriverBase::renderedFps() const {
+    const int64_t elapsed_usec = esp_timer_get_time() - stats_start_usec_;
+    return elapsed_usec > 0 ? render_stats_.frames * 1000000.0f / elapsed_usec : 0.0f;
+}
+
+/* static */
+void DisplayDriverBase::lvglFlushCallback(lv_display_t *disp, const lv_area_t *area,
+                                          uint8_t *px_map) {
+    auto driver = static_cast<DisplayDriverBase *>(lv_display_get_user_data(disp));
+    driver->flushArea(area, px_map);
+}
+
+/* static */
+void DisplayDriverBase::lvglFlushWaitCallback(lv_display_t *disp) {
+    auto driver = static_cast<DisplayDriverBase *>(lv_display_get_user_data(disp));
+    xSemaphoreTake(driver->flush_done_semaphore_, portMAX_DELAY);
+}
+
+/* static */
+void IRAM_ATTR DisplayDriverBase::spiFlushComplete(void *arg) {
+    auto driver = static_cast<DisplayDriverBase *>(arg);
+    driver->flush_done_usec_ = esp_timer_get_time();
+    driver->flushReady();
+}
+
+/* static */
+void DisplayDriverBase::tearingEffectHandler(int gpio_num) {
+    DisplayDriverBase *driver = te_drivers_[gpio_num];
+    if (!driver) return;
+
+    // Measure the frame period, smoothing it. Ignore intervals that are way off, which
+    // happens for the first pulse or if pulses were missed. Uses the time recorded by the
+    // ISR since this handler runs in the GPIO task, after the queue latency.
+    const uint32_t now_usec = idfx::GpioInterrupteHandler::interruptTimeUsec(gpio_num);
+    const uint32_t period_usec = now_usec - driver->last_vsync_usec_;
+    const uint32_t expected_usec = driver->frame_period_usec_;
+    if (period_usec > expected_usec / 2 && period_usec < expected_usec * 2) {
+        driver->frame_period_usec_ = (expected_usec * 7 + period_usec) / 8;
+    }
+    driver->last_vsync_usec_ = now_usec;
+    driver->vsync_stats_.vsyncs++;
+
+    xSemaphoreGive(driver->vsync_semaphore_);
+}
+
+/* static */
+void DisplayDriverBase::renderEventCallback(lv_event_t *event) {
+    auto driver = static_cast<DisplayDriverBase *>(lv_event_get_user_data(event));
+    if (lv_event_get_code(event) == LV_EVENT_RENDER_START) {
+        driver->render_start_usec_ = esp_timer_get_time();
+        return;
+    }
+
+    // Render is ready so update the statistics
+    uint32_t elapsed_usec = esp_timer_get_time() - driver->render_start_usec_;
+    render_stats_t &stats = driver->render_stats_;
+    stats.frames++;
+    stats.total_usec += elapsed_usec;
+    stats.max_usec = std::max(stats.max_usec, elapsed_usec);
+    stats.last_usec = elapsed_usec;
+}
+
+esp_err_t DisplayDriverBase::attachSpi(spi_host_device_t host,
+                                       spi_device_interface_config_t dev_config,
+                                       gpio_num_t dc_pin) {
+    DEBUG("Attaching SPI display on host %d with dc_pin=%d", host, dc_pin);
+
+    // The DC pin is set by the pre transfer callback for each phase
+    dc_pin_ = dc_pin;
+    gpio_set_direction(dc_pin_, GPIO_MODE_OUTPUT);
+    dev_config.pre_cb = idfx::SpiTransaction::preTransferCallback;
+    dev_config.post_cb = idfx::SpiTransaction::postTransferCallback;
+    dev_config.queue_size = std::max(dev_config.queue_size, (int)idfx::SpiTransaction::kMaxPhases);
+
+    esp_err_t result = spi_bus_add_device(host, &dev_config, &spi_device_);
+    if (result != ESP_OK) {
+        ERROR("Could not add SPI display device. Returned %s", esp_err_to_name(result));
+    }
+    return result;
+}
+
+idfx::SpiTransaction &DisplayDriverBase::beginTransaction() {
+    // Can only have one batch in progress at a time
+    waitForTransaction();
+
+    transaction_.begin(spi_device_, dc_pin_);
+    return transaction_;
+}
+
+esp_err_t DisplayDriverBase::sendArea(const lv_area_t *area, const void *pixels, size_t length,
+                                      idfx::spi_complete_function_t complete_function, void *arg) {
+    VERBOSE("Sending area x1=%d y1=%d x2=%d y2=%d of %d bytes", area->x1, area->y1, area->x2,
+            area->y2, length);
+
+    const uint8_t columns[] = {(uint8_t)(area->x1 >> 8), (uint8_t)(area->x1 & 0xFF),
+                               (uint8_t)(area->x2 >> 8), (uint8_t)(area->x2 & 0xFF)};
+    const uint8_t rows[] = {(uint8_t)(area->y1 >> 8), (uint8_t)(area->y1 & 0xFF),
+                            (uint8_t)(area->y2 >> 8), (uint8_t)(area->y2 & 0xFF)};
+
+    // The 4 byte parameters are copied by SpiTransaction so ok that they are on the stack
+    return beginTransaction()
+        .command(kCmdSetColumnAddress)
+        .data(columns, sizeof(columns))
+        .command(kCmdSetRowAddress)
+        .data(rows, sizeof(rows))
+        .command(kCmdWriteMemoryStart)
+        .data(pixels, length)
+        .onComplete(complete_function, arg)
+        .submit();
+}
+
+esp_err_t DisplayDriverBase::waitForTransaction() {
+    if (!transaction_.inProgress()) return ESP_OK;
+
+    return transaction_.wait();
+}
+
+esp_err_t DisplayDriverBase::copyArea(const lv_area_t *area, void *dest, size_t dest_stride,
+                                      const void *src, size_t src_stride,
+                                      idfx::copy_complete_function_t complete_function,
+                                      void *arg) {
+    waitForCopy();
+
+    const size_t pixel_size = lv_color_format_get_size(lv_display_get_color_format(lv_display_));
+    const size_t row_bytes = lv_area_get_width(area) * pixel_size;
+    const size_t offset_x = area->x1 * pixel_size;
+
+    copy_.begin()
+        .addRect((uint8_t *)dest + area->y1 * dest_stride + offset_x, dest_stride,
+                 (const uint8_t *)src + area->y1 * src_stride + offset_x, src_stride, row_bytes,
+                 lv_area_get_height(area))
+        .onComplete(complete_function, arg);
+    return copy_.submit();
+}
+
+esp_err_t DisplayDriverBase::waitForCopy() {
+    return copy_.wait();
+}
@@ -0,0 +1,118 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/display/displayDriverI80.hpp"
+
+#if SOC_LCD_I80_SUPPORTED
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "idfx/utils/log.hpp"
+
+// MIPI DCS commands
+static const int kCmdSoftwareReset = 0x01;
+static const int kCmdSleepOut = 0x11;
+static const int kCmdDisplayOn = 0x29;
+static const int kCmdSetColumnAddress = 0x2A;
+static const int kCmdSetRowAddress = 0x2B;
+static const int kCmdWriteMemoryStart = 0x2C;
+static const int kCmdPixelFormat = 0x3A;
+
+// For kCmdPixelFormat. 16 bits per pixel for both RGB and MCU interfaces.
+static const uint8_t kPixelFormatRgb565 = 0x55;
+
+DisplayDriverI80::DisplayDriverI80(int width, int height,
+                                   const esp_lcd_i80_bus_config_t &bus_config,
+                                   const esp_lcd_panel_io_i80_config_t &io_config)
+    : DisplayDriverBase(width, height),
+      bus_config_(bus_config),
+      io_config_(io_config),
+      bus_(nullptr),
+      io_(nullptr),
+      frames_flushed_(0) {
+    INFO("Creating i80 display driver for %dx%d panel with %d bit bus", width, height,
+         bus_config_.bus_width);
+
+    // With an 8 bit bus the RGB565 bytes need to be sent most significant first. Let the
+    // LCD peripheral swap them instead of the CPU, which also means that the buffers are
+    // not modified, as required for direct mode.
+    io_config_.flags.swap_color_bytes = bus_config_.bus_width == 8;
+    setSwapBytes(false);
+}
+
+DisplayDriverI80::~DisplayDriverI80() {
+    if (io_) esp_lcd_panel_io_del(io_);
+    if (bus_) esp_lcd_del_i80_bus(bus_);
+}
+
+void DisplayDriverI80::init() {
+    DEBUG("Initializing i80 bus and panel IO");
+
+    ESP_ERROR_CHECK(esp_lcd_new_i80_bus(&bus_config_, &bus_));
+
+    io_config_.on_color_trans_done = colorTransDone;
+    io_config_.user_ctx = this;
+    ESP_ERROR_CHECK(esp_lcd_new_panel_io_i80(bus_, &io_config_, &io_));
+
+    sendInitCommands();
+}
+
+void DisplayDriverI80::sendInitCommands() {
+    DEBUG("Sending generic MIPI DCS init commands");
+
+    esp_lcd_panel_io_tx_param(io_, kCmdSoftwareReset, nullptr, 0);
+    vTaskDelay(pdMS_TO_TICKS(120));
+    esp_lcd_panel_io_tx_param(io_, kCmdSleepOut, nullptr, 0);
+    vTaskDelay(pdMS_TO_TICKS(120));
+    esp_lcd_panel_io_tx_param(io_, kCmdPixelFormat, &kPixelFormatRgb565, 1);
+    esp_lcd_panel_io_tx_param(io_, kCmdDisplayOn, nullptr, 0);
+}
+
+void DisplayDriverI80::flush() {
+    lv_refr_now(lvglDisplay());
+}
+
+void DisplayDriverI80::flushArea(const lv_area_t *area, uint8_t *px_map) {
+    lv_display_t *disp = lvglDisplay();
+    lv_area_t full_area = {0, 0, width() - 1, height() - 1};
+
+    // In direct and full refresh modes the buffer is the whole frame. Only send it once
+    // the whole frame has been rendered.
+    if (lv_display_get_render_mode(disp) != LV_DISPLAY_RENDER_MODE_PARTIAL) {
+        if (!lv_display_flush_is_last(disp)) {
+            flushReady();
+            return;
+        }
+        area = &full_area;
+        frames_flushed_++;
+    }
+
+    const size_t num_pixels = lv_area_get_size(area);
+    const size_t length = num_pixels * lv_color_format_get_size(lv_display_get_color_format(disp));
+
+    const uint8_t columns[] = {(uint8_t)(area->x1 >> 8), (uint8_t)(area->x1 & 0xFF),
+                               (uint8_t)(area->x2 >> 8), (uint8_t)(area->x2 & 0xFF)};
+    const uint8_t rows[] = {(uint8_t)(area->y1 >> 8), (uint8_t)(area->y1 & 0xFF),
+                            (uint8_t)(area->y2 >> 8), (uint8_t)(area->y2 & 0xFF)};
+
+    // If tearing effect sync enabled, wait until clear of scanline
+    waitForScanline(area, length);
+
+    // The parameters are copied by esp_lcd. The pixel data is sent via DMA and
+    // colorTransDone() is called once done.
+    esp_lcd_panel_io_tx_param(io_, kCmdSetColumnAddress, columns, sizeof(columns));
+    esp_lcd_panel_io_tx_param(io_, kCmdSetRowAddress, rows, sizeof(rows));
+    esp_lcd_panel_io_tx_color(io_, kCmdWriteMemoryStart, px_map, length);
+}
+
+/* static */
+bool DisplayDriverI80::colorTransDone(esp_lcd_panel_io_handle_t panel_io,
+                                      esp_lcd_panel_io_event_data_t *edata, void *user_ctx) {
+    static_cast<DisplayDriverI80 *>(user_ctx)->flushReady();
+
+    // No higher priority task woken
+    return false;
+}
+
+#endif  // SOC_LCD_I80_SUPPORTED
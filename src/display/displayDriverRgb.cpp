@@ -0,0 +1,111 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/display/displayDriverRgb.hpp"
+
+#if SOC_LCD_RGB_SUPPORTED
+
+#include "esp_timer.h"
+#include "idfx/utils/log.hpp"
+
+DisplayDriverRgb::DisplayDriverRgb(const esp_lcd_rgb_panel_config_t &panel_config,
+                                   bool full_refresh, int bounce_buffer_lines)
+    : DisplayDriverBase(panel_config.timings.h_res, panel_config.timings.v_res),
+      panel_config_(panel_config),
+      full_refresh_(full_refresh),
+      panel_(nullptr),
+      flush_pending_(false),
+      vsyncs_(0),
+      vsyncs_start_usec_(0) {
+    INFO("Creating RGB display driver for %ldx%ld panel, full_refresh=%d bounce_buffer_lines=%d",
+         panel_config_.timings.h_res, panel_config_.timings.v_res, full_refresh_,
+         bounce_buffer_lines);
+
+    if (panel_config_.timings.v_res % bounce_buffer_lines != 0) {
+        WARN("Bounce buffer of %d lines does not divide evenly into panel height of %ld",
+             bounce_buffer_lines, panel_config_.timings.v_res);
+    }
+
+    panel_config_.num_fbs = full_refresh_ ? 2 : 1;
+    panel_config_.bounce_buffer_size_px = panel_config_.timings.h_res * bounce_buffer_lines;
+    panel_config_.flags.fb_in_psram = true;
+
+    // The RGB interface sends pixels in memory order so no byte swapping needed
+    setSwapBytes(false);
+}
+
+DisplayDriverRgb::~DisplayDriverRgb() {
+    if (panel_) esp_lcd_panel_del(panel_);
+}
+
+void DisplayDriverRgb::init() {
+    DEBUG("Initializing RGB panel");
+
+    ESP_ERROR_CHECK(esp_lcd_new_rgb_panel(&panel_config_, &panel_));
+
+    esp_lcd_rgb_panel_event_callbacks_t callbacks = {};
+    callbacks.on_vsync = onVsync;
+    ESP_ERROR_CHECK(esp_lcd_rgb_panel_register_event_callbacks(panel_, &callbacks, this));
+
+    ESP_ERROR_CHECK(esp_lcd_panel_reset(panel_));
+    ESP_ERROR_CHECK(esp_lcd_panel_init(panel_));
+    vsyncs_start_usec_ = esp_timer_get_time();
+
+    // LVGL renders directly into the frame buffers of the panel so that no copying is needed
+    void *fb0 = nullptr;
+    void *fb1 = nullptr;
+    if (full_refresh_) {
+        ESP_ERROR_CHECK(esp_lcd_rgb_panel_get_frame_buffer(panel_, 2, &fb0, &fb1));
+    } else {
+        ESP_ERROR_CHECK(esp_lcd_rgb_panel_get_frame_buffer(panel_, 1, &fb0));
+    }
+    const size_t fb_size = width() * height() * lv_color_format_get_size(LV_COLOR_FORMAT_RGB565);
+    registerLvglDisplay(fb0, fb1, fb_size,
+                        full_refresh_ ? LV_DISPLAY_RENDER_MODE_FULL : LV_DISPLAY_RENDER_MODE_DIRECT,
+                        LV_COLOR_FORMAT_RGB565);
+}
+
+void DisplayDriverRgb::flush() {
+    lv_refr_now(lvglDisplay());
+}
+
+void DisplayDriverRgb::flushArea(const lv_area_t *area, uint8_t *px_map) {
+    // In direct mode LVGL has rendered straight into the frame buffer being displayed
+    if (!full_refresh_) {
+        flushReady();
+        return;
+    }
+
+    // Full refresh. Since px_map is one of the panel's frame buffers esp_lcd doesn't copy
+    // it but instead switches to it. The previous frame buffer is still being displayed
+    // until the vsync so only then can it be handed back to LVGL.
+    flush_pending_ = true;
+    esp_lcd_panel_draw_bitmap(panel_, 0, 0, width(), height(), px_map);
+}
+
+float DisplayDriverRgb::refreshHz() const {
+    const int64_t elapsed_usec = esp_timer_get_time() - vsyncs_start_usec_;
+    return elapsed_usec > 0 ? vsyncs_ * 1000000.0f / elapsed_usec : 0.0f;
+}
+
+uint32_t DisplayDriverRgb::psramBytesPerSecond() const {
+    // Frame buffer is read at every refresh, and written for every rendered frame. In
+    // direct mode only the changed areas are written so this is an upper bound.
+    return drawBufSize() * (refreshHz() + renderedFps());
+}
+
+/* static */
+bool DisplayDriverRgb::onVsync(esp_lcd_panel_handle_t panel,
+                               const esp_lcd_rgb_panel_event_data_t *edata, void *user_ctx) {
+    auto driver = static_cast<DisplayDriverRgb *>(user_ctx);
+    driver->vsyncs_++;
+    if (driver->flush_pending_.exchange(false)) {
+        driver->flushReady();
+    }
+
+    // No higher priority task woken
+    return false;
+}
+
+#endif  // SOC_LCD_RGB_SUPPORTED
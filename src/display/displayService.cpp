@@ -0,0 +1,202 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/display/displayService.hpp"
+
+#include <algorithm>
+
+#include "esp_timer.h"
+#include "idfx/utils/log.hpp"
+
+using namespace idfx;
+
+// Even when LVGL has no timers that are due the task checks in this often
+static const uint32_t kMaxSleepMsec = 1000;
+
+SemaphoreHandle_t DisplayService::mutex_ = nullptr;
+TaskHandle_t DisplayService::task_ = nullptr;
+uint32_t DisplayService::idle_timeout_usec_ = 0;
+uint32_t DisplayService::idle_period_msec_ = 0;
+uint32_t DisplayService::active_period_msec_ = 0;
+volatile int64_t DisplayService::last_activity_usec_ = 0;
+volatile bool DisplayService::idle_ = false;
+std::vector<lv_indev_t *> DisplayService::waking_inputs_;
+DisplayService::stats_t DisplayService::stats_ = {};
+
+/* static */
+esp_err_t DisplayService::start(uint32_t idle_timeout_msec, uint32_t idle_period_msec,
+                           uint32_t active_period_msec, UBaseType_t task_priority,
+                           BaseType_t core_id) {
+    if (task_) {
+        WARN("DisplayService already started");
+        return ESP_OK;
+    }
+    INFO("Starting DisplayService with idle timeout of %ld msec and periods of %ld/%ld msec",
+         idle_timeout_msec, active_period_msec, idle_period_msec);
+
+    idle_timeout_usec_ = idle_timeout_msec * 1000;
+    idle_period_msec_ = idle_period_msec;
+    active_period_msec_ = active_period_msec;
+    last_activity_usec_ = esp_timer_get_time();
+    idle_ = false;
+    stats_ = {};
+
+    if (!lv_is_initialized()) lv_init();
+    lv_tick_set_cb(tickCallback);
+
+    mutex_ = xSemaphoreCreateRecursiveMutex();
+    if (mutex_ == nullptr) {
+        ERROR("Could not create LVGL mutex so DisplayService not started");
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(serviceTask, "lvgl", 8192, nullptr, task_priority, &task_,
+                                core_id) != pdPASS) {
+        ERROR("Could not create lvgl task so DisplayService not started");
+        task_ = nullptr;
+        vSemaphoreDelete(mutex_);
+        mutex_ = nullptr;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/* static */
+bool DisplayService::lock(uint32_t timeout_msec) {
+    const TickType_t timeout = timeout_msec == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeout_msec);
+    return xSemaphoreTakeRecursive(mutex_, timeout) == pdTRUE;
+}
+
+/* static */
+void DisplayService::unlock() {
+    xSemaphoreGiveRecursive(mutex_);
+}
+
+/* static */
+void DisplayService::wake() {
+    last_activity_usec_ = esp_timer_get_time();
+    if (task_) xTaskNotifyGive(task_);
+}
+
+/* static */
+void DisplayService::addWakingInput(lv_indev_t *indev) {
+    if (std::find(waking_inputs_.begin(), waking_inputs_.end(), indev) != waking_inputs_.end()) {
+        return;
+    }
+    waking_inputs_.push_back(indev);
+
+    // Use the current period right away. If not started yet then setTimerPeriods() sets it
+    // once the task is running.
+    lv_timer_t *timer = lv_indev_get_read_timer(indev);
+    if (task_ && timer) lv_timer_set_period(timer, idle_ ? idle_period_msec_ : active_period_msec_);
+}
+
+/* static */
+void DisplayService::removeWakingInput(lv_indev_t *indev) {
+    waking_inputs_.erase(std::remove(waking_inputs_.begin(), waking_inputs_.end(), indev),
+                         waking_inputs_.end());
+}
+
+/* static */
+DisplayService::stats_t DisplayService::stats() {
+    stats_t stats = stats_;
+    stats.idle = idle_;
+    return stats;
+}
+
+/* static */
+float DisplayService::idlePercent() {
+    const uint64_t total_usec = stats_.idle_usec + stats_.render_usec;
+    return total_usec ? 100.0f * stats_.idle_usec / total_usec : 0.0f;
+}
+
+/* static */
+void DisplayService::resetStats() {
+    stats_ = {};
+}
+
+/* static */
+uint32_t DisplayService::tickCallback() {
+    return esp_timer_get_time() / 1000;
+}
+
+/* static */
+void DisplayService::setTimerPeriods(uint32_t period_msec) {
+    for (lv_display_t *disp = lv_display_get_next(nullptr); disp; disp = lv_display_get_next(disp)) {
+        lv_timer_t *timer = lv_display_get_refr_timer(disp);
+        if (timer) lv_timer_set_period(timer, period_msec);
+    }
+
+    // Inputs that call wake() are handled right away even while idle, so their read
+    // timers can be slowed too. The read timers of other inputs are left alone. A polled
+    // input, such as a keypad or an encoder, can't wake the service, so slowing its read
+    // timer would delay the input by up to the idle period.
+    for (lv_indev_t *indev : waking_inputs_) {
+        lv_timer_t *timer = lv_indev_get_read_timer(indev);
+        if (timer) lv_timer_set_period(timer, period_msec);
+    }
+}
+
+/* static */
+void DisplayService::invalidateCallback(lv_event_t *event) {
+    last_activity_usec_ = esp_timer_get_time();
+
+    // If invalidated by another task, while it holds the lock, then the LVGL task needs
+    // to wake up so that the area is rendered right away
+    if (idle_ || xTaskGetCurrentTaskHandle() != task_) xTaskNotifyGive(task_);
+}
+
+/* static */
+bool DisplayService::hasInvalidateCallback(lv_display_t *disp) {
+    const uint32_t count = lv_display_get_event_count(disp);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (lv_event_dsc_get_cb(lv_display_get_event_dsc(disp, i)) == invalidateCallback) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* static */
+void DisplayService::serviceTask(void *arg) {
+    while (true) {
+        lock();
+
+        // Displays can be created at any time, so register for invalidations of new ones
+        for (lv_display_t *disp = lv_display_get_next(nullptr); disp;
+             disp = lv_display_get_next(disp)) {
+            if (!hasInvalidateCallback(disp)) {
+                lv_display_add_event_cb(disp, invalidateCallback, LV_EVENT_INVALIDATE_AREA,
+                                        nullptr);
+            }
+        }
+
+        const int64_t now_usec = esp_timer_get_time();
+        const bool inactive = now_usec - last_activity_usec_ > idle_timeout_usec_;
+        if (idle_ && !inactive) {
+            DEBUG("Display active again so using refresh period of %ld msec", active_period_msec_);
+            setTimerPeriods(active_period_msec_);
+            idle_ = false;
+        } else if (!idle_ && inactive) {
+            DEBUG("Display idle so using refresh period of %ld msec", idle_period_msec_);
+            setTimerPeriods(idle_period_msec_);
+            idle_ = true;
+            stats_.idle_entries++;
+        }
+
+        const uint32_t until_next_msec = lv_timer_handler();
+        const int64_t rendered_usec = esp_timer_get_time();
+        unlock();
+
+        stats_.render_usec += rendered_usec - now_usec;
+        stats_.wakeups++;
+
+        // Sleep until the next LVGL timer is due, or until woken by an invalidation from
+        // another task or by input. While active sleep at most the active period so
+        // that the switch to idle happens on time.
+        uint32_t sleep_msec = std::min(until_next_msec, kMaxSleepMsec);
+        if (!idle_) sleep_msec = std::min(sleep_msec, active_period_msec_);
+        ulTaskNotifyTake(pdTRUE, std::max<TickType_t>(pdMS_TO_TICKS(sleep_msec), 1));
+        stats_.idle_usec += esp_timer_get_time() - rendered_usec;
+    }
+}
@@ -0,0 +1,333 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/display/glyphCache.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "idfx/utils/log.hpp"
+
+using namespace idfx;
+
+GlyphCache::GlyphCache(size_t budget_bytes, uint8_t bpp)
+    : bpp_(bpp == 8 ? 8 : 4),
+      pages_total_(budget_bytes / kPageSize),
+      pages_used_(0),
+      page_classes_(budget_bytes / kPageSize, 0),
+      page_glyphs_(budget_bytes / kPageSize, 0),
+      stats_() {
+    INFO("Creating glyph cache with budget of %u bytes, %d bpp", budget_bytes, bpp_);
+
+    // Use PSRAM if available so that internal memory is kept for DMA and stacks
+    size_t size = pages_total_ * kPageSize;
+    memory_ = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (memory_ == nullptr) memory_ = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+    if (memory_ == nullptr) {
+        ERROR("Could not allocate %u bytes for glyph cache so glyphs will not be cached", size);
+        pages_total_ = 0;
+    }
+    stats_.pages_total = pages_total_;
+}
+
+GlyphCache::~GlyphCache() { heap_caps_free(memory_); }
+
+lv_font_t *GlyphCache::cachedFont(const lv_font_t *font, uint16_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for (proxy_font_t &proxy : proxies_) {
+        if (proxy.source == font && proxy.size == size) return &proxy.font;
+    }
+
+    proxies_.push_back({});
+    proxy_font_t &proxy = proxies_.back();
+    proxy.font = *font;
+    proxy.font.get_glyph_dsc = getGlyphDscCallback;
+    proxy.font.get_glyph_bitmap = getGlyphBitmapCallback;
+    proxy.font.release_glyph = nullptr;
+    proxy.font.user_data = &proxy;
+    proxy.source = font;
+    proxy.size = size;
+    proxy.cache = this;
+
+    DEBUG("Created cached font for font %p size %d", font, size);
+    return &proxy.font;
+}
+
+void GlyphCache::prewarm(const lv_font_t *cached_font, std::initializer_list<const char *> strings) {
+    for (const char *str : strings) prewarm(cached_font, str);
+}
+
+void GlyphCache::prewarm(const lv_font_t *cached_font, const char *str) {
+    proxy_font_t *proxy = (proxy_font_t *)cached_font->user_data;
+
+    lv_draw_buf_t *draw_buf = lv_draw_buf_create(1, 1, LV_COLOR_FORMAT_A8, 0);
+    if (draw_buf == nullptr) return;
+
+    uint32_t i = 0;
+    while (str[i] != '\0') {
+        uint32_t codepoint = lv_text_encoded_next(str, &i);
+        lv_font_glyph_dsc_t g_dsc = {};
+        if (!getGlyphDscCallback(cached_font, &g_dsc, codepoint, 0)) continue;
+        if (g_dsc.box_w == 0 || g_dsc.box_h == 0) continue;
+
+        lv_draw_buf_t *reshaped =
+            lv_draw_buf_reshape(draw_buf, LV_COLOR_FORMAT_A8, g_dsc.box_w, g_dsc.box_h, 0);
+        if (reshaped == nullptr) {
+            lv_draw_buf_destroy(draw_buf);
+            draw_buf = lv_draw_buf_create(g_dsc.box_w, g_dsc.box_h, LV_COLOR_FORMAT_A8, 0);
+            if (draw_buf == nullptr) return;
+        }
+        glyphBitmap(proxy, codepoint, draw_buf);
+    }
+
+    lv_draw_buf_destroy(draw_buf);
+}
+
+void GlyphCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Unassign all the pages so that they can be carved again for whichever size classes
+    // are used from now on
+    lru_.clear();
+    index_.clear();
+    for (std::vector<uint8_t *> &free_slots : free_slots_) free_slots.clear();
+    std::fill(page_classes_.begin(), page_classes_.end(), 0);
+    std::fill(page_glyphs_.begin(), page_glyphs_.end(), 0);
+    pages_used_ = 0;
+    stats_.glyphs = 0;
+}
+
+GlyphCache::stats_t GlyphCache::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.pages_used = pages_used_;
+    return stats_;
+}
+
+/* static */
+bool GlyphCache::getGlyphDscCallback(const lv_font_t *font, lv_font_glyph_dsc_t *g_dsc,
+                                     uint32_t letter, uint32_t letter_next) {
+    proxy_font_t *proxy = (proxy_font_t *)font->user_data;
+
+    // Metrics depend on the next letter because of kerning so always come from the source
+    // font. They are cheap compared to rasterizing.
+    if (!proxy->source->get_glyph_dsc(proxy->source, g_dsc, letter, letter_next)) return false;
+
+    // The bitmap callback is only given the glyph descriptor so pass the codepoint through
+    // the glyph id. The source glyph id is looked up again if the glyph has to be rasterized.
+    g_dsc->gid.index = letter;
+    return true;
+}
+
+/* static */
+const void *GlyphCache::getGlyphBitmapCallback(lv_font_glyph_dsc_t *g_dsc,
+                                               lv_draw_buf_t *draw_buf) {
+    proxy_font_t *proxy = (proxy_font_t *)g_dsc->resolved_font->user_data;
+    return proxy->cache->glyphBitmap(proxy, g_dsc->gid.index, draw_buf);
+}
+
+/**
+ * Copies the glyph from the cache into the draw buffer as A8, rasterizing it first with
+ * the source font if not yet cached.
+ */
+const void *GlyphCache::glyphBitmap(proxy_font_t *proxy, uint32_t codepoint,
+                                    lv_draw_buf_t *draw_buf) {
+    glyph_key_t key = {proxy->source, proxy->size, codepoint};
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            copyOut(*it->second, draw_buf);
+            stats_.hits++;
+            return draw_buf;
+        }
+    }
+
+    // Not cached so rasterize with the source font. Done without the lock since it is
+    // the slow part.
+    const lv_font_t *source = proxy->source;
+    lv_font_glyph_dsc_t source_dsc = {};
+    if (!source->get_glyph_dsc(source, &source_dsc, codepoint, 0)) return nullptr;
+    source_dsc.resolved_font = source;
+
+    const void *result = source->get_glyph_bitmap(&source_dsc, draw_buf);
+    bool cacheable = result == draw_buf && source_dsc.format >= LV_FONT_GLYPH_FORMAT_A1 &&
+                     source_dsc.format <= LV_FONT_GLYPH_FORMAT_A8;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (cacheable) {
+        store(key, draw_buf, source_dsc.box_w, source_dsc.box_h);
+        stats_.misses++;
+    } else {
+        stats_.uncacheable++;
+    }
+
+    if (source->release_glyph) source->release_glyph(source, &source_dsc);
+    return result;
+}
+
+/**
+ * Returns a free slot of the size class. If there are none, and all pages have been
+ * assigned, then a page of another size class that holds no glyphs is reassigned to this
+ * size class. Otherwise the least recently used glyph is evicted. If that glyph is of
+ * another size class then its whole page is reclaimed and reassigned to this size class,
+ * so that pages move to the size classes that are actually in use. Returns null if no
+ * slot available. Mutex must be held.
+ */
+uint8_t *GlyphCache::allocate(int size_class) {
+    std::vector<uint8_t *> &free_slots = free_slots_[size_class];
+
+    // If no free slots then carve a new page into slots for the size class
+    if (free_slots.empty() && pages_used_ < pages_total_) {
+        carvePage(pages_used_++, size_class);
+    }
+
+    // If still no free slots then reuse a page whose slots are all free, which doesn't
+    // require evicting anything
+    if (free_slots.empty()) {
+        for (size_t page_index = 0; page_index < pages_used_; ++page_index) {
+            if (page_glyphs_[page_index] == 0 && page_classes_[page_index] != size_class) {
+                reclaimPage(page_index);
+                carvePage(page_index, size_class);
+                break;
+            }
+        }
+    }
+
+    // If still no free slots then evict
+    if (free_slots.empty()) {
+        if (lru_.empty()) return nullptr;
+
+        glyph_entry_t &oldest = lru_.back();
+        if (oldest.size_class == size_class) {
+            VERBOSE("Evicting glyph %lu of font %p", oldest.key.codepoint, oldest.key.font);
+            uint8_t *slot = oldest.bitmap;
+            page_glyphs_[(slot - memory_) / kPageSize]--;
+            index_.erase(oldest.key);
+            lru_.pop_back();
+            stats_.evictions++;
+            stats_.glyphs--;
+            return slot;
+        }
+
+        const size_t page_index = (oldest.bitmap - memory_) / kPageSize;
+        reclaimPage(page_index);
+        carvePage(page_index, size_class);
+    }
+
+    uint8_t *slot = free_slots.back();
+    free_slots.pop_back();
+    return slot;
+}
+
+/**
+ * Assigns the page to the size class and adds its slots to the free slots of the class.
+ * Mutex must be held.
+ */
+void GlyphCache::carvePage(size_t page_index, int size_class) {
+    uint8_t *page = memory_ + page_index * kPageSize;
+    page_classes_[page_index] = size_class;
+    for (size_t offset = 0; offset < kPageSize; offset += kSizeClasses[size_class]) {
+        free_slots_[size_class].push_back(page + offset);
+    }
+}
+
+/**
+ * Evicts all the glyphs of the page and removes its free slots from its size class, so
+ * that the page can be assigned to another size class. Mutex must be held.
+ */
+void GlyphCache::reclaimPage(size_t page_index) {
+    uint8_t *page = memory_ + page_index * kPageSize;
+    const int size_class = page_classes_[page_index];
+    auto on_page = [page](const uint8_t *slot) { return slot >= page && slot < page + kPageSize; };
+    VERBOSE("Reclaiming page %u from size class %d", page_index, size_class);
+
+    for (auto it = lru_.begin(); it != lru_.end();) {
+        if (on_page(it->bitmap)) {
+            index_.erase(it->key);
+            it = lru_.erase(it);
+            stats_.evictions++;
+            stats_.glyphs--;
+        } else {
+            ++it;
+        }
+    }
+
+    page_glyphs_[page_index] = 0;
+
+    std::vector<uint8_t *> &free_slots = free_slots_[size_class];
+    free_slots.erase(std::remove_if(free_slots.begin(), free_slots.end(), on_page),
+                     free_slots.end());
+    stats_.pages_reclaimed++;
+}
+
+/**
+ * Stores the A8 glyph of the draw buffer into the cache. Mutex must be held.
+ */
+void GlyphCache::store(const glyph_key_t &key, const lv_draw_buf_t *draw_buf, uint16_t box_w,
+                       uint16_t box_h) {
+    // Could have been stored by another draw unit while rasterizing
+    if (index_.count(key)) return;
+
+    size_t bytes = bpp_ == 8 ? box_w * box_h : (box_w * box_h + 1) / 2;
+    int size_class = 0;
+    while (size_class < kNumSizeClasses && kSizeClasses[size_class] < bytes) size_class++;
+    if (size_class == kNumSizeClasses) {
+        stats_.uncacheable++;
+        return;
+    }
+
+    uint8_t *slot = allocate(size_class);
+    if (slot == nullptr) {
+        stats_.uncacheable++;
+        return;
+    }
+
+    uint32_t stride = draw_buf->header.stride ? draw_buf->header.stride : box_w;
+    const uint8_t *src = (const uint8_t *)draw_buf->data;
+    if (bpp_ == 8) {
+        for (int y = 0; y < box_h; ++y) memcpy(slot + y * box_w, src + y * stride, box_w);
+    } else {
+        // Pack two pixels per byte, rounded to nearest
+        memset(slot, 0, bytes);
+        int i = 0;
+        for (int y = 0; y < box_h; ++y) {
+            for (int x = 0; x < box_w; ++x, ++i) {
+                uint8_t value = (src[y * stride + x] * 15 + 127) / 255;
+                slot[i / 2] |= (i & 1) ? value : value << 4;
+            }
+        }
+    }
+
+    lru_.push_front({key, slot, box_w, box_h, (uint8_t)size_class});
+    index_[key] = lru_.begin();
+    page_glyphs_[(slot - memory_) / kPageSize]++;
+    stats_.glyphs++;
+}
+
+/**
+ * Copies a cached glyph into the draw buffer as A8. Mutex must be held.
+ */
+void GlyphCache::copyOut(const glyph_entry_t &entry, lv_draw_buf_t *draw_buf) {
+    uint32_t stride = draw_buf->header.stride ? draw_buf->header.stride : entry.box_w;
+    uint8_t *dest = (uint8_t *)draw_buf->data;
+
+    if (bpp_ == 8) {
+        for (int y = 0; y < entry.box_h; ++y) {
+            memcpy(dest + y * stride, entry.bitmap + y * entry.box_w, entry.box_w);
+        }
+    } else {
+        int i = 0;
+        for (int y = 0; y < entry.box_h; ++y) {
+            for (int x = 0; x < entry.box_w; ++x, ++i) {
+                uint8_t packed = entry.bitmap[i / 2];
+                uint8_t value = (i & 1) ? packed & 0x0F : packed >> 4;
+                dest[y * stride + x] = value * 17;
+            }
+        }
+    }
+}
@@ -0,0 +1,314 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/display/imageDecoder.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <mutex>
+
+#include "esp_heap_caps.h"
+#include "idfx/utils/log.hpp"
+
+using namespace idfx;
+
+// A decoded image held in the cache. Entries that are referenced by an open decoder
+// descriptor are not evicted until they are closed.
+typedef struct CacheEntry {
+    const void *src;
+    lv_draw_buf_t draw_buf;
+    void *memory;
+    size_t size;
+    int refs;
+} cache_entry_t;
+
+// What a decoder descriptor is using. Stored in dsc->user_data.
+typedef struct DecodeContext {
+    const idfx_image_header_t *hdr;
+    cache_entry_t *entry;   // if whole image decoded into the cache
+    lv_draw_buf_t *chunk;   // if decoding by lines
+} decode_context_t;
+
+// Most recently used entry is at the front. Decoders can be called from multiple draw
+// units concurrently so access is protected by a mutex.
+static std::list<cache_entry_t> cache_;
+static std::mutex cache_mutex_;
+static ImageDecoder::cache_stats_t stats_ = {};
+
+/**
+ * Returns the idfx image header if the source is an idfx compressed image, otherwise null
+ */
+static const idfx_image_header_t *imageHeader(const lv_image_decoder_dsc_t *dsc) {
+    if (dsc->src_type != LV_IMAGE_SRC_VARIABLE) return nullptr;
+
+    const lv_image_dsc_t *img = (const lv_image_dsc_t *)dsc->src;
+    if (img->header.cf != LV_COLOR_FORMAT_RAW && img->header.cf != LV_COLOR_FORMAT_RAW_ALPHA)
+        return nullptr;
+    if (img->data == nullptr || img->data_size < sizeof(idfx_image_header_t)) return nullptr;
+
+    const idfx_image_header_t *hdr = (const idfx_image_header_t *)img->data;
+    if (hdr->magic != kIdfxImageMagic) return nullptr;
+    if (img->data_size < sizeof(idfx_image_header_t) + hdr->height * sizeof(uint32_t)) {
+        WARN("idfx image data of %lu bytes is truncated", img->data_size);
+        return nullptr;
+    }
+
+    return hdr;
+}
+
+/**
+ * Returns pointer to the encoded data for the specified line
+ */
+static const uint8_t *lineData(const idfx_image_header_t *hdr, int y) {
+    const uint8_t *offsets = (const uint8_t *)(hdr + 1);
+    const uint8_t *lines = offsets + hdr->height * sizeof(uint32_t);
+
+    // Offsets are not necessarily aligned so copy instead of dereferencing
+    uint32_t offset;
+    memcpy(&offset, offsets + y * sizeof(uint32_t), sizeof(offset));
+    return lines + offset;
+}
+
+/**
+ * Decodes count run length encoded RGB565 pixels. Returns pointer to the following data.
+ */
+static const uint8_t *decodeRle16(const uint8_t *in, uint16_t *out, int count) {
+    while (count > 0) {
+        uint8_t control = *in++;
+        int n = std::min((control & 0x7F) + 1, count);
+        if (control & 0x80) {
+            uint16_t value = in[0] | (in[1] << 8);
+            in += 2;
+            for (int i = 0; i < n; ++i) out[i] = value;
+        } else {
+            memcpy(out, in, n * 2);
+            in += n * 2;
+        }
+        out += n;
+        count -= n;
+    }
+    return in;
+}
+
+/**
+ * Decodes count run length encoded alpha values. Returns pointer to the following data.
+ */
+static const uint8_t *decodeRle8(const uint8_t *in, uint8_t *out, int count) {
+    while (count > 0) {
+        uint8_t control = *in++;
+        int n = std::min((control & 0x7F) + 1, count);
+        if (control & 0x80) {
+            memset(out, *in++, n);
+        } else {
+            memcpy(out, in, n);
+            in += n;
+        }
+        out += n;
+        count -= n;
+    }
+    return in;
+}
+
+/**
+ * Decodes num_lines lines, starting at first_line, into the draw buffer. For RGB565A8 the
+ * alpha plane directly follows the RGB565 pixels of the decoded lines.
+ */
+static void decodeLines(const idfx_image_header_t *hdr, int first_line, int num_lines,
+                        lv_draw_buf_t *buf) {
+    uint32_t stride = buf->header.stride;
+    uint8_t *rgb = (uint8_t *)buf->data;
+    uint8_t *alpha = rgb + stride * num_lines;
+
+    for (int row = 0; row < num_lines; ++row) {
+        const uint8_t *in = lineData(hdr, first_line + row);
+        uint16_t *rgb_row = (uint16_t *)(rgb + row * stride);
+        uint8_t *alpha_row = alpha + row * (stride / 2);
+
+        if (hdr->compression == 0) {
+            memcpy(rgb_row, in, hdr->width * 2);
+            if (hdr->has_alpha) memcpy(alpha_row, in + hdr->width * 2, hdr->width);
+        } else {
+            in = decodeRle16(in, rgb_row, hdr->width);
+            if (hdr->has_alpha) decodeRle8(in, alpha_row, hdr->width);
+        }
+    }
+}
+
+/**
+ * Frees least recently used entries that are not in use until there is room for
+ * needed_bytes. Returns false if that is not possible. Cache mutex must be held.
+ */
+static bool makeRoom(size_t needed_bytes) {
+    auto it = cache_.end();
+    while (stats_.used_bytes + needed_bytes > stats_.budget_bytes && it != cache_.begin()) {
+        --it;
+        if (it->refs > 0) continue;
+
+        VERBOSE("Evicting decoded image %p of %u bytes", it->src, it->size);
+        stats_.used_bytes -= it->size;
+        stats_.evictions++;
+        heap_caps_free(it->memory);
+        it = cache_.erase(it);
+    }
+
+    return stats_.used_bytes + needed_bytes <= stats_.budget_bytes;
+}
+
+/* static */
+void ImageDecoder::install(size_t cache_budget_bytes) {
+    INFO("Installing idfx image decoder with cache budget of %u bytes", cache_budget_bytes);
+
+    stats_.budget_bytes = cache_budget_bytes;
+
+    lv_image_decoder_t *decoder = lv_image_decoder_create();
+    lv_image_decoder_set_info_cb(decoder, infoCallback);
+    lv_image_decoder_set_open_cb(decoder, openCallback);
+    lv_image_decoder_set_get_area_cb(decoder, getAreaCallback);
+    lv_image_decoder_set_close_cb(decoder, closeCallback);
+}
+
+/* static */
+ImageDecoder::cache_stats_t ImageDecoder::cacheStats() {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    return stats_;
+}
+
+/* static */
+void ImageDecoder::clearCache() {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+
+    for (auto it = cache_.begin(); it != cache_.end();) {
+        if (it->refs > 0) {
+            ++it;
+            continue;
+        }
+        stats_.used_bytes -= it->size;
+        heap_caps_free(it->memory);
+        it = cache_.erase(it);
+    }
+}
+
+/* static */
+lv_result_t ImageDecoder::infoCallback(lv_image_decoder_t *decoder, lv_image_decoder_dsc_t *dsc,
+                                       lv_image_header_t *header) {
+    const idfx_image_header_t *hdr = imageHeader(dsc);
+    if (hdr == nullptr) return LV_RESULT_INVALID;
+
+    header->magic = LV_IMAGE_HEADER_MAGIC;
+    header->w = hdr->width;
+    header->h = hdr->height;
+    header->cf = hdr->has_alpha ? LV_COLOR_FORMAT_RGB565A8 : LV_COLOR_FORMAT_RGB565;
+    header->stride = lv_draw_buf_width_to_stride(hdr->width, (lv_color_format_t)header->cf);
+    return LV_RESULT_OK;
+}
+
+/* static */
+lv_result_t ImageDecoder::openCallback(lv_image_decoder_t *decoder, lv_image_decoder_dsc_t *dsc) {
+    const idfx_image_header_t *hdr = imageHeader(dsc);
+    if (hdr == nullptr) return LV_RESULT_INVALID;
+
+    decode_context_t *context = (decode_context_t *)lv_malloc_zeroed(sizeof(decode_context_t));
+    if (context == nullptr) return LV_RESULT_INVALID;
+    context->hdr = hdr;
+    dsc->user_data = context;
+
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+
+    // If already decoded then move to front of the LRU list and use it
+    for (auto it = cache_.begin(); it != cache_.end(); ++it) {
+        if (it->src == dsc->src) {
+            cache_.splice(cache_.begin(), cache_, it);
+            it->refs++;
+            stats_.hits++;
+            context->entry = &*it;
+            dsc->decoded = &it->draw_buf;
+            return LV_RESULT_OK;
+        }
+    }
+
+    // Not cached. Decode the whole image into the cache if it fits within the budget.
+    lv_color_format_t cf = (lv_color_format_t)dsc->header.cf;
+    uint32_t stride = lv_draw_buf_width_to_stride(hdr->width, cf);
+    size_t size = stride * hdr->height;
+    if (hdr->has_alpha) size += (stride / 2) * hdr->height;
+
+    if (makeRoom(size)) {
+        // Use PSRAM if available so that internal memory is kept for DMA and stacks
+        void *memory = heap_caps_aligned_alloc(LV_DRAW_BUF_ALIGN, size, MALLOC_CAP_SPIRAM);
+        if (memory == nullptr)
+            memory = heap_caps_aligned_alloc(LV_DRAW_BUF_ALIGN, size, MALLOC_CAP_DEFAULT);
+
+        if (memory != nullptr) {
+            cache_.push_front({dsc->src, {}, memory, size, 1});
+            cache_entry_t &entry = cache_.front();
+            lv_draw_buf_init(&entry.draw_buf, hdr->width, hdr->height, cf, stride, memory, size);
+            decodeLines(hdr, 0, hdr->height, &entry.draw_buf);
+
+            stats_.misses++;
+            stats_.used_bytes += size;
+            context->entry = &entry;
+            dsc->decoded = &entry.draw_buf;
+            DEBUG("Decoded %dx%d image %p into cache, %u bytes", hdr->width, hdr->height,
+                  dsc->src, size);
+            return LV_RESULT_OK;
+        }
+    }
+
+    // Too large for the cache so leave dsc->decoded null. LVGL then calls getAreaCallback()
+    // to decode a chunk of lines at a time.
+    stats_.line_decodes++;
+    return LV_RESULT_OK;
+}
+
+/* static */
+lv_result_t ImageDecoder::getAreaCallback(lv_image_decoder_t *decoder,
+                                          lv_image_decoder_dsc_t *dsc,
+                                          const lv_area_t *full_area, lv_area_t *decoded_area) {
+    decode_context_t *context = (decode_context_t *)dsc->user_data;
+    const idfx_image_header_t *hdr = context->hdr;
+
+    if (decoded_area->y1 == LV_COORD_MIN) {
+        // First call so start at top of the requested area. Whole lines are decoded
+        // since the run length encoding doesn't allow starting in the middle of a line.
+        decoded_area->x1 = 0;
+        decoded_area->x2 = hdr->width - 1;
+        decoded_area->y1 = full_area->y1;
+
+        if (context->chunk == nullptr) {
+            context->chunk = lv_draw_buf_create(hdr->width, kLinesPerChunk,
+                                                (lv_color_format_t)dsc->header.cf, 0);
+            if (context->chunk == nullptr) return LV_RESULT_INVALID;
+        }
+        dsc->decoded = context->chunk;
+    } else {
+        decoded_area->y1 = decoded_area->y2 + 1;
+    }
+
+    if (decoded_area->y1 > full_area->y2) return LV_RESULT_INVALID;
+
+    int lines = std::min(kLinesPerChunk, (int)(full_area->y2 - decoded_area->y1 + 1));
+    decoded_area->y2 = decoded_area->y1 + lines - 1;
+
+    // The alpha plane must directly follow the RGB565 pixels of the decoded lines
+    context->chunk->header.h = lines;
+    decodeLines(hdr, decoded_area->y1, lines, context->chunk);
+    return LV_RESULT_OK;
+}
+
+/* static */
+void ImageDecoder::closeCallback(lv_image_decoder_t *decoder, lv_image_decoder_dsc_t *dsc) {
+    decode_context_t *context = (decode_context_t *)dsc->user_data;
+    if (context == nullptr) return;
+
+    if (context->entry) {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        context->entry->refs--;
+    }
+    if (context->chunk) lv_draw_buf_destroy(context->chunk);
+
+    lv_free(context);
+    dsc->user_data = nullptr;
+    dsc->decoded = nullptr;
+}
@@ -0,0 +1,295 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/display/lvglAllocator.hpp"
+
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "esp_memory_utils.h"
+#include "freertos/FreeRTOS.h"
+#include "idfx/utils/log.hpp"
+#include "lvgl.h"
+
+using namespace idfx;
+
+// Every block has a header so that free and realloc know the size class. Is 8 bytes so that
+// the memory returned keeps 8 byte alignment.
+typedef struct BlockHeader {
+    uint16_t size_class;  // index into kSizeClasses, or kLargeClass
+    uint16_t reserved;
+    uint32_t size;        // requested size, for realloc and the statistics
+} block_header_t;
+
+static const uint16_t kLargeClass = 0xFFFF;
+
+// Free blocks are linked through their first word, after the header
+typedef struct FreeBlock {
+    struct FreeBlock *next;
+} free_block_t;
+
+static free_block_t *free_lists_[LvglAllocator::kNumSizeClasses] = {};
+static LvglAllocator::stats_t stats_ = {};
+static portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
+
+/* Returns index of the smallest size class that fits size, or kLargeClass */
+static uint16_t sizeClassFor(size_t size) {
+    for (int i = 0; i < LvglAllocator::kNumSizeClasses; ++i) {
+        if (size <= LvglAllocator::kSizeClasses[i]) return i;
+    }
+    return kLargeClass;
+}
+
+/* Allocates a new slab page for the size class and adds its blocks to the free list. Is
+ * called without the lock held since heap_caps_malloc() can take a while. */
+static bool addPage(uint16_t size_class) {
+    const bool internal = stats_.slab_internal_bytes + LvglAllocator::kPageSize <=
+                          LvglAllocator::kMaxInternalSlabBytes;
+    uint8_t *page = nullptr;
+    // Must be byte addressable. On the ESP32 MALLOC_CAP_INTERNAL alone can return IRAM,
+    // which only supports 32 bit access, and LVGL would then get a LoadStoreError.
+    if (internal) {
+        page = (uint8_t *)heap_caps_malloc(LvglAllocator::kPageSize,
+                                           MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (page == nullptr) page = (uint8_t *)heap_caps_malloc(LvglAllocator::kPageSize, MALLOC_CAP_SPIRAM);
+    if (page == nullptr) page = (uint8_t *)heap_caps_malloc(LvglAllocator::kPageSize, MALLOC_CAP_DEFAULT);
+    if (page == nullptr) return false;
+
+    const size_t stride = sizeof(block_header_t) + LvglAllocator::kSizeClasses[size_class];
+    const uint32_t num_blocks = LvglAllocator::kPageSize / stride;
+
+    // Link the blocks of the page together before taking the lock
+    free_block_t *first = nullptr;
+    free_block_t *last = nullptr;
+    for (uint32_t i = 0; i < num_blocks; ++i) {
+        free_block_t *block = (free_block_t *)(page + i * stride + sizeof(block_header_t));
+        block->next = nullptr;
+        if (last) {
+            last->next = block;
+        } else {
+            first = block;
+        }
+        last = block;
+    }
+
+    portENTER_CRITICAL(&lock_);
+    last->next = free_lists_[size_class];
+    free_lists_[size_class] = first;
+    LvglAllocator::size_class_stats_t &class_stats = stats_.classes[size_class];
+    class_stats.pages++;
+    class_stats.blocks_total += num_blocks;
+    stats_.slab_bytes += LvglAllocator::kPageSize;
+    if (esp_ptr_internal(page)) stats_.slab_internal_bytes += LvglAllocator::kPageSize;
+    portEXIT_CRITICAL(&lock_);
+
+    return true;
+}
+
+/* Keeps track of the maximum memory in use. Needs to be called with the lock held. */
+static void updateUsedMax() {
+    const size_t used = stats_.slab_used_bytes + stats_.large_bytes;
+    if (used > stats_.used_bytes_max) stats_.used_bytes_max = used;
+}
+
+static void *allocate(size_t size) {
+    const uint16_t size_class = sizeClassFor(size);
+
+    if (size_class == kLargeClass) {
+        // Large buffers go to PSRAM so that internal RAM is kept for DMA, stacks and the slabs
+        block_header_t *header = (block_header_t *)heap_caps_malloc(
+            sizeof(block_header_t) + size, MALLOC_CAP_SPIRAM);
+        if (header == nullptr) {
+            header = (block_header_t *)heap_caps_malloc(sizeof(block_header_t) + size,
+                                                        MALLOC_CAP_DEFAULT);
+        }
+
+        portENTER_CRITICAL(&lock_);
+        if (header == nullptr) {
+            stats_.failures++;
+            portEXIT_CRITICAL(&lock_);
+            return nullptr;
+        }
+        stats_.large_allocs++;
+        stats_.large_in_use++;
+        stats_.large_bytes += size;
+        if (stats_.large_bytes > stats_.large_bytes_max) stats_.large_bytes_max = stats_.large_bytes;
+        updateUsedMax();
+        portEXIT_CRITICAL(&lock_);
+
+        *header = {kLargeClass, 0, (uint32_t)size};
+        return header + 1;
+    }
+
+    // Pop a block from the free list of the size class, adding a page if there is none
+    while (true) {
+        portENTER_CRITICAL(&lock_);
+        free_block_t *block = free_lists_[size_class];
+        if (block) {
+            free_lists_[size_class] = block->next;
+            LvglAllocator::size_class_stats_t &class_stats = stats_.classes[size_class];
+            class_stats.allocs++;
+            class_stats.blocks_used++;
+            if (class_stats.blocks_used > class_stats.blocks_used_max) {
+                class_stats.blocks_used_max = class_stats.blocks_used;
+            }
+            stats_.slab_used_bytes += size;
+            updateUsedMax();
+            portEXIT_CRITICAL(&lock_);
+
+            block_header_t *header = (block_header_t *)block - 1;
+            *header = {size_class, 0, (uint32_t)size};
+            return block;
+        }
+        portEXIT_CRITICAL(&lock_);
+
+        if (!addPage(size_class)) {
+            portENTER_CRITICAL(&lock_);
+            stats_.failures++;
+            portEXIT_CRITICAL(&lock_);
+            return nullptr;
+        }
+    }
+}
+
+static void release(void *ptr) {
+    if (ptr == nullptr) return;
+
+    block_header_t *header = (block_header_t *)ptr - 1;
+    if (header->size_class == kLargeClass) {
+        portENTER_CRITICAL(&lock_);
+        stats_.large_in_use--;
+        stats_.large_bytes -= header->size;
+        portEXIT_CRITICAL(&lock_);
+        heap_caps_free(header);
+        return;
+    }
+
+    free_block_t *block = (free_block_t *)ptr;
+    portENTER_CRITICAL(&lock_);
+    block->next = free_lists_[header->size_class];
+    free_lists_[header->size_class] = block;
+    stats_.classes[header->size_class].blocks_used--;
+    stats_.slab_used_bytes -= header->size;
+    portEXIT_CRITICAL(&lock_);
+}
+
+/* static */
+LvglAllocator::stats_t LvglAllocator::stats() {
+    portENTER_CRITICAL(&lock_);
+    stats_t stats = stats_;
+    portEXIT_CRITICAL(&lock_);
+
+    for (int i = 0; i < kNumSizeClasses; ++i) stats.classes[i].block_size = kSizeClasses[i];
+    return stats;
+}
+
+/* static */
+float LvglAllocator::slabWastePercent() {
+    const stats_t stats = LvglAllocator::stats();
+    if (stats.slab_bytes == 0) return 0.0f;
+    return 100.0f * (stats.slab_bytes - stats.slab_used_bytes) / stats.slab_bytes;
+}
+
+/* static */
+void LvglAllocator::logStats() {
+    const stats_t stats = LvglAllocator::stats();
+
+    INFO("LVGL slabs use %u bytes, %u internal, %.1f%% waste. Large allocations: %ld using "
+         "%u bytes, max %u. Failures: %ld",
+         stats.slab_bytes, stats.slab_internal_bytes, slabWastePercent(), stats.large_in_use,
+         stats.large_bytes, stats.large_bytes_max, stats.failures);
+    for (const size_class_stats_t &class_stats : stats.classes) {
+        INFO("  size %3d: pages=%d blocks used=%ld/%ld max=%ld allocs=%ld", class_stats.block_size,
+             class_stats.pages, class_stats.blocks_used, class_stats.blocks_total,
+             class_stats.blocks_used_max, class_stats.allocs);
+    }
+}
+
+#if LV_USE_STDLIB_MALLOC == LV_STDLIB_CUSTOM
+
+/*
+ * The functions that LVGL calls when LV_USE_STDLIB_MALLOC is LV_STDLIB_CUSTOM
+ */
+
+void lv_mem_init(void) {
+    // Nothing to do since pages are added on demand
+}
+
+void lv_mem_deinit(void) {
+    // Pages are kept, since LVGL could be initialized again
+}
+
+lv_mem_pool_t lv_mem_add_pool(void *mem, size_t bytes) {
+    // Memory comes from heap_caps so additional pools are not supported
+    return nullptr;
+}
+
+void lv_mem_remove_pool(lv_mem_pool_t pool) {}
+
+void *lv_malloc_core(size_t size) {
+    return allocate(size);
+}
+
+void *lv_realloc_core(void *p, size_t new_size) {
+    if (p == nullptr) return allocate(new_size);
+
+    // If still fits in the same size class then can simply keep the block
+    block_header_t *header = (block_header_t *)p - 1;
+    if (header->size_class != kLargeClass && sizeClassFor(new_size) == header->size_class) {
+        portENTER_CRITICAL(&lock_);
+        stats_.slab_used_bytes += new_size - header->size;
+        portEXIT_CRITICAL(&lock_);
+        header->size = new_size;
+        return p;
+    }
+
+    void *new_p = allocate(new_size);
+    if (new_p == nullptr) return nullptr;
+    memcpy(new_p, p, header->size < new_size ? header->size : new_size);
+    release(p);
+    return new_p;
+}
+
+void lv_free_core(void *p) {
+    release(p);
+}
+
+void lv_mem_monitor_core(lv_mem_monitor_t *mon_p) {
+    const LvglAllocator::stats_t stats = LvglAllocator::stats();
+
+    uint32_t free_cnt = 0;
+    uint32_t used_cnt = stats.large_in_use;
+    size_t free_biggest = 0;
+    for (const LvglAllocator::size_class_stats_t &class_stats : stats.classes) {
+        free_cnt += class_stats.blocks_total - class_stats.blocks_used;
+        used_cnt += class_stats.blocks_used;
+        if (class_stats.blocks_total > class_stats.blocks_used) free_biggest = class_stats.block_size;
+    }
+
+    // Large allocations come from the heap, so report its free memory too
+    const uint32_t caps = MALLOC_CAP_SPIRAM;
+    const size_t heap_free = heap_caps_get_free_size(caps) ? heap_caps_get_free_size(caps)
+                                                           : heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    const size_t heap_biggest = heap_caps_get_largest_free_block(caps)
+                                    ? heap_caps_get_largest_free_block(caps)
+                                    : heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+
+    const size_t used = stats.slab_used_bytes + stats.large_bytes;
+    const size_t free_size = stats.slab_bytes - stats.slab_used_bytes + heap_free;
+    mon_p->total_size = used + free_size;
+    mon_p->free_cnt = free_cnt;
+    mon_p->free_size = free_size;
+    mon_p->free_biggest_size = heap_biggest > free_biggest ? heap_biggest : free_biggest;
+    mon_p->used_cnt = used_cnt;
+    mon_p->max_used = stats.used_bytes_max;
+    mon_p->used_pct = mon_p->total_size ? 100 * used / mon_p->total_size : 0;
+    mon_p->frag_pct = free_size ? 100 - 100 * mon_p->free_biggest_size / free_size : 0;
+}
+
+lv_result_t lv_mem_test_core(void) {
+    return LV_RESULT_OK;
+}
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/display/spiTransaction.hpp"
+
+#include <cstring>
+
+#include "esp_attr.h"
+#include "hal/gpio_ll.h"
+#include "idfx/utils/log.hpp"
+
+using namespace idfx;
+
+SpiTransaction::SpiTransaction()
+    : device_(nullptr),
+      dc_pin_(GPIO_NUM_NC),
+      num_phases_(0),
+      num_queued_(0),
+      complete_function_(nullptr),
+      complete_arg_(nullptr) {}
+
+void SpiTransaction::begin(spi_device_handle_t device, gpio_num_t dc_pin) {
+    ASSERT_MSG(num_queued_ == 0, "SpiTransaction::begin() called while previous batch in progress");
+
+    device_ = device;
+    dc_pin_ = dc_pin;
+    num_phases_ = 0;
+    num_queued_ = 0;
+    complete_function_ = nullptr;
+    complete_arg_ = nullptr;
+}
+
+spi_transaction_t* SpiTransaction::addPhase(size_t length, bool is_data) {
+    if (num_phases_ >= kMaxPhases) {
+        ERROR("SpiTransaction already has the maximum of %d phases", kMaxPhases);
+        return nullptr;
+    }
+
+    // The callbacks find this object, and therefore the DC level, via the user field
+    dc_levels_[num_phases_] = is_data ? 1 : 0;
+    spi_transaction_t* trans = &phases_[num_phases_++];
+    memset(trans, 0, sizeof(spi_transaction_t));
+    trans->length = length * 8;
+    trans->user = this;
+    return trans;
+}
+
+SpiTransaction& SpiTransaction::command(uint8_t cmd) {
+    spi_transaction_t* trans = addPhase(1, false);
+    if (trans) {
+        trans->flags = SPI_TRANS_USE_TXDATA;
+        trans->tx_data[0] = cmd;
+    }
+    return *this;
+}
+
+SpiTransaction& SpiTransaction::data(const void* data, size_t length) {
+    if (length == 0) return *this;
+
+    spi_transaction_t* trans = addPhase(length, true);
+    if (trans) {
+        if (length <= sizeof(trans->tx_data)) {
+            // Small enough to copy, so caller doesn't need to keep the data around
+            trans->flags = SPI_TRANS_USE_TXDATA;
+            memcpy(trans->tx_data, data, length);
+        } else {
+            trans->tx_buffer = data;
+        }
+    }
+    return *this;
+}
+
+SpiTransaction& SpiTransaction::onComplete(spi_complete_function_t complete_function, void* arg) {
+    complete_function_ = complete_function;
+    complete_arg_ = arg;
+    return *this;
+}
+
+esp_err_t SpiTransaction::submit() {
+    if (num_phases_ == 0) return ESP_OK;
+
+    // Acquire bus once for the polled phases of the batch instead of for each phase
+    esp_err_t result = spi_device_acquire_bus(device_, portMAX_DELAY);
+    if (result != ESP_OK) {
+        ERROR("Could not acquire SPI bus. Returned %s", esp_err_to_name(result));
+        return result;
+    }
+
+    for (size_t i = 0; i < num_phases_; ++i) {
+        spi_transaction_t* trans = &phases_[i];
+
+        // Polling cannot be done while queued transactions are still in flight. Therefore
+        // once a phase has been queued the rest of the phases are queued too.
+        if (num_queued_ == 0 && trans->length / 8 <= kPollingThresholdBytes) {
+            result = spi_device_polling_transmit(device_, trans);
+        } else {
+            result = spi_device_queue_trans(device_, trans, portMAX_DELAY);
+            if (result == ESP_OK) num_queued_++;
+        }
+
+        if (result != ESP_OK) {
+            ERROR("Sending SPI phase %d of %d failed. Returned %s", i, num_phases_,
+                  esp_err_to_name(result));
+            break;
+        }
+    }
+    VERBOSE("Submitted SPI batch of %d phases, %d of them queued", num_phases_, num_queued_);
+
+    // Queued phases don't need the bus to be acquired, the SPI driver sends them from its
+    // ISR once the bus is free. So release the bus now so that other devices on it aren't
+    // blocked while the display isn't being updated, such as for a static screen.
+    spi_device_release_bus(device_);
+
+    // If failed then the last phase will never complete. Still call the complete function
+    // so that whoever is waiting on it, like LVGL, doesn't hang.
+    if (result != ESP_OK && complete_function_) {
+        (*complete_function_)(complete_arg_);
+    }
+
+    // If nothing was queued then the batch is already complete
+    if (num_queued_ == 0) {
+        wait();
+    }
+    return result;
+}
+
+esp_err_t SpiTransaction::wait(TickType_t timeout) {
+    while (num_queued_ > 0) {
+        spi_transaction_t* done_trans;
+        esp_err_t result = spi_device_get_trans_result(device_, &done_trans, timeout);
+        if (result != ESP_OK) {
+            return result;
+        }
+        num_queued_--;
+    }
+
+    num_phases_ = 0;
+    return ESP_OK;
+}
+
+/* static */
+void IRAM_ATTR SpiTransaction::preTransferCallback(spi_transaction_t* trans) {
+    // Uses low level call since gpio_set_level() is not necessarily in IRAM
+    SpiTransaction* batch = static_cast<SpiTransaction*>(trans->user);
+    size_t phase = trans - batch->phases_;
+    gpio_ll_set_level(GPIO_LL_GET_HW(GPIO_PORT_0), batch->dc_pin_, batch->dc_levels_[phase]);
+}
+
+/* static */
+void IRAM_ATTR SpiTransaction::postTransferCallback(spi_transaction_t* trans) {
+    SpiTransaction* batch = static_cast<SpiTransaction*>(trans->user);
+    size_t phase = trans - batch->phases_;
+    if (phase == batch->num_phases_ - 1 && batch->complete_function_) {
+        (*batch->complete_function_)(batch->complete_arg_);
+    }
+}
@@ -0,0 +1,156 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/display/staticLayer.hpp"
+
+#include "esp_heap_caps.h"
+#include "idfx/utils/log.hpp"
+
+using namespace idfx;
+
+StaticLayer::StaticLayer(lv_obj_t *container, bool has_alpha)
+    : container_(container),
+      color_format_(has_alpha ? LV_COLOR_FORMAT_ARGB8888 : LV_COLOR_FORMAT_RGB565),
+      image_(nullptr),
+      draw_buf_({}),
+      buffer_(nullptr),
+      buffer_size_(0),
+      container_opa_(LV_OPA_COVER),
+      render_pending_(false),
+      rendering_(false),
+      renders_(0) {
+    lv_obj_add_event_cb(container_, containerEventCallback, LV_EVENT_ALL, this);
+}
+
+StaticLayer::~StaticLayer() {
+    thaw();
+    if (container_) lv_obj_remove_event_cb_with_user_data(container_, containerEventCallback, this);
+    if (render_pending_) lv_async_call_cancel(asyncRender, this);
+}
+
+bool StaticLayer::freeze() {
+    if (isFrozen()) return true;
+    if (container_ == nullptr) return false;
+
+    // The image is a sibling of the container, directly above it in z-order, that doesn't
+    // take part in the layout of the parent
+    image_ = lv_image_create(lv_obj_get_parent(container_));
+    lv_obj_add_flag(image_, LV_OBJ_FLAG_IGNORE_LAYOUT);
+    lv_obj_remove_flag(image_, LV_OBJ_FLAG_CLICKABLE);
+    lv_obj_move_to_index(image_, lv_obj_get_index(container_) + 1);
+    container_opa_ = lv_obj_get_style_opa(container_, LV_PART_MAIN);
+
+    if (!render()) {
+        thaw();
+        return false;
+    }
+    return true;
+}
+
+void StaticLayer::thaw() {
+    if (!isFrozen()) return;
+
+    if (container_) {
+        rendering_ = true;
+        lv_obj_set_style_opa(container_, container_opa_, LV_PART_MAIN);
+        rendering_ = false;
+    }
+
+    lv_obj_delete(image_);
+    image_ = nullptr;
+    lv_image_cache_drop(&draw_buf_);
+    heap_caps_free(buffer_);
+    buffer_ = nullptr;
+    buffer_size_ = 0;
+}
+
+void StaticLayer::invalidate() {
+    if (!isFrozen() || render_pending_) return;
+
+    render_pending_ = true;
+    lv_async_call(asyncRender, this);
+}
+
+/* static */
+void StaticLayer::asyncRender(void *arg) {
+    StaticLayer *layer = (StaticLayer *)arg;
+    layer->render_pending_ = false;
+    if (layer->isFrozen()) layer->render();
+}
+
+bool StaticLayer::render() {
+    // Changing the opacity of the container causes a style changed event, which must not
+    // be treated as a change of the content
+    rendering_ = true;
+
+    // Snapshot includes the extra area that shadows and such draw outside of the container
+    lv_obj_update_layout(container_);
+    const int32_t ext = lv_obj_get_ext_draw_size(container_);
+    const int32_t width = lv_obj_get_width(container_) + 2 * ext;
+    const int32_t height = lv_obj_get_height(container_) + 2 * ext;
+    const uint32_t stride = lv_draw_buf_width_to_stride(width, color_format_);
+    const size_t size = stride * height;
+
+    // Only reallocate if the buffer has to grow. Use PSRAM if available so that internal
+    // memory is kept for DMA and stacks.
+    if (size > buffer_size_) {
+        heap_caps_free(buffer_);
+        buffer_ = heap_caps_aligned_alloc(LV_DRAW_BUF_ALIGN, size, MALLOC_CAP_SPIRAM);
+        if (buffer_ == nullptr)
+            buffer_ = heap_caps_aligned_alloc(LV_DRAW_BUF_ALIGN, size, MALLOC_CAP_DEFAULT);
+        buffer_size_ = buffer_ ? size : 0;
+        if (buffer_ == nullptr) {
+            ERROR("Could not allocate %u bytes for static layer", size);
+            rendering_ = false;
+            return false;
+        }
+    }
+
+    lv_image_cache_drop(&draw_buf_);
+    lv_draw_buf_init(&draw_buf_, width, height, color_format_, stride, buffer_, buffer_size_);
+
+    // The container must be visible for the snapshot
+    lv_obj_set_style_opa(container_, container_opa_, LV_PART_MAIN);
+    lv_result_t result = lv_snapshot_take_to_draw_buf(container_, color_format_, &draw_buf_);
+    lv_obj_set_style_opa(container_, LV_OPA_TRANSP, LV_PART_MAIN);
+    rendering_ = false;
+
+    if (result != LV_RESULT_OK) {
+        ERROR("Could not take snapshot for static layer");
+        return false;
+    }
+
+    lv_obj_set_pos(image_, lv_obj_get_x(container_) - ext, lv_obj_get_y(container_) - ext);
+    lv_image_set_src(image_, &draw_buf_);
+    lv_obj_invalidate(image_);
+
+    renders_++;
+    DEBUG("Rendered static layer of %ldx%ld into %u byte buffer", width, height, buffer_size_);
+    return true;
+}
+
+/* static */
+void StaticLayer::containerEventCallback(lv_event_t *event) {
+    StaticLayer *layer = (StaticLayer *)lv_event_get_user_data(event);
+    if (lv_event_get_code(event) == LV_EVENT_DELETE) {
+        // Container is going away so the image must go too. The event callback is
+        // removed by LVGL along with the container.
+        layer->container_ = nullptr;
+        layer->thaw();
+        return;
+    }
+    if (!layer->isFrozen() || layer->rendering_) return;
+
+    switch (lv_event_get_code(event)) {
+        case LV_EVENT_SIZE_CHANGED:
+        case LV_EVENT_STYLE_CHANGED:
+        case LV_EVENT_CHILD_CHANGED:
+        case LV_EVENT_CHILD_CREATED:
+        case LV_EVENT_CHILD_DELETED:
+            layer->invalidate();
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,217 @@
+/**
+ * Base class for touch controller drivers
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/display/touchDriverBase.hpp"
+
+#include <algorithm>
+
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#include "idfx/display/displayService.hpp"
+#include "idfx/utils/log.hpp"
+
+// Default time after the last interrupt that a touch is considered released
+static const uint32_t kDefaultReleaseTimeoutUsec = 50000;
+
+// Timeout for I2C transactions with the controller
+static const int kI2cTimeoutMsec = 20;
+
+// For level triggered interrupts, how long INT stays masked after a failed read. Doubles
+// for each consecutive failure, up to the max, so that a controller that holds INT
+// asserted while not responding doesn't cause an interrupt storm.
+static const uint32_t kMinRearmBackoffUsec = 1000;
+static const uint32_t kMaxRearmBackoffUsec = 100000;
+
+// For finding the driver from the INT pin in interruptHandler(). Indexed by GPIO number.
+static TouchDriverBase *touch_drivers_[GPIO_NUM_MAX] = {};
+
+TouchDriverBase::TouchDriverBase(int width, int height)
+    : width_(width),
+      height_(height),
+      swap_xy_(false),
+      mirror_x_(false),
+      mirror_y_(false),
+      release_timeout_usec_(kDefaultReleaseTimeoutUsec),
+      int_pin_(GPIO_NUM_NC),
+      rearm_timer_(nullptr),
+      rearm_backoff_usec_(kMinRearmBackoffUsec),
+      latest_point_(0),
+      last_interrupt_usec_(0),
+      stats_({}),
+      lv_indev_(nullptr),
+      i2c_device_(nullptr) {
+    INFO("TouchDriverBase constructor");
+}
+
+TouchDriverBase::~TouchDriverBase() {
+    // Delete the timer first so that it can't re-arm the interrupt after it is disabled
+    if (rearm_timer_) {
+        esp_timer_stop(rearm_timer_);
+        esp_timer_delete(rearm_timer_);
+    }
+    if (int_pin_ != GPIO_NUM_NC) {
+        gpio_intr_disable(int_pin_);
+        touch_drivers_[int_pin_] = nullptr;
+    }
+    if (lv_indev_) {
+        idfx::DisplayService::removeWakingInput(lv_indev_);
+        lv_indev_delete(lv_indev_);
+    }
+    if (i2c_device_) i2c_master_bus_rm_device(i2c_device_);
+}
+
+lv_indev_t *TouchDriverBase::createLvglInput(lv_display_t *display) {
+    lv_indev_ = lv_indev_create();
+    lv_indev_set_type(lv_indev_, LV_INDEV_TYPE_POINTER);
+    lv_indev_set_read_cb(lv_indev_, lvglReadCallback);
+    lv_indev_set_driver_data(lv_indev_, this);
+    if (display) lv_indev_set_display(lv_indev_, display);
+
+    // handleInterrupt() wakes the DisplayService for each touch, so the read timer doesn't
+    // need to keep running at the active period while the display is idle
+    idfx::DisplayService::addWakingInput(lv_indev_);
+
+    return lv_indev_;
+}
+
+void TouchDriverBase::setTransform(bool swap_xy, bool mirror_x, bool mirror_y) {
+    swap_xy_ = swap_xy;
+    mirror_x_ = mirror_x;
+    mirror_y_ = mirror_y;
+}
+
+TouchDriverBase::touch_point_t TouchDriverBase::latestPoint() const {
+    return unpack(latest_point_.load());
+}
+
+void TouchDriverBase::attachInterrupt(idfx::GPIONum int_pin, gpio_int_type_t intr_type) {
+    INFO("Attaching touch controller INT pin %d", int_pin.get_value());
+
+    int_pin_ = (gpio_num_t)int_pin.get_value();
+    touch_drivers_[int_pin_] = this;
+
+    // For re-arming a level triggered interrupt after backing off from a failed read
+    if (!rearm_timer_) {
+        esp_timer_create_args_t timer_args = {};
+        timer_args.callback = rearmTimerCallback;
+        timer_args.arg = this;
+        timer_args.name = "touch_rearm";
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &rearm_timer_));
+    }
+
+    // A level interrupt is not re-armed automatically since handleInterrupt() only re-arms
+    // it once the controller has been read successfully
+    idfx::GpioInterrupteHandler(int_pin, interruptHandler, intr_type, GPIO_PULLUP_ENABLE,
+                                GPIO_PULLDOWN_DISABLE, false);
+
+    // The controller drives INT so the pin must be input only
+    gpio_set_direction(int_pin_, GPIO_MODE_INPUT);
+}
+
+esp_err_t TouchDriverBase::attachI2c(i2c_master_bus_handle_t bus, uint16_t address,
+                                     uint32_t scl_speed_hz) {
+    INFO("Attaching touch controller at I2C address 0x%02X", address);
+
+    i2c_device_config_t dev_config = {};
+    dev_config.dev_addr_length = I2C_ADDR_BIT_LEN_7;
+    dev_config.device_address = address;
+    dev_config.scl_speed_hz = scl_speed_hz;
+    return i2c_master_bus_add_device(bus, &dev_config, &i2c_device_);
+}
+
+esp_err_t TouchDriverBase::readRegisters(uint16_t reg, size_t reg_len, uint8_t *data,
+                                         size_t length) {
+    const uint8_t reg_bytes[] = {(uint8_t)(reg_len == 2 ? reg >> 8 : reg), (uint8_t)(reg & 0xFF)};
+    return i2c_master_transmit_receive(i2c_device_, reg_len == 2 ? reg_bytes : &reg_bytes[1],
+                                       reg_len, data, length, kI2cTimeoutMsec);
+}
+
+esp_err_t TouchDriverBase::writeRegister(uint16_t reg, size_t reg_len, uint8_t value) {
+    const uint8_t buf[] = {(uint8_t)(reg >> 8), (uint8_t)(reg & 0xFF), value};
+    const uint8_t *start = reg_len == 2 ? buf : &buf[1];
+    return i2c_master_transmit(i2c_device_, start, reg_len + 1, kI2cTimeoutMsec);
+}
+
+/* static */
+void TouchDriverBase::interruptHandler(int gpio_num) {
+    TouchDriverBase *driver = touch_drivers_[gpio_num];
+    if (driver) driver->handleInterrupt();
+}
+
+void TouchDriverBase::handleInterrupt() {
+    stats_.interrupts++;
+
+    const int64_t start_usec = esp_timer_get_time();
+    touch_point_t point = {};
+    if (!readTouch(point)) {
+        // INT is likely still asserted, so for a level interrupt keep it masked for a while
+        // instead of immediately handling the same interrupt again
+        stats_.read_errors++;
+        esp_timer_stop(rearm_timer_);
+        esp_timer_start_once(rearm_timer_, rearm_backoff_usec_);
+        rearm_backoff_usec_ = std::min(rearm_backoff_usec_ * 2, kMaxRearmBackoffUsec);
+        return;
+    }
+    const int64_t end_usec = esp_timer_get_time();
+    rearm_backoff_usec_ = kMinRearmBackoffUsec;
+    idfx::GpioInterrupteHandler::acknowledge(int_pin_);
+    stats_.max_read_usec = std::max(stats_.max_read_usec, (uint32_t)(end_usec - start_usec));
+
+    if (swap_xy_) std::swap(point.x, point.y);
+    if (mirror_x_) point.x = width_ - 1 - point.x;
+    if (mirror_y_) point.y = height_ - 1 - point.y;
+    point.x = std::clamp<int16_t>(point.x, 0, width_ - 1);
+    point.y = std::clamp<int16_t>(point.y, 0, height_ - 1);
+
+    VERBOSE("Touch x=%d y=%d pressed=%d", point.x, point.y, point.pressed);
+    // Timestamp is stored before the point so that lvglReadCallback(), which loads the
+    // point first, never sees a new point together with an old timestamp and then wrongly
+    // times it out
+    last_interrupt_usec_ = (uint32_t)end_usec;
+    latest_point_ = pack(point);
+
+    // So that the touch is handled right away even if the refresh rate has been lowered
+    idfx::DisplayService::wake();
+}
+
+/* static */
+void TouchDriverBase::rearmTimerCallback(void *arg) {
+    auto driver = static_cast<TouchDriverBase *>(arg);
+    idfx::GpioInterrupteHandler::acknowledge(driver->int_pin_);
+}
+
+/* static */
+void TouchDriverBase::lvglReadCallback(lv_indev_t *indev, lv_indev_data_t *data) {
+    TouchDriverBase *driver = (TouchDriverBase *)lv_indev_get_driver_data(indev);
+    uint32_t packed = driver->latest_point_.load();
+    touch_point_t point = unpack(packed);
+
+    // If controller doesn't interrupt on release then a touch is released once the
+    // interrupts stop. Only stored if no new point arrived in the meantime.
+    if (point.pressed && driver->release_timeout_usec_ > 0) {
+        uint32_t since_usec = (uint32_t)esp_timer_get_time() - driver->last_interrupt_usec_;
+        if (since_usec > driver->release_timeout_usec_) {
+            point.pressed = false;
+            driver->latest_point_.compare_exchange_strong(packed, pack(point));
+            driver->stats_.timeouts++;
+        }
+    }
+
+    data->point.x = point.x;
+    data->point.y = point.y;
+    data->state = point.pressed ? LV_INDEV_STATE_PRESSED : LV_INDEV_STATE_RELEASED;
+}
+
+/* static */
+uint32_t TouchDriverBase::pack(const touch_point_t &point) {
+    return ((uint32_t)(uint16_t)point.x << 16) | ((uint32_t)(point.y & 0x7FFF) << 1) |
+           (point.pressed ? 1 : 0);
+}
+
+/* static */
+TouchDriverBase::touch_point_t TouchDriverBase::unpack(uint32_t packed) {
+    return {(int16_t)(packed >> 16), (int16_t)((packed >> 1) & 0x7FFF), (packed & 1) != 0};
+}
@@ -0,0 +1,196 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/hardware/actionScheduler.hpp"
+
+#include <utility>
+
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "idfx/utils/iram.hpp"
+#include "idfx/utils/log.hpp"
+
+// So that don't get warnings about the gptimer structures not being fully specified
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+
+using namespace idfx;
+
+// Resolution of the GPTimer. 1MHz so that timer ticks are microseconds.
+static const uint32_t kTimerResolutionHz = 1000000;
+
+// An alarm set for a time that has already passed would not fire until the counter wraps.
+// Therefore alarm is always set at least this far into the future.
+static const uint64_t kMinAlarmLeadUsec = 3;
+
+ActionScheduler::ActionScheduler(uint16_t capacity)
+    : capacity_(capacity), size_(0), stats_({}) {
+    DEBUG("Creating ActionScheduler with capacity of %d actions", capacity);
+
+    portMUX_INITIALIZE(&lock_);
+
+    // Heap is accessed from the ISR so must be in internal RAM, not PSRAM
+    heap_ = (action_t *)heap_caps_malloc(capacity * sizeof(action_t),
+                                         MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ASSERT_MSG(heap_, "Could not allocate ActionScheduler queue");
+
+    // Uses the highest interrupt priority that can still be handled in C
+    gptimer_config_t timer_config = {.clk_src = GPTIMER_CLK_SRC_DEFAULT,
+                                     .direction = GPTIMER_COUNT_UP,
+                                     .resolution_hz = kTimerResolutionHz,
+                                     .intr_priority = 3};
+    ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &timer_));
+    gptimer_event_callbacks_t callbacks = {.on_alarm = onAlarm};
+    ESP_ERROR_CHECK(gptimer_register_event_callbacks(timer_, &callbacks, this));
+
+    // Timer runs continuously and is never reloaded, so that now() is monotonic
+    ESP_ERROR_CHECK(gptimer_enable(timer_));
+    ESP_ERROR_CHECK(gptimer_start(timer_));
+}
+
+ActionScheduler::~ActionScheduler() {
+    DEBUG("Deleting ActionScheduler");
+
+    gptimer_stop(timer_);
+    gptimer_disable(timer_);
+    gptimer_del_timer(timer_);
+    heap_caps_free(heap_);
+}
+
+uint64_t IDFX_IRAM_ATTR ActionScheduler::now() const {
+    uint64_t count = 0;
+    gptimer_get_raw_count(timer_, &count);
+    return count;
+}
+
+bool IDFX_IRAM_ATTR ActionScheduler::setBitAt(uint64_t at_usec, const OutputBit &bit, bool on) {
+    action_t action = {.at_usec = at_usec, .type = kSetBit};
+    action.bit = &bit;
+    action.value = on;
+    return push(action);
+}
+
+bool IDFX_IRAM_ATTR ActionScheduler::setDutyAt(uint64_t at_usec, OutputPWM &pwm, uint32_t duty) {
+    action_t action = {.at_usec = at_usec, .type = kSetDuty};
+    action.pwm = &pwm;
+    action.value = duty;
+    return push(action);
+}
+
+bool IDFX_IRAM_ATTR ActionScheduler::callAt(uint64_t at_usec, action_function_t function,
+                                            void *arg) {
+    action_t action = {.at_usec = at_usec, .type = kCall};
+    action.function = function;
+    action.arg = arg;
+    return push(action);
+}
+
+void ActionScheduler::cancelAll() {
+    portENTER_CRITICAL_SAFE(&lock_);
+    size_ = 0;
+    setAlarm();
+    portEXIT_CRITICAL_SAFE(&lock_);
+}
+
+bool IDFX_IRAM_ATTR ActionScheduler::push(const action_t &action) {
+    portENTER_CRITICAL_SAFE(&lock_);
+
+    if (size_ >= capacity_) {
+        stats_.dropped++;
+        portEXIT_CRITICAL_SAFE(&lock_);
+        return false;
+    }
+
+    // Sift up
+    uint16_t index = size_++;
+    while (index > 0) {
+        uint16_t parent = (index - 1) / 2;
+        if (heap_[parent].at_usec <= action.at_usec) break;
+        heap_[index] = heap_[parent];
+        index = parent;
+    }
+    heap_[index] = action;
+    stats_.scheduled++;
+
+    // Only need to move the alarm if the new action is the earliest
+    if (index == 0) setAlarm();
+
+    portEXIT_CRITICAL_SAFE(&lock_);
+    return true;
+}
+
+void IDFX_IRAM_ATTR ActionScheduler::setAlarm() {
+    if (size_ == 0) {
+        gptimer_set_alarm_action(timer_, nullptr);
+        return;
+    }
+
+    uint64_t earliest = now() + kMinAlarmLeadUsec;
+    gptimer_alarm_config_t alarm_config = {
+        .alarm_count = heap_[0].at_usec > earliest ? heap_[0].at_usec : earliest};
+    gptimer_set_alarm_action(timer_, &alarm_config);
+}
+
+/* static */
+void IRAM_ATTR ActionScheduler::doAction(const action_t &action) {
+    switch (action.type) {
+        case kSetBit:
+            action.bit->setFast(action.value);
+            break;
+        case kSetDuty:
+            action.pwm->setDutyValueFast(action.value);
+            break;
+        case kCall:
+            action.function(action.arg);
+            break;
+    }
+}
+
+/* static */
+bool IRAM_ATTR ActionScheduler::onAlarm(gptimer_handle_t timer,
+                                        const gptimer_alarm_event_data_t *edata, void *user_ctx) {
+    ActionScheduler *scheduler = static_cast<ActionScheduler *>(user_ctx);
+
+    // Do all the actions that are due. The lock is released while doing an action so
+    // that a called function can schedule further actions.
+    while (true) {
+        portENTER_CRITICAL_ISR(&scheduler->lock_);
+
+        const uint64_t now_usec = scheduler->now();
+        if (scheduler->size_ == 0 || scheduler->heap_[0].at_usec > now_usec) {
+            scheduler->setAlarm();
+            portEXIT_CRITICAL_ISR(&scheduler->lock_);
+            break;
+        }
+
+        // Pop the earliest action and sift down the last one into its place
+        action_t action = scheduler->heap_[0];
+        const action_t &last = scheduler->heap_[--scheduler->size_];
+        uint16_t index = 0;
+        while (true) {
+            uint16_t child = 2 * index + 1;
+            if (child >= scheduler->size_) break;
+            if (child + 1 < scheduler->size_ &&
+                scheduler->heap_[child + 1].at_usec < scheduler->heap_[child].at_usec) {
+                child++;
+            }
+            if (last.at_usec <= scheduler->heap_[child].at_usec) break;
+            scheduler->heap_[index] = scheduler->heap_[child];
+            index = child;
+        }
+        scheduler->heap_[index] = last;
+
+        const uint32_t late_usec = now_usec - action.at_usec;
+        if (late_usec > scheduler->stats_.max_late_usec) {
+            scheduler->stats_.max_late_usec = late_usec;
+        }
+        scheduler->stats_.executed++;
+
+        portEXIT_CRITICAL_ISR(&scheduler->lock_);
+
+        doAction(action);
+    }
+
+    // No task was woken
+    return false;
+}
@@ -0,0 +1,238 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/hardware/asyncCopy.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_attr.h"
+#include "esp_memory_utils.h"
+#include "idfx/utils/log.hpp"
+
+using namespace idfx;
+
+#if SOC_ASYNC_MEMCPY_SUPPORTED
+static async_memcpy_handle_t mcp_ = nullptr;
+#endif
+
+// Backlog the driver was installed with, so that submit() doesn't queue more than fit
+static uint32_t backlog_ = 0;
+
+// Updated by submit() and by the DMA completion callback without locking, so can be
+// slightly off if multiple copies run at the same time
+static AsyncCopy::stats_t stats_ = {};
+
+/* static */
+esp_err_t AsyncCopy::initialize(uint32_t backlog) {
+#if SOC_ASYNC_MEMCPY_SUPPORTED
+    if (mcp_) return ESP_OK;
+
+    INFO("Installing async memcpy driver with backlog of %ld", backlog);
+    async_memcpy_config_t config = ASYNC_MEMCPY_DEFAULT_CONFIG();
+    config.backlog = backlog;
+    esp_err_t err = esp_async_memcpy_install(&config, &mcp_);
+    if (err != ESP_OK) {
+        ERROR("Could not install async memcpy driver so copies will use the CPU. %s",
+              esp_err_to_name(err));
+        return err;
+    }
+    backlog_ = backlog;
+    return ESP_OK;
+#else
+    INFO("No async memcpy engine on this chip so copies will use the CPU");
+    return ESP_OK;
+#endif
+}
+
+/* static */
+AsyncCopy::stats_t AsyncCopy::stats() {
+    return stats_;
+}
+
+/* static */
+void AsyncCopy::copy(void* dest, const void* src, size_t size) {
+    AsyncCopy copy;
+    copy.begin().add(dest, src, size).submit();
+    copy.wait();
+}
+
+AsyncCopy::AsyncCopy()
+    : next_dma_segment_(0),
+      pending_(0),
+      in_progress_(false),
+      done_semaphore_(xSemaphoreCreateBinary()),
+      complete_function_(nullptr),
+      complete_arg_(nullptr) {}
+
+AsyncCopy::~AsyncCopy() {
+    if (in_progress_) wait();
+    vSemaphoreDelete(done_semaphore_);
+}
+
+AsyncCopy& AsyncCopy::begin() {
+    ASSERT_MSG(!in_progress_, "AsyncCopy::begin() called while previous copy in progress");
+
+    segments_.clear();
+    dma_segments_.clear();
+    complete_function_ = nullptr;
+    complete_arg_ = nullptr;
+    return *this;
+}
+
+AsyncCopy& AsyncCopy::add(void* dest, const void* src, size_t size) {
+    if (size > 0) segments_.push_back({dest, src, size, false});
+    return *this;
+}
+
+AsyncCopy& AsyncCopy::addRect(void* dest, size_t dest_stride, const void* src, size_t src_stride,
+                              size_t row_bytes, size_t rows) {
+    // If rows are contiguous in both buffers then it is just one segment
+    if (dest_stride == row_bytes && src_stride == row_bytes) return add(dest, src, row_bytes * rows);
+
+    segments_.reserve(segments_.size() + rows);
+    for (size_t row = 0; row < rows; ++row) {
+        add((uint8_t*)dest + row * dest_stride, (const uint8_t*)src + row * src_stride, row_bytes);
+    }
+    return *this;
+}
+
+AsyncCopy& AsyncCopy::onComplete(copy_complete_function_t complete_function, void* arg) {
+    complete_function_ = complete_function;
+    complete_arg_ = arg;
+    return *this;
+}
+
+/* static */
+bool AsyncCopy::useDma(const segment_t& segment) {
+#if SOC_ASYNC_MEMCPY_SUPPORTED
+    if (mcp_ == nullptr || segment.size < kCpuThresholdBytes) return false;
+
+    // The DMA engine can't read from flash. Alignment is checked by the driver, which
+    // rejects the segment so that it falls back to the CPU.
+    bool src_ok = esp_ptr_dma_capable(segment.src) || esp_ptr_external_ram(segment.src);
+    bool dest_ok = esp_ptr_dma_capable(segment.dest) || esp_ptr_external_ram(segment.dest);
+    return src_ok && dest_ok;
+#else
+    return false;
+#endif
+}
+
+esp_err_t AsyncCopy::submit() {
+    ASSERT_MSG(!in_progress_, "AsyncCopy::submit() called while previous copy in progress");
+
+    // One extra pending count for the CPU segments, so that the copy can't complete
+    // while DMA segments are still being queued
+    in_progress_ = true;
+    pending_ = 1;
+    xSemaphoreTake(done_semaphore_, 0);
+
+    // Split into DMA and CPU segments first since the completion callback reads
+    // dma_segments_ as soon as the first DMA segment has been queued
+    std::vector<segment_t*> cpu_segments;
+    for (segment_t& segment : segments_) {
+        if (useDma(segment)) {
+            dma_segments_.push_back(&segment);
+        } else {
+            cpu_segments.push_back(&segment);
+        }
+    }
+
+    // Only queue as many DMA segments as fit in the backlog. Each one that completes
+    // queues the next, so the DMA engine stays busy until all have been copied.
+    next_dma_segment_ = 0;
+    const size_t initial = std::min(dma_segments_.size(), (size_t)backlog_);
+    for (size_t i = 0; i < initial; ++i) {
+        queueNextDmaSegment(false);
+    }
+
+    // Copy the rest with the CPU while the DMA engine is busy with the large segments
+    for (segment_t* segment : cpu_segments) {
+        memcpy(segment->dest, segment->src, segment->size);
+        stats_.cpu_segments++;
+        stats_.cpu_bytes += segment->size;
+    }
+    copyRejectedSegments();
+
+    partDone(false);
+    return ESP_OK;
+}
+
+bool IRAM_ATTR AsyncCopy::queueNextDmaSegment(bool from_isr) {
+    BaseType_t higher_priority_task_woken = pdFALSE;
+#if SOC_ASYNC_MEMCPY_SUPPORTED
+    size_t index;
+    while ((index = next_dma_segment_++) < dma_segments_.size()) {
+        segment_t* segment = dma_segments_[index];
+        pending_++;
+        if (esp_async_memcpy(mcp_, segment->dest, (void*)segment->src, segment->size,
+                             dmaDoneCallback, this) == ESP_OK) {
+            stats_.dma_segments++;
+            stats_.dma_bytes += segment->size;
+            break;
+        }
+
+        // Rejected, such as because of alignment or because another copy is using the
+        // backlog, so it is to be copied by the CPU instead. Not done here since this can
+        // be the ISR, so it stays pending until submit() or wait() copies it. Wake up
+        // wait() so that it does so.
+        segment->rejected = true;
+        if (from_isr) xSemaphoreGiveFromISR(done_semaphore_, &higher_priority_task_woken);
+    }
+#endif
+    return higher_priority_task_woken == pdTRUE;
+}
+
+void AsyncCopy::copyRejectedSegments() {
+    for (segment_t* segment : dma_segments_) {
+        if (!segment->rejected) continue;
+
+        segment->rejected = false;
+        memcpy(segment->dest, segment->src, segment->size);
+        stats_.cpu_segments++;
+        stats_.cpu_bytes += segment->size;
+        partDone(false);
+    }
+}
+
+esp_err_t AsyncCopy::wait(TickType_t timeout) {
+    if (!in_progress_) return ESP_OK;
+
+    // The semaphore is given both when the copy is done and when the DMA engine rejected
+    // a segment that then needs to be copied here
+    while (true) {
+        copyRejectedSegments();
+        if (pending_ == 0) break;
+        if (xSemaphoreTake(done_semaphore_, timeout) != pdTRUE) return ESP_ERR_TIMEOUT;
+    }
+
+    in_progress_ = false;
+    return ESP_OK;
+}
+
+bool IRAM_ATTR AsyncCopy::partDone(bool from_isr) {
+    if (--pending_ != 0) return false;
+
+    if (complete_function_) complete_function_(complete_arg_);
+
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    if (from_isr) {
+        xSemaphoreGiveFromISR(done_semaphore_, &higher_priority_task_woken);
+    } else {
+        xSemaphoreGive(done_semaphore_);
+    }
+    return higher_priority_task_woken == pdTRUE;
+}
+
+#if SOC_ASYNC_MEMCPY_SUPPORTED
+/* static */
+bool IRAM_ATTR AsyncCopy::dmaDoneCallback(async_memcpy_handle_t mcp, async_memcpy_event_t* event,
+                                          void* arg) {
+    // Queue the next segment before marking this one done so that the copy can't be
+    // considered complete in between
+    AsyncCopy* copy = (AsyncCopy*)arg;
+    bool woken = copy->queueNextDmaSegment(true);
+    return copy->partDone(true) || woken;
+}
+#endif
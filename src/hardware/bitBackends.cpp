@@ -0,0 +1,188 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/hardware/bitBackends.hpp"
+
+#include "idfx/utils/log.hpp"
+
+using namespace idfx;
+
+static const int kI2cTimeoutMsec = 50;
+
+/* Adds an I2C device to the bus. Aborts if it cannot be added since that is a wiring or
+ * configuration problem */
+static i2c_master_dev_handle_t addI2cDevice(i2c_master_bus_handle_t bus, uint8_t address,
+                                            uint32_t scl_speed_hz) {
+    i2c_device_config_t dev_config = {};
+    dev_config.dev_addr_length = I2C_ADDR_BIT_LEN_7;
+    dev_config.device_address = address;
+    dev_config.scl_speed_hz = scl_speed_hz;
+    i2c_master_dev_handle_t device;
+    ESP_ERROR_CHECK(i2c_master_bus_add_device(bus, &dev_config, &device));
+    return device;
+}
+
+/********************************** NativeGpio ***************************/
+
+void NativeGpio::configAsOutput(uint8_t bit) {
+    VERBOSE("Configuring GPIO %d as output", bit);
+    gpio_reset_pin((gpio_num_t)bit);
+    ESP_ERROR_CHECK(gpio_set_direction((gpio_num_t)bit, GPIO_MODE_INPUT_OUTPUT));
+}
+
+void NativeGpio::configAsInput(uint8_t bit) {
+    VERBOSE("Configuring GPIO %d as input", bit);
+    gpio_reset_pin((gpio_num_t)bit);
+    ESP_ERROR_CHECK(gpio_set_direction((gpio_num_t)bit, GPIO_MODE_INPUT));
+}
+
+/********************************** Pca9557 ***************************/
+
+// Registers
+static const uint8_t kPca9557RegInput = 0x00;
+static const uint8_t kPca9557RegOutput = 0x01;
+static const uint8_t kPca9557RegPolarity = 0x02;
+static const uint8_t kPca9557RegConfig = 0x03;
+
+Pca9557::Pca9557(i2c_master_bus_handle_t bus, uint8_t address, uint32_t scl_speed_hz)
+    : ShadowedOutputs(0), config_(0xFF) {
+    INFO("Creating PCA9557 at I2C address 0x%02X", address);
+
+    i2c_device_ = addI2cDevice(bus, address, scl_speed_hz);
+
+    // All pins start as inputs. Make the outputs low and don't invert the inputs.
+    const uint8_t output[] = {kPca9557RegOutput, outputs_};
+    ESP_ERROR_CHECK(i2c_master_transmit(i2c_device_, output, sizeof(output), kI2cTimeoutMsec));
+    const uint8_t polarity[] = {kPca9557RegPolarity, 0x00};
+    ESP_ERROR_CHECK(
+        i2c_master_transmit(i2c_device_, polarity, sizeof(polarity), kI2cTimeoutMsec));
+}
+
+Pca9557::~Pca9557() {
+    i2c_master_bus_rm_device(i2c_device_);
+}
+
+void Pca9557::configAsOutput(uint8_t bit) {
+    config_ &= ~(1 << bit);
+    const uint8_t buf[] = {kPca9557RegConfig, config_};
+    ESP_ERROR_CHECK(i2c_master_transmit(i2c_device_, buf, sizeof(buf), kI2cTimeoutMsec));
+}
+
+void Pca9557::configAsInput(uint8_t bit) {
+    config_ |= 1 << bit;
+    const uint8_t buf[] = {kPca9557RegConfig, config_};
+    ESP_ERROR_CHECK(i2c_master_transmit(i2c_device_, buf, sizeof(buf), kI2cTimeoutMsec));
+}
+
+bool Pca9557::read(uint8_t bit) {
+    const uint8_t reg = kPca9557RegInput;
+    uint8_t value = 0;
+    esp_err_t err = i2c_master_transmit_receive(i2c_device_, &reg, 1, &value, 1, kI2cTimeoutMsec);
+    if (err != ESP_OK) {
+        ERROR("Reading PCA9557 failed: %s", esp_err_to_name(err));
+        return false;
+    }
+    return (value >> bit) & 1;
+}
+
+void Pca9557::writeOutputs(uint8_t outputs) {
+    const uint8_t buf[] = {kPca9557RegOutput, outputs};
+    esp_err_t err = i2c_master_transmit(i2c_device_, buf, sizeof(buf), kI2cTimeoutMsec);
+    if (err != ESP_OK) {
+        ERROR("Writing PCA9557 outputs failed: %s", esp_err_to_name(err));
+    }
+}
+
+/********************************** Mcp23017 ***************************/
+
+// Registers, for IOCON.BANK=0 where the A and B registers are adjacent
+static const uint8_t kMcp23017RegIodir = 0x00;
+static const uint8_t kMcp23017RegGpio = 0x12;
+static const uint8_t kMcp23017RegOlat = 0x14;
+
+Mcp23017::Mcp23017(i2c_master_bus_handle_t bus, uint8_t address, uint32_t scl_speed_hz)
+    : ShadowedOutputs(0), iodir_(0xFFFF) {
+    INFO("Creating MCP23017 at I2C address 0x%02X", address);
+
+    i2c_device_ = addI2cDevice(bus, address, scl_speed_hz);
+
+    // All pins start as inputs. Make the outputs low.
+    writeRegisterPair(kMcp23017RegOlat, outputs_);
+}
+
+Mcp23017::~Mcp23017() {
+    i2c_master_bus_rm_device(i2c_device_);
+}
+
+void Mcp23017::writeRegisterPair(uint8_t reg, uint16_t value) {
+    // Register address auto-increments so the B register is written in the same transaction
+    const uint8_t buf[] = {reg, (uint8_t)(value & 0xFF), (uint8_t)(value >> 8)};
+    esp_err_t err = i2c_master_transmit(i2c_device_, buf, sizeof(buf), kI2cTimeoutMsec);
+    if (err != ESP_OK) {
+        ERROR("Writing MCP23017 register 0x%02X failed: %s", reg, esp_err_to_name(err));
+    }
+}
+
+void Mcp23017::configAsOutput(uint8_t bit) {
+    iodir_ &= ~(1 << bit);
+    writeRegisterPair(kMcp23017RegIodir, iodir_);
+}
+
+void Mcp23017::configAsInput(uint8_t bit) {
+    iodir_ |= 1 << bit;
+    writeRegisterPair(kMcp23017RegIodir, iodir_);
+}
+
+bool Mcp23017::read(uint8_t bit) {
+    const uint8_t reg = kMcp23017RegGpio;
+    uint8_t values[2] = {};
+    esp_err_t err =
+        i2c_master_transmit_receive(i2c_device_, &reg, 1, values, sizeof(values), kI2cTimeoutMsec);
+    if (err != ESP_OK) {
+        ERROR("Reading MCP23017 failed: %s", esp_err_to_name(err));
+        return false;
+    }
+    return ((values[0] | values[1] << 8) >> bit) & 1;
+}
+
+void Mcp23017::writeOutputs(uint16_t outputs) {
+    writeRegisterPair(kMcp23017RegOlat, outputs);
+}
+
+/********************************** ShiftRegister595 ***************************/
+
+ShiftRegister595::ShiftRegister595(gpio_num_t data_pin, gpio_num_t clock_pin,
+                                   gpio_num_t latch_pin, uint8_t num_chips)
+    : ShadowedOutputs(0),
+      data_pin_(data_pin),
+      clock_pin_(clock_pin),
+      latch_pin_(latch_pin),
+      num_chips_(num_chips) {
+    INFO("Creating 74HC595 chain of %d chips", num_chips);
+    ASSERT_MSG(num_chips >= 1 && num_chips <= 4, "74HC595 chain must be 1 to 4 chips");
+
+    for (gpio_num_t pin : {data_pin_, clock_pin_, latch_pin_}) {
+        gpio_reset_pin(pin);
+        ESP_ERROR_CHECK(gpio_set_direction(pin, GPIO_MODE_OUTPUT));
+        gpio_set_level(pin, 0);
+    }
+    writeOutputs(outputs_);
+}
+
+void ShiftRegister595::configAsInput(uint8_t bit) {
+    ERROR("74HC595 bit %d cannot be an input", bit);
+}
+
+void ShiftRegister595::writeOutputs(uint32_t outputs) {
+    // Last bit of the chain is shifted out first. The 74HC595 needs only ~20ns pulses so no
+    // delays are needed between the register writes.
+    gpio_dev_t *hw = GPIO_LL_GET_HW(GPIO_PORT_0);
+    for (int bit = num_chips_ * 8 - 1; bit >= 0; --bit) {
+        gpio_ll_set_level(hw, data_pin_, (outputs >> bit) & 1);
+        gpio_ll_set_level(hw, clock_pin_, 1);
+        gpio_ll_set_level(hw, clock_pin_, 0);
+    }
+    gpio_ll_set_level(hw, latch_pin_, 1);
+    gpio_ll_set_level(hw, latch_pin_, 0);
+}
@@ -8,41 +8,48 @@
 
 #include <rom/ets_sys.h>
 
-#include <map>
-
 #include "esp_intr_alloc.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "hal/gpio_ll.h"
+#include "idfx/utils/iram.hpp"
 #include "idfx/utils/log.hpp"
 
 using namespace idfx;
 
 // Structure for data in the queue. Identifies the GPIO bit and the ISR function to call.
+// For level triggered interrupts also specifies whether the bit is to be re-armed once
+// the ISR function returns.
 typedef struct QueueData {
     int gpio_num;
     isr_function_t individual_isr_for_bit;
+    bool level_triggered;
+    bool rearm_after_handler;
 } queue_object_t;
 
 // Forward declaration
 static void gpioIsrTaskFunction(void *arg);
 
+// Configuration passed to the GPIO isr task so that it can install the isr service
+// on the proper core. The task signals install_done once the service is installed.
+typedef struct InitConfig {
+    int intr_alloc_flags;
+    esp_err_t install_result;
+    SemaphoreHandle_t install_done;
+} init_config_t;
+
+// Whether GpioInterrupteHandler::initialize() has already been done
+static bool initialized_ = false;
+
 /**
- * Initializes the GPIO interrupt handling if haven't done so yet.
+ * Initializes the GPIO interrupt handling if haven't done so yet. Uses the defaults
+ * of GpioInterrupteHandler::initialize().
  */
 static void initializeIfNeeded(void) {
     // If already done this, don't need to do again
-    static bool initialized = false;
-    if (initialized) return;
+    if (initialized_) return;
 
-    // start gpio task
-    UBaseType_t UX_PRIORITY = 10;
-    void *NULL_PV_PARAMETERS = nullptr;
-    TaskHandle_t *NULL_CREATED_TASK = nullptr;
-    xTaskCreate(gpioIsrTaskFunction,
-                "gpio_isr_task",
-                4096,  // FIXME Note: the usual 2048 resulted in stack overflow
-                NULL_PV_PARAMETERS, UX_PRIORITY, NULL_CREATED_TASK);
-
-    // So that only initialize once
-    initialized = true;
+    GpioInterrupteHandler::initialize();
 }
 
 /* The internal interrupt handler communicates with the xTask using this queue.
@@ -50,48 +57,108 @@ static void initializeIfNeeded(void) {
  * for the bit can be identified and called. */
 static QueueHandle_t gpio_event_queue_ = xQueueCreate(10, sizeof(queue_object_t));
 
-/* Map for containing for each GPIO bit the ISR function to be called by the GPIO
- * task when it is appropriate time to handle the interrupt. Keyed on integer GPIO
- * bit number and values are QueueData objects containing bit number and isr function ptr.
+/* Array containing for each GPIO bit the ISR function to be called by the GPIO
+ * task when it is appropriate time to handle the interrupt. Indexed by the GPIO
+ * bit number. A plain array is used instead of a map because it is accessed from
+ * the ISR, which must not allocate memory and, when ESP_INTR_FLAG_IRAM is used,
+ * must not touch flash.
+ */
+static QueueData gpio_bit_data_[GPIO_NUM_MAX] = {};
+
+// Time in microseconds, as truncated esp_timer_get_time(), that the ISR was last called
+// for each GPIO bit. Recorded in the ISR so that it doesn't include the queue latency.
+static volatile uint32_t isr_time_usec_[GPIO_NUM_MAX] = {};
+
+// Number of interrupt events dropped by the ISR because the queue was full
+static volatile uint32_t dropped_events_ = 0;
+
+// Set by the ISR for each GPIO bit whose event couldn't be queued because the queue was
+// full, so that the GPIO task can still handle it. A level triggered bit stays masked
+// until then, since re-enabling it in the ISR while the level holds would refire right
+// away and keep the GPIO task from ever draining the queue.
+static volatile bool lost_events_[GPIO_NUM_MAX] = {};
+static volatile bool any_lost_events_ = false;
+
+/**
+ * Calls the handler for a GPIO interrupt and re-arms a level triggered interrupt if
+ * appropriate. Called by the GPIO task.
+ */
+static void handleEvent(const QueueData &data) {
+    int io_num = data.gpio_num;
+    isr_function_t isr_func = data.individual_isr_for_bit;
+    DEBUG("gpio_isr_task_function() Task handling interrupt. GPIO[%" PRIu32 "] intr, val: %d",
+               io_num, gpio_get_level(static_cast<gpio_num_t>(io_num)));
+
+    // Call the user defined isr that was defined for this GPIO interrupt.
+    // And pass in the IO bit number.
+    DEBUG("About to call the user ISR...");
+    (*isr_func)(io_num);
+    DEBUG("Called the user ISR!");
+
+    // A level triggered interrupt was masked by the ISR. Re-arm it now that
+    // the handler has dealt with it, unless the handler is to acknowledge it.
+    if (data.level_triggered && data.rearm_after_handler) {
+        gpio_intr_enable(static_cast<gpio_num_t>(io_num));
+    }
+}
+
+/**
+ * Handles the events that the ISR couldn't queue. A flag is cleared before its event is
+ * handled so that if the ISR sets it again in the meantime the event is handled again
+ * instead of lost.
  */
-static std::map<int, QueueData> gpio_bit_data_map_ = std::map<int, QueueData>();
+static void handleLostEvents() {
+    if (!any_lost_events_) return;
+
+    any_lost_events_ = false;
+    for (int gpio_num = 0; gpio_num < GPIO_NUM_MAX; ++gpio_num) {
+        if (!lost_events_[gpio_num]) continue;
+
+        lost_events_[gpio_num] = false;
+        VERBOSE("Handling GPIO %d interrupt that could not be queued", gpio_num);
+        handleEvent(gpio_bit_data_[gpio_num]);
+    }
+}
 
 /**
  * The single freeRTOS Task that runs continuously to do actual processing of GPIO interrupts.
  * Reads from the GPIO interrupts queue and calls the isr configured for the IO bit.
- * @param *arg Pointer to arg specified when xTaskCreate() called in order to setup
- * the GPIO isr task. Not actually used.
+ * @param *arg Pointer to the init_config_t specified when xTaskCreatePinnedToCore() called
+ * in order to setup the GPIO isr task. Only valid until install_done has been given.
  */
 static void gpioIsrTaskFunction(void *arg) {
-    INFO("Running task gpio_isr_task forever...");
+    auto config = static_cast<init_config_t *>(arg);
+    INFO("Running task gpio_isr_task forever on core %d...", xPortGetCoreID());
 
-    // Install gpio isr service. This must be done in the task that has been
-    // created to handle the interrupts. Note that have to use intr_alloc_flags
-    // of ESP_INTR_FLAG_LOWMED because if use a higher level then the ISR must
-    // be written in assembly language. Otherwise get a very cryptic alloc error
-    // message.
+    // Install gpio isr service. This is done in this task, which is pinned to the
+    // desired core, because the interrupt is allocated on the core that installs
+    // the service. Once installed, initialize() is signaled so that it can return.
     esp_err_t result;
-    if (ESP_OK == (result = gpio_install_isr_service(ESP_INTR_FLAG_LOWMED))) {
-        DEBUG("Successfully initialized per bit interrupts via gpio_install_isr_service()");
+    if (ESP_OK == (result = gpio_install_isr_service(config->intr_alloc_flags))) {
+        DEBUG("Successfully initialized per bit interrupts via gpio_install_isr_service() "
+              "with intr_alloc_flags=0x%X", config->intr_alloc_flags);
     } else {
         ERROR("Error occurred in gpio_install_isr_service(). Returned 0x%X", result);
     }
+    config->install_result = result;
+    xSemaphoreGive(config->install_done);
+
+    // If the service couldn't be installed then no interrupts will arrive. Exit so that
+    // initialize() can be retried without leaving a stray task behind.
+    if (result != ESP_OK) {
+        vTaskDelete(nullptr);
+        return;
+    }
 
     QueueData data;
     for (;;) {
         // Wait until interrupt event is received
         if (xQueueReceive(gpio_event_queue_, &data, portMAX_DELAY)) {
             // Got from the queue a GPIO interrupt to handle
-            int io_num = data.gpio_num;
-            isr_function_t isr_func = data.individual_isr_for_bit;
-            DEBUG("gpio_isr_task_function() Task handling interrupt. GPIO[%" PRIu32 "] intr, val: %d",
-                       io_num, gpio_get_level(static_cast<gpio_num_t>(io_num)));
-
-            // Call the user defined isr that was defined for this GPIO interrupt.
-            // And pass in the IO bit number.
-            DEBUG("About to call the user ISR...");
-            (*isr_func)(io_num);
-            DEBUG("Called the user ISR!");
+            handleEvent(data);
+
+            // Since the queue now has room the ISR can't have lost an event after this
+            handleLostEvents();
         } else {
             INFO("xQueueReceive() did not return any data so will try again...");
         }
@@ -106,24 +173,95 @@ static void gpioIsrTaskFunction(void *arg) {
  * @param *arg the gpio number of the interrupt bit.
  */
 static void IRAM_ATTR gpioIsrHandler(void *arg) {
-    // We can get bit number since we setup ISR using gpio_install_isr_service(ESP_INTR_FLAG_LEVELMASK)
+    // We can get bit number since it was passed in as the arg to gpio_isr_handler_add()
     uint32_t gpio_num = (uint32_t)arg;
 
-    // Log using TASK_DEBUG() since regular logging statements should not be called in an ISR
-    TASK_DEBUG("Internal ISR for bit %ld called. Adding even to queue.", GPIO_NUM_0);
+    // Log using ISR_DEBUG() since regular logging statements should not be called in an ISR,
+    // and the format must not be in flash in case the flash cache is disabled
+    ISR_DEBUG("Internal ISR for bit %ld called. Adding even to queue.", gpio_num);
+    isr_time_usec_[gpio_num] = (uint32_t)esp_timer_get_time();
 
-    // Create the data that describes the interrupt handler
-    QueueData queue_data = gpio_bit_data_map_[gpio_num];
+    // A level interrupt keeps refiring as long as the level holds, which would flood the
+    // queue and starve the core. Therefore mask it until the handler has dealt with it.
+    // Uses the low level call since gpio_intr_disable() is not necessarily in IRAM.
+    if (gpio_bit_data_[gpio_num].level_triggered) {
+        gpio_ll_intr_disable(GPIO_LL_GET_HW(GPIO_PORT_0), gpio_num);
+    }
 
     // Add to the Queue the queue data that describies how to handle the interrupt
-    xQueueSendFromISR(gpio_event_queue_, &queue_data, NULL);
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    if (xQueueSendFromISR(gpio_event_queue_, &gpio_bit_data_[gpio_num], &higher_priority_task_woken) != pdTRUE) {
+        // Queue full. Flag the event so that the GPIO task handles it once it has handled
+        // a queued one. A level interrupt stays masked until then.
+        dropped_events_ = dropped_events_ + 1;
+        lost_events_[gpio_num] = true;
+        any_lost_events_ = true;
+    }
+
+    // If the GPIO task has higher priority than the interrupted task then switch to it
+    // right away instead of waiting for the next tick
+    if (higher_priority_task_woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+/* static */
+esp_err_t GpioInterrupteHandler::initialize(BaseType_t core_id, int intr_alloc_flags,
+                                            UBaseType_t task_priority) {
+    if (initialized_) {
+        WARN("GpioInterrupteHandler::initialize() called but already initialized. Therefore "
+             "the core and intr_alloc_flags cannot be changed. Make sure initialize() is called "
+             "before any GpioInterrupteHandler is constructed.");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // If core not specified then use the current one so that it is deterministic
+    if (core_id == tskNO_AFFINITY) {
+        core_id = xPortGetCoreID();
+    }
+    DEBUG("Initializing GPIO interrupts for core %d with intr_alloc_flags=0x%X", core_id,
+          intr_alloc_flags);
+
+    // Only needed until the task has installed the isr service, so can be on the stack
+    init_config_t config = {.intr_alloc_flags = intr_alloc_flags,
+                            .install_result = ESP_FAIL,
+                            .install_done = xSemaphoreCreateBinary()};
+
+    if (!config.install_done) {
+        ERROR("Could not create semaphore for initializing GPIO interrupts");
+        return ESP_ERR_NO_MEM;
+    }
+
+    // start gpio task, pinned to the desired core
+    TaskHandle_t *NULL_CREATED_TASK = nullptr;
+    BaseType_t created = xTaskCreatePinnedToCore(gpioIsrTaskFunction,
+                            "gpio_isr_task",
+                            4096,  // FIXME Note: the usual 2048 resulted in stack overflow
+                            &config, task_priority, NULL_CREATED_TASK, core_id);
+    if (created != pdPASS) {
+        ERROR("Could not create gpio_isr_task so GPIO interrupts not initialized");
+        vSemaphoreDelete(config.install_done);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Wait until the isr service has actually been installed so that handlers
+    // can be added right after this returns
+    xSemaphoreTake(config.install_done, portMAX_DELAY);
+    vSemaphoreDelete(config.install_done);
+
+    // Only considered initialized if successful so that a failure can be retried
+    if (config.install_result == ESP_OK) {
+        initialized_ = true;
+    }
+    return config.install_result;
 }
 
 GpioInterrupteHandler::GpioInterrupteHandler(GPIONum gpio_num,
                            isr_function_t individual_isr_for_bit,
                            gpio_int_type_t intr_type,
                            gpio_pullup_t pull_up_en,
-                           gpio_pulldown_t pull_down_en) {
+                           gpio_pulldown_t pull_down_en,
+                           bool rearm_after_handler) {
     // Makes sure one-time initialization has been done
     initializeIfNeeded();
 
@@ -147,9 +285,34 @@ GpioInterrupteHandler::GpioInterrupteHandler(GPIONum gpio_num,
     // Config the GPIO bit
     gpio_config(&io_conf);
 
-    // Add data for this bit to the map so that it can be accessed later, when the isr is actually triggered.
-    gpio_bit_data_map_[bit_num] = QueueData{.gpio_num = bit_num, .individual_isr_for_bit = individual_isr_for_bit};
+    // Add data for this bit to the array so that it can be accessed later, when the isr is actually triggered.
+    bool level_triggered = intr_type == GPIO_INTR_LOW_LEVEL || intr_type == GPIO_INTR_HIGH_LEVEL;
+    gpio_bit_data_[bit_num] = QueueData{.gpio_num = bit_num,
+                                        .individual_isr_for_bit = individual_isr_for_bit,
+                                        .level_triggered = level_triggered,
+                                        .rearm_after_handler = rearm_after_handler};
 
     // hook isr handler for specific gpio pin
     gpio_isr_handler_add(static_cast<gpio_num_t>(bit_num), gpioIsrHandler, (void *)bit_num);
 }
+
+/* static */
+void GpioInterrupteHandler::acknowledge(int gpio_num) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX || !gpio_bit_data_[gpio_num].level_triggered) {
+        return;
+    }
+
+    VERBOSE("Re-arming level triggered interrupt for GPIO bit %d", gpio_num);
+    gpio_intr_enable(static_cast<gpio_num_t>(gpio_num));
+}
+
+/* static */
+uint32_t GpioInterrupteHandler::droppedEvents() {
+    return dropped_events_;
+}
+
+/* static */
+uint32_t GpioInterrupteHandler::interruptTimeUsec(int gpio_num) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) return 0;
+    return isr_time_usec_[gpio_num];
+}
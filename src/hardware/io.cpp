@@ -7,14 +7,21 @@
 #include <esp_private/esp_gpio_reserve.h>
 
 #include <algorithm>
+#include <cstring>
 #include <map>
 #include <set>
 #include <string>
+#include <utility>
 
 #include "driver/gpio.h"
 #include "driver/ledc.h"
 #include "esp_err.h"
 #include "esp-idf-cxx/gpio_cxx.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "hal/gpio_ll.h"
+#include "idfx/utils/iram.hpp"
 #include "idfx/utils/log.hpp"
 
 // So that don't get warnings about the LEDC structures not being fully specified
@@ -26,7 +33,10 @@ using namespace idfx;
 
 OutputBit::OutputBit(const GPIONum num, const std::string bit_name,
                      const IOExpander* io_expander_ptr)
-    : pin_(num), bit_name_(bit_name), io_expander_ptr_(io_expander_ptr) {
+    : pin_(num),
+      bit_name_(bit_name),
+      io_expander_ptr_(io_expander_ptr),
+      gpio_num_(io_expander_ptr ? GPIO_NUM_NC : num.get_value<gpio_num_t>()) {
     // Configure the pin as an output
     VERBOSE("Creating OutputBit for GPIO %d (%s)", pin_.get_value(), bit_name_.c_str());
     if (io_expander_ptr_) {
@@ -97,10 +107,18 @@ void OutputBit::setOff() const {
     }
 }
 
+void IDFX_IRAM_ATTR OutputBit::setFast(bool on) const {
+    // Uses the low level call since gpio_set_level() is not necessarily in IRAM
+    if (gpio_num_ != GPIO_NUM_NC) gpio_ll_set_level(GPIO_LL_GET_HW(GPIO_PORT_0), gpio_num_, on);
+}
+
 /********************************** InputBit ***************************/
 
 InputBit::InputBit(const GPIONum num, const std::string bit_name, const IOExpander* io_expander_ptr)
-    : pin_(num), bit_name_(bit_name), io_expander_ptr_(io_expander_ptr) {
+    : pin_(num),
+      bit_name_(bit_name),
+      io_expander_ptr_(io_expander_ptr),
+      gpio_num_(io_expander_ptr ? GPIO_NUM_NC : num.get_value<gpio_num_t>()) {
     VERBOSE("Creating Input bit for GPIO %d (%s)", pin_.get_value(), bit_name_.c_str());
 
     // Configure the pin as an output
@@ -140,24 +158,36 @@ bool InputBit::get() const {
     }
 }
 
+bool IDFX_IRAM_ATTR InputBit::getFast() const {
+    if (gpio_num_ == GPIO_NUM_NC) return false;
+    return gpio_ll_get_level(GPIO_LL_GET_HW(GPIO_PORT_0), gpio_num_) == 1;
+}
+
 /********************************** PWMTimer ***************************/
 
-static auto timers_in_use = std::map<ledc_timer_t, PWMTimer*>();
+// Timers are identified by speed mode as well as number since each speed mode group
+// has its own set of timers
+static auto timers_in_use = std::map<std::pair<ledc_mode_t, ledc_timer_t>, PWMTimer*>();
 
 /* static */
-PWMTimer* PWMTimer::getAvailableTimer(const uint32_t freq_hz) {
-    for (int num = LEDC_TIMER_0; num < LEDC_TIMER_MAX; ++num) {
-        ledc_timer_t timer_num = static_cast<ledc_timer_t>(num);
-        if (timers_in_use.find(timer_num) == timers_in_use.end()) {
-            DEBUG("Found that timer num %ld is available", timer_num);
-            // Found a not in use timer number. Therefore create it
-            PWMTimer* new_timer_ptr = new PWMTimer(timer_num, freq_hz);
-
-            // Remember that created it
-            timers_in_use[timer_num] = new_timer_ptr;
-
-            // Done
-            return new_timer_ptr;
+PWMTimer* PWMTimer::getAvailableTimer(const uint32_t freq_hz, const ledc_mode_t speed_mode) {
+    // On the original ESP32 LEDC_HIGH_SPEED_MODE is 0 so the high speed group is tried first
+    for (int mode = 0; mode < LEDC_SPEED_MODE_MAX; ++mode) {
+        if (speed_mode != LEDC_SPEED_MODE_MAX && mode != speed_mode) continue;
+
+        for (int num = LEDC_TIMER_0; num < LEDC_TIMER_MAX; ++num) {
+            auto key = std::make_pair(static_cast<ledc_mode_t>(mode), static_cast<ledc_timer_t>(num));
+            if (timers_in_use.find(key) == timers_in_use.end()) {
+                DEBUG("Found that timer num %d of speed mode %d is available", num, mode);
+                // Found a not in use timer number. Therefore create it
+                PWMTimer* new_timer_ptr = new PWMTimer(key.second, key.first, freq_hz);
+
+                // Remember that created it
+                timers_in_use[key] = new_timer_ptr;
+
+                // Done
+                return new_timer_ptr;
+            }
         }
     }
 
@@ -166,10 +196,11 @@ PWMTimer* PWMTimer::getAvailableTimer(const uint32_t freq_hz) {
 }
 
 /* static */
-PWMTimer* PWMTimer::getTimer(const ledc_timer_t timer_num, const uint32_t freq_hz) {
-    DEBUG("Getting PWMTimer for timer number %ld", timer_num);
+PWMTimer* PWMTimer::getTimer(const ledc_timer_t timer_num, const uint32_t freq_hz,
+                             const ledc_mode_t speed_mode) {
+    DEBUG("Getting PWMTimer for timer number %ld of speed mode %d", timer_num, speed_mode);
 
-    auto found_timer = timers_in_use.find(timer_num);
+    auto found_timer = timers_in_use.find(std::make_pair(speed_mode, timer_num));
     if (found_timer != timers_in_use.end()) {
         // timer already exists. Therefore increment reference count and return it.
         DEBUG("Returning existing PWMTimer for timer number %ld", timer_num);
@@ -179,7 +210,10 @@ PWMTimer* PWMTimer::getTimer(const ledc_timer_t timer_num, const uint32_t freq_h
     } else {
         // Timer doesn't already exist so create it
         DEBUG("Creating new PWMTimer for timer number %ld", timer_num);
-        PWMTimer* new_timer_ptr = new PWMTimer(timer_num, freq_hz);
+        PWMTimer* new_timer_ptr = new PWMTimer(timer_num, speed_mode, freq_hz);
+
+        // Remember that created it so that it can be shared
+        timers_in_use[std::make_pair(speed_mode, new_timer_ptr->getTimer())] = new_timer_ptr;
         return new_timer_ptr;
     }
 }
@@ -190,7 +224,7 @@ void PWMTimer::doneWithTimer() {
     // Decrement reference count. If no more references to it then destruct the timer
     if (--num_references_ == 0) {
         // Update timers_in_use to indicate that this timer number is now available
-        timers_in_use.erase(timer_num_);
+        timers_in_use.erase(std::make_pair(speed_mode_, timer_num_));
 
         // Destruct the timer
         DEBUG("No more references to PWMTimer for timer number %ld so deleting it", timer_num_);
@@ -200,13 +234,19 @@ void PWMTimer::doneWithTimer() {
     }
 }
 
-PWMTimer::PWMTimer(const ledc_timer_t timer_num, const uint32_t freq_hz)
+PWMTimer::PWMTimer(const ledc_timer_t timer_num, const ledc_mode_t speed_mode,
+                   const uint32_t freq_hz)
     : timer_num_(std::clamp(timer_num, LEDC_TIMER_0, (ledc_timer_t)(LEDC_TIMER_MAX - 1))),
       // Oddly, for the ESP32S3 at least there is only low speed mode. High speed mode,
-      // where harware is used and duty changes are glitch free, is simply not available.
-      speed_mode_(LEDC_LOW_SPEED_MODE),
-      freq_hz_(freq_hz) {
-    DEBUG("Constructing PWMTimer for timer_num=%d and freq_hz=%ld", timer_num_, freq_hz_);
+      // where harware is used and duty changes are glitch free, is only available on
+      // the original ESP32.
+      speed_mode_(speed_mode < LEDC_SPEED_MODE_MAX ? speed_mode : LEDC_LOW_SPEED_MODE),
+      freq_hz_(freq_hz),
+      phase_staggering_(true),
+      dither_timer_(nullptr),
+      dither_step_(0) {
+    DEBUG("Constructing PWMTimer for timer_num=%d speed_mode=%d and freq_hz=%ld", timer_num_,
+          speed_mode_, freq_hz_);
 
     // Initalize members. Remember that this one is in use by setting reference count to 1
     num_references_ = 1;
@@ -232,6 +272,12 @@ PWMTimer::PWMTimer(const ledc_timer_t timer_num, const uint32_t freq_hz)
 PWMTimer::~PWMTimer() {
     DEBUG("In destructor ~PWMTimer() for timer %ld", timer_num_);
 
+    // Make sure dither timer callback no longer running, since it uses this object
+    if (dither_timer_) {
+        stopDitherTimer(dither_timer_);
+        dither_timer_ = nullptr;
+    }
+
     // First need to pause the timer
     ledc_timer_pause(speed_mode_, timer_num_);
 
@@ -242,6 +288,7 @@ PWMTimer::~PWMTimer() {
 }
 
 void PWMTimer::setFrequency(const uint32_t freq_hz) {
+    freq_hz_ = freq_hz;
     ledc_timer_config_t ledc_timer = {
         .speed_mode = speed_mode_,
         .duty_resolution = LEDC_TIMER_12_BIT,  // Duty can be 0 to 2^12=4096
@@ -250,28 +297,165 @@ void PWMTimer::setFrequency(const uint32_t freq_hz) {
         .clk_cfg = LEDC_AUTO_CLK,
         .deconfigure = false};
     ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
+
+    // Dither steps are tied to the PWM frequency so restart dither timer with new period
+    if (dither_timer_) {
+        esp_timer_stop(dither_timer_);
+        ESP_ERROR_CHECK(esp_timer_start_periodic(dither_timer_, ditherPeriodUsec()));
+    }
+}
+
+void PWMTimer::setPhaseStaggering(const bool enabled) {
+    DEBUG("Setting phase staggering for timer %ld to %d", timer_num_, enabled);
+    phase_staggering_ = enabled;
+    distributePhases();
+}
+
+void PWMTimer::addOutput(OutputPWM* output_ptr) {
+    {
+        std::lock_guard<std::mutex> lock(outputs_mutex_);
+        outputs_.push_back(output_ptr);
+    }
+    distributePhases();
+}
+
+void PWMTimer::removeOutput(OutputPWM* output_ptr) {
+    {
+        std::lock_guard<std::mutex> lock(outputs_mutex_);
+        outputs_.erase(std::remove(outputs_.begin(), outputs_.end(), output_ptr), outputs_.end());
+    }
+    distributePhases();
+    updateDithering();
+}
+
+void PWMTimer::updateDithering() {
+    esp_timer_handle_t timer_to_stop = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(outputs_mutex_);
+        bool dithering_needed =
+            std::any_of(outputs_.begin(), outputs_.end(),
+                        [](OutputPWM* output_ptr) { return output_ptr->isDithering(); });
+
+        if (dithering_needed && !dither_timer_) {
+            DEBUG("Starting dither timer for PWMTimer %ld", timer_num_);
+            esp_timer_create_args_t timer_args = {.callback = ditherTimerCallback,
+                                                  .arg = this,
+                                                  .dispatch_method = ESP_TIMER_TASK,
+                                                  .name = "pwm_dither",
+                                                  .skip_unhandled_events = true};
+            ESP_ERROR_CHECK(esp_timer_create(&timer_args, &dither_timer_));
+            ESP_ERROR_CHECK(esp_timer_start_periodic(dither_timer_, ditherPeriodUsec()));
+        } else if (!dithering_needed && dither_timer_) {
+            DEBUG("No more dithered outputs so stopping dither timer for PWMTimer %ld",
+                  timer_num_);
+            timer_to_stop = dither_timer_;
+            dither_timer_ = nullptr;
+        }
+    }
+
+    // Stopped outside of the lock since a running callback is waiting for it
+    if (timer_to_stop) stopDitherTimer(timer_to_stop);
+}
+
+// Gives the semaphore passed as arg. Used by stopDitherTimer().
+static void giveSemaphoreCallback(void* arg) {
+    xSemaphoreGive((SemaphoreHandle_t)arg);
+}
+
+/* static */
+void PWMTimer::stopDitherTimer(esp_timer_handle_t dither_timer) {
+    esp_timer_stop(dither_timer);
+
+    // esp_timer_stop() doesn't wait for a callback that has already been dispatched. Since
+    // the esp_timer task runs callbacks one at a time, once a callback scheduled now has run
+    // the dither callback is certainly done. Not needed if already in the esp_timer task.
+    if (strcmp(pcTaskGetName(nullptr), "esp_timer") != 0) {
+        SemaphoreHandle_t done = xSemaphoreCreateBinary();
+        esp_timer_create_args_t barrier_args = {.callback = giveSemaphoreCallback,
+                                                .arg = done,
+                                                .dispatch_method = ESP_TIMER_TASK,
+                                                .name = "pwm_barrier"};
+        esp_timer_handle_t barrier;
+        ESP_ERROR_CHECK(esp_timer_create(&barrier_args, &barrier));
+        ESP_ERROR_CHECK(esp_timer_start_once(barrier, 0));
+        xSemaphoreTake(done, portMAX_DELAY);
+        esp_timer_delete(barrier);
+        vSemaphoreDelete(done);
+    }
+
+    esp_timer_delete(dither_timer);
+}
+
+/* static */
+void PWMTimer::ditherTimerCallback(void* arg) {
+    PWMTimer* timer_ptr = static_cast<PWMTimer*>(arg);
+    uint32_t step = timer_ptr->dither_step_++;
+    std::lock_guard<std::mutex> lock(timer_ptr->outputs_mutex_);
+    for (OutputPWM* output_ptr : timer_ptr->outputs_) {
+        if (output_ptr->isDithering()) {
+            output_ptr->ditherStep(step);
+        }
+    }
+}
+
+uint64_t PWMTimer::ditherPeriodUsec() const {
+    return 1000000ULL / std::clamp(freq_hz_, (uint32_t)1, kMaxDitherRateHz);
+}
+
+void PWMTimer::distributePhases() {
+    std::lock_guard<std::mutex> lock(outputs_mutex_);
+
+    // Spread the start points evenly across the period so that the outputs don't all switch
+    // on at the same instant. With a single output the hpoint is simply 0.
+    const uint32_t num_outputs = outputs_.size();
+    for (uint32_t i = 0; i < num_outputs; ++i) {
+        uint32_t hpoint = phase_staggering_ ? i * MAX_DUTY / num_outputs : 0;
+        VERBOSE("For timer %ld setting hpoint of output %ld to %ld", timer_num_, i, hpoint);
+        outputs_[i]->setHpoint(hpoint);
+    }
 }
 
 /********************************** OutputPWM ***************************/
 
-// For keeping track of which channels are being used.
-// Only used internally so declared as a static.
-static auto channels_used = std::set<ledc_channel_t>();
+// For keeping track of which channels are being used. Each speed mode group has its own
+// channels. Only used internally so declared as a static.
+static auto channels_used = std::set<std::pair<ledc_mode_t, ledc_channel_t>>();
 
-// Calls the other constructor using get_available_channel() to properly determine
-// channel number to use.
-OutputPWM::OutputPWM(gpio_num_t gpio_num) : OutputPWM(gpio_num, get_available_channel()) {}
+// Gets an available timer from any speed mode group and then uses get_available_channel()
+// to properly determine channel number to use within that group.
+OutputPWM::OutputPWM(gpio_num_t gpio_num) : OutputPWM(gpio_num, PWMTimer::getAvailableTimer()) {}
 
+OutputPWM::OutputPWM(gpio_num_t gpio_num, PWMTimer* timer_ptr)
+    : OutputPWM(gpio_num, get_available_channel(timer_ptr->getSpeedMode()), timer_ptr) {}
+
+// Channel was specified without a speed mode so it is a low speed channel
 OutputPWM::OutputPWM(gpio_num_t gpio_num, ledc_channel_t channel)
-    : timer_ptr_(PWMTimer::getAvailableTimer()),
+    : OutputPWM(gpio_num, channel,
+                PWMTimer::getAvailableTimer(PWMTimer::kDefaultFrequency, LEDC_LOW_SPEED_MODE)) {}
+
+// Shares the specified timer, using get_available_channel() to determine channel number to use.
+OutputPWM::OutputPWM(gpio_num_t gpio_num, ledc_timer_t timer_num)
+    : OutputPWM(gpio_num, get_available_channel(), PWMTimer::getTimer(timer_num)) {}
+
+OutputPWM::OutputPWM(gpio_num_t gpio_num, ledc_channel_t channel, ledc_timer_t timer_num)
+    : OutputPWM(gpio_num, channel, PWMTimer::getTimer(timer_num)) {}
+
+OutputPWM::OutputPWM(gpio_num_t gpio_num, ledc_channel_t channel, PWMTimer* timer_ptr)
+    : timer_ptr_(timer_ptr),
       gpio_num_(gpio_num),
       channel_(channel),
-      speed_mode_(timer_ptr_->getSpeedMode()) {
+      speed_mode_(timer_ptr_->getSpeedMode()),
+      duty_(0),
+      hpoint_(0),
+      dither_bits_(0),
+      fine_duty_(0),
+      applied_duty_(0),
+      dither_state_(0) {
     INFO("Constructing OutputPWM for gpio_num=%d timer=%ld channel=%d", gpio_num_,
          timer_ptr_->getTimer(), channel_);
 
     // Keep track that this channel is being used
-    channels_used.insert(channel);
+    channels_used.insert(std::make_pair(speed_mode_, channel_));
 
     // Prepare and then apply the LEDC PWM channel configuration
     ledc_channel_config_t ledc_channel = {.gpio_num = gpio_num_,
@@ -280,16 +464,23 @@ OutputPWM::OutputPWM(gpio_num_t gpio_num, ledc_channel_t channel)
                                           .intr_type = LEDC_INTR_DISABLE,
                                           .timer_sel = timer_ptr_->getTimer(),
                                           .duty = 0,  // Set duty to 0% at initialization
-                                          .hpoint = 0,
+                                          .hpoint = hpoint_,
                                           .sleep_mode = LEDC_SLEEP_MODE_NO_ALIVE_NO_PD,
                                           .flags = false};
     ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
+
+    // Now that channel is configured let the timer know about it so that the
+    // phases of all the outputs using the timer can be staggered
+    timer_ptr_->addOutput(this);
 }
 
 OutputPWM::~OutputPWM() {
     INFO("Deleting OutputPWM for gpio_num=%d and channel=%d", gpio_num_, channel_);
 
-    // Release the reference to the timer
+    // Release the reference to the timer. First remove this output so that the phases
+    // of the remaining outputs are redistributed.
+    dither_bits_ = 0;
+    timer_ptr_->removeOutput(this);
     timer_ptr_->doneWithTimer();
 
     // Oddly, there is an ESP-IDF bug where GPIO LEDC bits are reserved automatically,
@@ -298,15 +489,15 @@ OutputPWM::~OutputPWM() {
     esp_gpio_revoke(BIT64(gpio_num_));
 
     // Keep track that this channel no longer being used
-    channels_used.erase(channel_);
+    channels_used.erase(std::make_pair(speed_mode_, channel_));
 }
 
-ledc_channel_t OutputPWM::get_available_channel(void) {
-    DEBUG("Determining available LEDC channel...");
+ledc_channel_t OutputPWM::get_available_channel(ledc_mode_t speed_mode) {
+    DEBUG("Determining available LEDC channel for speed mode %d...", speed_mode);
 
     for (int num = LEDC_CHANNEL_0; num < LEDC_CHANNEL_MAX; ++num) {
         ledc_channel_t channel_num = static_cast<ledc_channel_t>(num);
-        if (!channels_used.contains(channel_num)) {
+        if (!channels_used.contains(std::make_pair(speed_mode, channel_num))) {
             DEBUG("Will be using LEDC channel %ld", channel_num);
             // Found channel not already used
             return channel_num;
@@ -320,10 +511,20 @@ ledc_channel_t OutputPWM::get_available_channel(void) {
 void OutputPWM::setDuty(const float percentage) {
     DEBUG("Setting duty for GPIO PWM bit %ld to %f%%", gpio_num_, percentage);
 
-    setDutyValue(percentage * PWMTimer::MAX_DUTY / 100.0);
+    if (dither_bits_) {
+        setDutyValueFine(percentage * (PWMTimer::MAX_DUTY << dither_bits_) / 100.0);
+    } else {
+        setDutyValue(percentage * PWMTimer::MAX_DUTY / 100.0);
+    }
 }
 
 void OutputPWM::setDutyValue(const uint32_t duty) {
+    // If dithering then simply a fine duty with no fractional part
+    if (dither_bits_) {
+        setDutyValueFine(std::min(duty, (uint32_t)PWMTimer::MAX_DUTY) << dither_bits_);
+        return;
+    }
+
     if (duty > PWMTimer::MAX_DUTY) {
         WARN(
             "For GPIO PWM bit %d tried to set duty to %ld but maximum duty is %ld so has been set "
@@ -336,11 +537,93 @@ void OutputPWM::setDutyValue(const uint32_t duty) {
     DEBUG("Setting OutputPWM bit %d on channel %ld to %ld out of %ld", gpio_num_, channel_, duty_,
           PWMTimer::MAX_DUTY);
 
-    // Set duty to 50%
-    ESP_ERROR_CHECK(ledc_set_duty(speed_mode_, channel_, duty_));
+    // Set the duty, keeping the hpoint so that phase staggering is preserved
+    ESP_ERROR_CHECK(ledc_set_duty_with_hpoint(speed_mode_, channel_, duty_, hpoint_));
 
     // Update duty to apply the new value
     ESP_ERROR_CHECK(ledc_update_duty(speed_mode_, channel_));
+    applied_duty_ = duty_;
+}
+
+void IDFX_IRAM_ATTR OutputPWM::setDutyValueFast(const uint32_t duty) {
+    // No logging or error checking since the strings would be in flash. The LEDC calls are
+    // in IRAM if CONFIG_LEDC_CTRL_FUNC_IN_IRAM is set, which CONFIG_IDFX_IRAM_SAFE selects.
+    duty_ = duty > PWMTimer::MAX_DUTY ? PWMTimer::MAX_DUTY : duty;
+    if (dither_bits_) {
+        // Dithered outputs just get the base duty, with no fraction. The channel is only
+        // written by ditherStep(), so that it and this don't race, so takes effect at the
+        // next dither step.
+        fine_duty_ = duty_ << dither_bits_;
+        dither_state_ = duty_ << 16;
+        return;
+    }
+    ledc_set_duty_with_hpoint(speed_mode_, channel_, duty_, hpoint_);
+    ledc_update_duty(speed_mode_, channel_);
+    applied_duty_ = duty_;
+}
+
+// For dithering. Bit reversed order of the 16 dither steps so that the periods that get
+// the extra duty are spread as evenly as possible, minimizing visible flicker.
+static const uint8_t kBitReversed4[16] = {0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15};
+
+void OutputPWM::setDithering(const uint8_t extra_bits) {
+    uint8_t bits = std::min(extra_bits, kMaxDitherBits);
+    if (bits != extra_bits) {
+        WARN("For GPIO PWM bit %d tried to set %d dither bits but maximum is %d", gpio_num_,
+             extra_bits, kMaxDitherBits);
+    }
+    DEBUG("Setting dithering for GPIO PWM bit %d to %d extra bits", gpio_num_, bits);
+
+    // Keep the same duty, but with the new resolution
+    dither_bits_ = bits;
+    setDutyValue(duty_);
+
+    // Let timer know so that it can start or stop the dither timer
+    timer_ptr_->updateDithering();
+}
+
+void OutputPWM::setDutyValueFine(const uint32_t fine_duty) {
+    if (!dither_bits_) {
+        setDutyValue(fine_duty);
+        return;
+    }
+
+    const uint32_t max_fine_duty = PWMTimer::MAX_DUTY << dither_bits_;
+    if (fine_duty > max_fine_duty) {
+        WARN("For GPIO PWM bit %d tried to set fine duty to %ld but maximum is %ld so has been set "
+             "to that value", gpio_num_, fine_duty, max_fine_duty);
+    }
+    fine_duty_ = std::min(fine_duty, max_fine_duty);
+
+    // Split into the base duty and the fraction that is realized by dithering
+    const uint32_t base = fine_duty_ >> dither_bits_;
+    const uint32_t fraction = fine_duty_ & ((1 << dither_bits_) - 1);
+
+    // Precompute which of the steps get base+1. Out of the 2^dither_bits_ steps, fraction of
+    // them do, spread out by using bit reversed order.
+    uint32_t pattern = 0;
+    for (uint32_t step = 0; step < (1u << dither_bits_); ++step) {
+        if ((kBitReversed4[step] >> (kMaxDitherBits - dither_bits_)) < fraction) {
+            pattern |= 1 << step;
+        }
+    }
+    DEBUG("Setting OutputPWM bit %d fine duty to %ld, base=%ld pattern=0x%04lX", gpio_num_,
+          fine_duty_, base, pattern);
+
+    duty_ = base;
+    dither_state_ = (base << 16) | pattern;
+}
+
+void OutputPWM::ditherStep(const uint32_t step) {
+    const uint32_t state = dither_state_;
+    const uint32_t pattern_bit = step & ((1 << dither_bits_) - 1);
+    const uint32_t duty = (state >> 16) + ((state >> pattern_bit) & 1);
+
+    // Only write to the channel when the duty actually changes
+    if (applied_duty_.exchange(duty) == duty) return;
+
+    ESP_ERROR_CHECK(ledc_set_duty_with_hpoint(speed_mode_, channel_, duty, hpoint_));
+    ESP_ERROR_CHECK(ledc_update_duty(speed_mode_, channel_));
 }
 
 void OutputPWM::setFrequency(const uint32_t freq_hz) {
@@ -348,5 +631,18 @@ void OutputPWM::setFrequency(const uint32_t freq_hz) {
 
     // Since changing frequency of a timer also changes the duty of the signal
     // the duty is reset to its original value.
-    setDutyValue(duty_);
+    if (dither_bits_) {
+        setDutyValueFine(fine_duty_);
+    } else {
+        setDutyValue(duty_);
+    }
+}
+
+void OutputPWM::setHpoint(const uint32_t hpoint) {
+    hpoint_ = std::min(hpoint, (uint32_t)PWMTimer::MAX_DUTY - 1);
+    DEBUG("Setting hpoint for OutputPWM bit %d on channel %ld to %ld", gpio_num_, channel_, hpoint_);
+
+    // Reapply the current duty so that it is preserved with the new hpoint
+    ESP_ERROR_CHECK(ledc_set_duty_with_hpoint(speed_mode_, channel_, applied_duty_, hpoint_));
+    ESP_ERROR_CHECK(ledc_update_duty(speed_mode_, channel_));
 }
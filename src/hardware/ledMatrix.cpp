@@ -0,0 +1,223 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/hardware/ledMatrix.hpp"
+
+#include <algorithm>
+
+#include "esp_attr.h"
+#include "idfx/utils/log.hpp"
+#include "soc/gpio_struct.h"
+#include "soc/soc_caps.h"
+
+// So that don't get warnings about the gptimer structures not being fully specified
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+
+using namespace idfx;
+
+// Resolution of the GPTimer. 1MHz so that timer ticks are microseconds.
+static const uint32_t kTimerResolutionHz = 1000000;
+
+// If least significant bit-plane is displayed for less than this the ISR overhead dominates
+static const uint32_t kMinTickUsec = 5;
+
+LedMatrix::LedMatrix(const std::vector<gpio_num_t>& row_pins,
+                     const std::vector<gpio_num_t>& column_pins, bool rows_active_high,
+                     bool columns_active_high, uint32_t refresh_hz, uint8_t brightness_bits)
+    : row_pins_(row_pins),
+      column_pins_(column_pins),
+      rows_active_high_(rows_active_high),
+      columns_active_high_(columns_active_high),
+      brightness_bits_(std::clamp(brightness_bits, (uint8_t)1, (uint8_t)8)),
+      num_rows_(row_pins.size()),
+      pixels_(row_pins.size() * column_pins.size(), 0),
+      all_off_masks_({}),
+      front_(nullptr),
+      pending_(nullptr),
+      back_index_(0),
+      timer_(nullptr),
+      current_row_(0),
+      current_plane_(0) {
+    INFO("Creating LedMatrix with %d rows and %d columns, refresh_hz=%ld brightness_bits=%d",
+         row_pins_.size(), column_pins_.size(), refresh_hz, brightness_bits_);
+
+    // Each row is displayed for (2^brightness_bits - 1) ticks per frame
+    const uint32_t ticks_per_row = (1 << brightness_bits_) - 1;
+    tick_usec_ = std::max(kTimerResolutionHz / (refresh_hz * row_pins_.size() * ticks_per_row),
+                          (uint32_t)1);
+    if (tick_usec_ < kMinTickUsec) {
+        WARN("LedMatrix tick of %ld usec is very short so ISR overhead will be significant. "
+             "Consider lowering refresh_hz or brightness_bits.", tick_usec_);
+    }
+
+    // Configure all the pins as outputs, initially off
+    uint64_t pin_bit_mask = 0;
+    for (gpio_num_t pin : row_pins_) {
+        pin_bit_mask |= 1ULL << pin;
+        addToMasks(all_off_masks_, pin, !rows_active_high_);
+    }
+    for (gpio_num_t pin : column_pins_) {
+        pin_bit_mask |= 1ULL << pin;
+        addToMasks(all_off_masks_, pin, !columns_active_high_);
+    }
+    gpio_config_t io_conf = {.pin_bit_mask = pin_bit_mask,
+                             .mode = GPIO_MODE_OUTPUT,
+                             .pull_up_en = GPIO_PULLUP_DISABLE,
+                             .pull_down_en = GPIO_PULLDOWN_DISABLE,
+                             .intr_type = GPIO_INTR_DISABLE};
+    ESP_ERROR_CHECK(gpio_config(&io_conf));
+    for (gpio_num_t pin : row_pins_) gpio_set_level(pin, !rows_active_high_);
+    for (gpio_num_t pin : column_pins_) gpio_set_level(pin, !columns_active_high_);
+
+    // Start with both frames all off
+    for (auto& frame : frames_) {
+        frame.assign(row_pins_.size() * brightness_bits_, all_off_masks_);
+    }
+    front_ = frames_[0].data();
+    back_index_ = 1;
+
+    // Create the timer that does the scanning. Uses the highest interrupt priority that
+    // can still be handled in C.
+    gptimer_config_t timer_config = {.clk_src = GPTIMER_CLK_SRC_DEFAULT,
+                                     .direction = GPTIMER_COUNT_UP,
+                                     .resolution_hz = kTimerResolutionHz,
+                                     .intr_priority = 3};
+    ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &timer_));
+    gptimer_event_callbacks_t callbacks = {.on_alarm = onAlarm};
+    ESP_ERROR_CHECK(gptimer_register_event_callbacks(timer_, &callbacks, this));
+}
+
+LedMatrix::~LedMatrix() {
+    DEBUG("Deleting LedMatrix");
+
+    stop();
+    gptimer_del_timer(timer_);
+}
+
+void LedMatrix::start() {
+    DEBUG("Starting LedMatrix scanning with tick of %ld usec", tick_usec_);
+
+    current_row_ = 0;
+    current_plane_ = 0;
+    ESP_ERROR_CHECK(gptimer_enable(timer_));
+    ESP_ERROR_CHECK(gptimer_set_raw_count(timer_, 0));
+    gptimer_alarm_config_t alarm_config = {.alarm_count = tick_usec_};
+    ESP_ERROR_CHECK(gptimer_set_alarm_action(timer_, &alarm_config));
+    ESP_ERROR_CHECK(gptimer_start(timer_));
+}
+
+void LedMatrix::stop() {
+    DEBUG("Stopping LedMatrix scanning");
+
+    // Stopping a timer that isn't running returns an error. That is fine.
+    if (gptimer_stop(timer_) == ESP_OK) {
+        gptimer_disable(timer_);
+    }
+
+    // Turn all LEDs off
+    GPIO.out_w1tc = all_off_masks_.clear_lo;
+    GPIO.out_w1ts = all_off_masks_.set_lo;
+#if SOC_GPIO_PIN_COUNT > 32
+    GPIO.out1_w1tc.val = all_off_masks_.clear_hi;
+    GPIO.out1_w1ts.val = all_off_masks_.set_hi;
+#endif
+}
+
+void LedMatrix::setPixel(uint8_t row, uint8_t column, uint8_t brightness) {
+    if (row >= row_pins_.size() || column >= column_pins_.size()) {
+        ERROR("LedMatrix pixel row=%d column=%d is out of range", row, column);
+        return;
+    }
+    pixels_[row * column_pins_.size() + column] = brightness;
+}
+
+void LedMatrix::clear() {
+    std::fill(pixels_.begin(), pixels_.end(), 0);
+}
+
+void LedMatrix::show() {
+    // If the ISR hasn't yet picked up the previous frame, such as when scanning is stopped
+    // or show() is called faster than the refresh rate, then take it back and overwrite
+    // it instead of waiting. Otherwise the ISR is now displaying that frame and the other
+    // buffer is free.
+    if (pending_.exchange(nullptr) != nullptr) {
+        back_index_ = 1 - back_index_;
+    }
+
+    // Precompute the masks for each row and bit-plane
+    std::vector<masks_t>& back = frames_[back_index_];
+    const uint8_t shift = 8 - brightness_bits_;
+    for (size_t row = 0; row < row_pins_.size(); ++row) {
+        for (uint8_t plane = 0; plane < brightness_bits_; ++plane) {
+            masks_t masks = {};
+            for (size_t r = 0; r < row_pins_.size(); ++r) {
+                addToMasks(masks, row_pins_[r], (r == row) == rows_active_high_);
+            }
+            for (size_t column = 0; column < column_pins_.size(); ++column) {
+                uint8_t level = pixels_[row * column_pins_.size() + column] >> shift;
+                bool lit = (level >> plane) & 1;
+                addToMasks(masks, column_pins_[column], lit == columns_active_high_);
+            }
+            back[row * brightness_bits_ + plane] = masks;
+        }
+    }
+
+    // Hand the new frame to the ISR and switch back buffer to the other one
+    pending_.store(back.data());
+    back_index_ = 1 - back_index_;
+}
+
+/* static */
+void LedMatrix::addToMasks(masks_t& masks, gpio_num_t pin, bool high) {
+    if (pin < 32) {
+        uint32_t bit = 1UL << pin;
+        masks.set_lo = high ? masks.set_lo | bit : masks.set_lo & ~bit;
+        masks.clear_lo = high ? masks.clear_lo & ~bit : masks.clear_lo | bit;
+    } else {
+        uint32_t bit = 1UL << (pin - 32);
+        masks.set_hi = high ? masks.set_hi | bit : masks.set_hi & ~bit;
+        masks.clear_hi = high ? masks.clear_hi & ~bit : masks.clear_hi | bit;
+    }
+}
+
+/* static */
+bool IRAM_ATTR LedMatrix::onAlarm(gptimer_handle_t timer, const gptimer_alarm_event_data_t* edata,
+                                  void* user_ctx) {
+    LedMatrix* matrix = static_cast<LedMatrix*>(user_ctx);
+
+    // At start of a frame switch to the new masks if there are some
+    if (matrix->current_row_ == 0 && matrix->current_plane_ == 0) {
+        masks_t* pending = matrix->pending_.exchange(nullptr);
+        if (pending) {
+            matrix->front_ = pending;
+        }
+    }
+
+    // Output the masks. Clear first so that the previous row is switched off before
+    // the next one is switched on, to avoid ghosting.
+    const masks_t& masks =
+        matrix->front_[matrix->current_row_ * matrix->brightness_bits_ + matrix->current_plane_];
+    GPIO.out_w1tc = masks.clear_lo;
+    GPIO.out_w1ts = masks.set_lo;
+#if SOC_GPIO_PIN_COUNT > 32
+    GPIO.out1_w1tc.val = masks.clear_hi;
+    GPIO.out1_w1ts.val = masks.set_hi;
+#endif
+
+    // Display this bit-plane for a time proportional to its weight
+    gptimer_alarm_config_t alarm_config = {
+        .alarm_count = edata->alarm_value + (matrix->tick_usec_ << matrix->current_plane_)};
+    gptimer_set_alarm_action(timer, &alarm_config);
+
+    // Advance to the next bit-plane, and row
+    if (++matrix->current_plane_ >= matrix->brightness_bits_) {
+        matrix->current_plane_ = 0;
+        if (++matrix->current_row_ >= matrix->num_rows_) {
+            matrix->current_row_ = 0;
+        }
+    }
+
+    // No task was woken so no need to yield
+    return false;
+}
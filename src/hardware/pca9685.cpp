@@ -0,0 +1,212 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/hardware/pca9685.hpp"
+
+#include <algorithm>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "idfx/utils/log.hpp"
+#include "rom/ets_sys.h"
+
+using namespace idfx;
+
+// Registers
+static const uint8_t kRegMode1 = 0x00;
+static const uint8_t kRegMode2 = 0x01;
+static const uint8_t kRegLed0OnL = 0x06;
+static const uint8_t kRegPrescale = 0xFE;
+
+// MODE1 bits
+static const uint8_t kMode1Restart = 0x80;
+static const uint8_t kMode1AutoIncrement = 0x20;
+static const uint8_t kMode1Sleep = 0x10;
+static const uint8_t kMode1AllCall = 0x01;
+
+// MODE2 bits
+static const uint8_t kMode2TotemPole = 0x04;
+
+// Bit in ON_H or OFF_H that makes the output fully on or fully off
+static const uint8_t kFullBit = 0x10;
+
+static const uint32_t kOscillatorHz = 25000000;
+static const int kI2cTimeoutMsec = 50;
+
+// If only this many unchanged channels are between changed ones then it is cheaper to
+// include them in the burst than to start another transaction
+static const int kMaxGapChannels = 1;
+
+/********************************** Pca9685Output ***************************/
+
+void Pca9685Output::setDuty(const float percentage) {
+    setDutyValue(std::clamp(percentage, 0.0f, 100.0f) * kMaxDuty / 100.0f + 0.5f);
+}
+
+void Pca9685Output::setDutyValue(const uint32_t duty) {
+    chip_ptr_->setDutyValue(channel_, duty);
+}
+
+void Pca9685Output::setFrequency(const uint32_t freq_hz) {
+    chip_ptr_->setFrequency(freq_hz);
+}
+
+/********************************** Pca9685 ***************************/
+
+Pca9685::Pca9685(i2c_master_bus_handle_t bus, uint8_t address, uint32_t freq_hz, bool open_drain,
+                 uint32_t scl_speed_hz)
+    : mode1_(kMode1AutoIncrement | kMode1AllCall), group_depth_(0), stats_({}) {
+    INFO("Creating PCA9685 at I2C address 0x%02X", address);
+
+    i2c_device_config_t dev_config = {};
+    dev_config.dev_addr_length = I2C_ADDR_BIT_LEN_7;
+    dev_config.device_address = address;
+    dev_config.scl_speed_hz = scl_speed_hz;
+    ESP_ERROR_CHECK(i2c_master_bus_add_device(bus, &dev_config, &i2c_device_));
+
+    for (int channel = 0; channel < kNumChannels; ++channel) {
+        outputs_[channel].chip_ptr_ = this;
+        outputs_[channel].channel_ = channel;
+    }
+
+    ESP_ERROR_CHECK(writeRegister(kRegMode2, open_drain ? 0 : kMode2TotemPole));
+    setFrequency(freq_hz);
+
+    // Start with all channels off. The shadow copy is set to something that can't match
+    // so that all channels are written in a single burst.
+    std::fill(written_, written_ + kNumChannels, UINT32_MAX);
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int channel = 0; channel < kNumChannels; ++channel) {
+        pending_[channel] = channelRegisters(channel, 0);
+    }
+    flush();
+}
+
+Pca9685::~Pca9685() {
+    DEBUG("Deleting PCA9685");
+
+    // Leave the outputs off
+    writeRegister(kRegMode1, mode1_ | kMode1Sleep);
+    i2c_master_bus_rm_device(i2c_device_);
+}
+
+Pca9685Output& Pca9685::output(uint8_t channel) {
+    ASSERT_MSG(channel < kNumChannels, "PCA9685 channel out of range");
+    return outputs_[channel];
+}
+
+esp_err_t Pca9685::writeRegister(uint8_t reg, uint8_t value) {
+    const uint8_t buf[] = {reg, value};
+    return i2c_master_transmit(i2c_device_, buf, sizeof(buf), kI2cTimeoutMsec);
+}
+
+void Pca9685::setFrequency(uint32_t freq_hz) {
+    // Prescale is 25MHz / (4096 * freq) - 1, rounded, and is limited to 3..255
+    const int prescale =
+        std::clamp<int>((kOscillatorHz + 2048 * freq_hz) / (4096 * freq_hz) - 1, 3, 255);
+    DEBUG("Setting PCA9685 frequency to %ld Hz using prescale of %d", freq_hz, prescale);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Prescale can only be written while sleeping. Restarting afterwards resumes the
+    // channels with their previous registers.
+    ESP_ERROR_CHECK(writeRegister(kRegMode1, mode1_ | kMode1Sleep));
+    ESP_ERROR_CHECK(writeRegister(kRegPrescale, prescale));
+    ESP_ERROR_CHECK(writeRegister(kRegMode1, mode1_));
+    // Oscillator needs 500 usec to stabilize before restarting
+    ets_delay_us(500);
+    ESP_ERROR_CHECK(writeRegister(kRegMode1, mode1_ | kMode1Restart));
+}
+
+/* static */
+uint32_t Pca9685::channelRegisters(uint8_t channel, uint32_t duty) {
+    if (duty == 0) return (uint32_t)kFullBit << 24;
+    if (duty >= OutputPWMBase::kMaxDuty) return (uint32_t)kFullBit << 8;
+
+    // Stagger the start of the pulse for each channel across the period
+    const uint32_t on = channel * (OutputPWMBase::kMaxDuty / kNumChannels);
+    const uint32_t off = (on + duty) % OutputPWMBase::kMaxDuty;
+    return on | off << 16;
+}
+
+void Pca9685::setDutyValue(uint8_t channel, uint32_t duty) {
+    if (channel >= kNumChannels) {
+        ERROR("PCA9685 channel %d is out of range", channel);
+        return;
+    }
+    if (duty > OutputPWMBase::kMaxDuty) {
+        WARN("For PCA9685 channel %d tried to set duty to %ld but maximum duty is %ld", channel,
+             duty, OutputPWMBase::kMaxDuty);
+        duty = OutputPWMBase::kMaxDuty;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_[channel] = channelRegisters(channel, duty);
+    if (pending_[channel] == written_[channel]) {
+        stats_.skipped_writes++;
+        return;
+    }
+    if (group_depth_ == 0) flush();
+}
+
+void Pca9685::beginGroup() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    group_depth_++;
+}
+
+void Pca9685::commit() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (group_depth_ == 0) {
+        WARN("PCA9685 commit() called without beginGroup()");
+        return;
+    }
+    if (--group_depth_ == 0) flush();
+}
+
+void Pca9685::flush() {
+    int channel = 0;
+    while (channel < kNumChannels) {
+        // Find the next changed channel
+        if (pending_[channel] == written_[channel]) {
+            channel++;
+            continue;
+        }
+
+        // Extend the run while changed channels are close enough together
+        const int first = channel;
+        int last = channel;
+        for (int next = channel + 1; next < kNumChannels && next - last <= kMaxGapChannels + 1;
+             ++next) {
+            if (pending_[next] != written_[next]) last = next;
+        }
+
+        // Write the run as a single auto-increment burst
+        uint8_t buf[1 + 4 * kNumChannels];
+        buf[0] = kRegLed0OnL + 4 * first;
+        size_t length = 1;
+        for (int ch = first; ch <= last; ++ch) {
+            const uint32_t regs = pending_[ch];
+            buf[length++] = regs;
+            buf[length++] = regs >> 8;
+            buf[length++] = regs >> 16;
+            buf[length++] = regs >> 24;
+        }
+
+        esp_err_t err = i2c_master_transmit(i2c_device_, buf, length, kI2cTimeoutMsec);
+        stats_.transactions++;
+        if (err == ESP_OK) {
+            // Update shadow so that the run isn't written again. Errors leave the shadow
+            // as is so that the channels are retried on the next flush.
+            for (int ch = first; ch <= last; ++ch) {
+                if (written_[ch] != pending_[ch]) stats_.channel_writes++;
+                written_[ch] = pending_[ch];
+            }
+        } else {
+            stats_.errors++;
+            ERROR("Writing PCA9685 channels %d-%d failed: %s", first, last, esp_err_to_name(err));
+        }
+
+        channel = last + 1;
+    }
+}
@@ -0,0 +1,141 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/hardware/pulseDecoders.hpp"
+
+using namespace idfx;
+
+// NEC timings in microseconds
+static const uint32_t kNecLeaderMarkUsec = 9000;
+static const uint32_t kNecLeaderSpaceUsec = 4500;
+static const uint32_t kNecRepeatSpaceUsec = 2250;
+static const uint32_t kNecBitMarkUsec = 560;
+static const uint32_t kNecZeroSpaceUsec = 560;
+static const uint32_t kNecOneSpaceUsec = 1690;
+
+// RC5 half bit time in microseconds. Each bit is a space and a mark, or vice versa.
+static const uint32_t kRc5HalfBitUsec = 889;
+static const int kRc5Bits = 14;
+
+// DHT high time that separates a 0 bit (26-28 usec) from a 1 bit (70 usec)
+static const uint32_t kDhtOneThresholdUsec = 50;
+static const int kDhtBits = 40;
+
+bool NecDecoder::decode(const pulse_t *pulses, size_t count) {
+    if (count < 3 || pulses[0].level != 1 || !matches(pulses[0].usec, kNecLeaderMarkUsec))
+        return false;
+
+    // Repeat code is leader mark, short space, and a bit mark
+    if (matches(pulses[1].usec, kNecRepeatSpaceUsec)) {
+        repeat_ = true;
+        return true;
+    }
+    if (!matches(pulses[1].usec, kNecLeaderSpaceUsec) || count < 2 + 32 * 2) return false;
+
+    // 32 bits, least significant first, each a mark followed by a space whose length
+    // determines the value
+    uint32_t bits = 0;
+    for (int bit = 0; bit < 32; ++bit) {
+        const pulse_t &mark = pulses[2 + bit * 2];
+        const pulse_t &space = pulses[3 + bit * 2];
+        if (!matches(mark.usec, kNecBitMarkUsec)) return false;
+
+        if (matches(space.usec, kNecOneSpaceUsec)) {
+            bits |= 1u << bit;
+        } else if (!matches(space.usec, kNecZeroSpaceUsec)) {
+            return false;
+        }
+    }
+
+    // Command is followed by its inverse. If the address is followed by its inverse then
+    // it is standard NEC, otherwise the full 16 bits are an extended address.
+    const uint8_t command = (bits >> 16) & 0xFF;
+    if (command != (uint8_t)~(bits >> 24)) return false;
+    const uint8_t address_lo = bits & 0xFF;
+    const uint8_t address_hi = (bits >> 8) & 0xFF;
+
+    address_ = address_lo == (uint8_t)~address_hi ? address_lo : (bits & 0xFFFF);
+    command_ = command;
+    repeat_ = false;
+    return true;
+}
+
+bool Rc5Decoder::decode(const pulse_t *pulses, size_t count) {
+    // Convert to a sequence of half bit levels. The first half of the first start bit
+    // is a space, which looks the same as idle so isn't captured.
+    uint8_t halves[kRc5Bits * 2];
+    int num_halves = 0;
+    halves[num_halves++] = 0;
+
+    for (size_t i = 0; i < count && num_halves < kRc5Bits * 2; ++i) {
+        int n;
+        if (matches(pulses[i].usec, kRc5HalfBitUsec)) {
+            n = 1;
+        } else if (matches(pulses[i].usec, 2 * kRc5HalfBitUsec)) {
+            n = 2;
+        } else {
+            return false;
+        }
+        for (int j = 0; j < n && num_halves < kRc5Bits * 2; ++j)
+            halves[num_halves++] = pulses[i].level;
+    }
+
+    // If the last bit is a 0 it ends with a space, which looks the same as idle
+    if (num_halves == kRc5Bits * 2 - 1) halves[num_halves++] = 0;
+    if (num_halves != kRc5Bits * 2) return false;
+
+    // Space then mark is a 1, mark then space is a 0
+    uint16_t bits = 0;
+    for (int bit = 0; bit < kRc5Bits; ++bit) {
+        const uint8_t first = halves[bit * 2];
+        const uint8_t second = halves[bit * 2 + 1];
+        if (first == second) return false;
+        bits = (bits << 1) | second;
+    }
+
+    // Second start bit is inverted command bit 6 for extended RC5
+    if ((bits & 0x2000) == 0) return false;
+    toggle_ = (bits >> 11) & 1;
+    address_ = (bits >> 6) & 0x1F;
+    command_ = (bits & 0x3F) | (((bits >> 12) & 1) ? 0 : 0x40);
+    return true;
+}
+
+bool DhtDecoder::decode(const pulse_t *pulses, size_t count) {
+    // The data bits are the last 40 high pulses. Before them are the start signal and
+    // response, which are ignored.
+    uint8_t data[kDhtBits / 8] = {};
+    int bit = kDhtBits - 1;
+    for (int i = (int)count - 1; i >= 0 && bit >= 0; --i) {
+        if (pulses[i].level != 1 || pulses[i].usec == 0) continue;
+        if (pulses[i].usec > kDhtOneThresholdUsec) data[bit / 8] |= 0x80 >> (bit % 8);
+        bit--;
+    }
+    if (bit >= 0) return false;
+
+    const uint8_t checksum = data[0] + data[1] + data[2] + data[3];
+    if (checksum != data[4]) return false;
+
+    if (model_ == DHT11) {
+        humidity_pct_ = data[0] + data[1] * 0.1f;
+        temperature_c_ = data[2] + (data[3] & 0x7F) * 0.1f;
+        if (data[3] & 0x80) temperature_c_ = -temperature_c_;
+    } else {
+        humidity_pct_ = ((data[0] << 8) | data[1]) * 0.1f;
+        temperature_c_ = (((data[2] & 0x7F) << 8) | data[3]) * 0.1f;
+        if (data[2] & 0x80) temperature_c_ = -temperature_c_;
+    }
+    return true;
+}
+
+bool UltrasonicDecoder::decode(const pulse_t *pulses, size_t count) {
+    // The echo is the first high pulse
+    for (size_t i = 0; i < count; ++i) {
+        if (pulses[i].level == 1 && pulses[i].usec > 0) {
+            echo_usec_ = pulses[i].usec;
+            return true;
+        }
+    }
+    return false;
+}
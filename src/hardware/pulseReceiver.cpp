@@ -0,0 +1,185 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/hardware/pulseReceiver.hpp"
+
+#include <algorithm>
+
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "idfx/utils/log.hpp"
+#include "soc/soc_caps.h"
+
+using namespace idfx;
+
+// Maximum glitch filter supported by all chips
+static const uint32_t kMaxFilterNsec = 3000;
+
+// Message from the receive done callback to the decode task
+typedef struct ReceivedFrame {
+    int buffer;
+    size_t num_symbols;
+} received_frame_t;
+
+// Value of ReceivedFrame::buffer that tells the decode task to exit
+static const int kExitTask = -1;
+
+PulseReceiver::PulseReceiver(GPIONum gpio_num, PulseDecoder &decoder,
+                             pulse_decoded_function_t decoded_function, void *arg, bool invert,
+                             size_t max_symbols, UBaseType_t task_priority)
+    : decoder_(decoder),
+      decoded_function_(decoded_function),
+      decoded_arg_(arg),
+      max_symbols_(max_symbols),
+      channel_(nullptr),
+      receive_config_({}),
+      buffers_{nullptr, nullptr},
+      next_buffer_(0),
+      pulses_(nullptr),
+      done_queue_(nullptr),
+      task_(nullptr),
+      task_exited_(nullptr),
+      continuous_(false),
+      stats_({}) {
+    INFO("Creating %s pulse receiver on pin %d", decoder_.name(), gpio_num.get_value());
+
+    rmt_rx_channel_config_t channel_config = {};
+    channel_config.gpio_num = (gpio_num_t)gpio_num.get_value();
+    channel_config.clk_src = RMT_CLK_SRC_DEFAULT;
+    channel_config.resolution_hz = decoder_.resolutionHz();
+    channel_config.mem_block_symbols = SOC_RMT_MEM_WORDS_PER_CHANNEL;
+    channel_config.flags.invert_in = invert;
+#if SOC_RMT_SUPPORT_DMA
+    // Frames longer than the RMT memory block are received via DMA
+    if (max_symbols_ > SOC_RMT_MEM_WORDS_PER_CHANNEL) {
+        channel_config.mem_block_symbols = max_symbols_;
+        channel_config.flags.with_dma = true;
+    }
+#else
+    if (max_symbols_ > SOC_RMT_MEM_WORDS_PER_CHANNEL) {
+        WARN("Frames limited to %d symbols since chip doesn't support RMT DMA",
+             SOC_RMT_MEM_WORDS_PER_CHANNEL);
+        max_symbols_ = SOC_RMT_MEM_WORDS_PER_CHANNEL;
+    }
+#endif
+    ESP_ERROR_CHECK(rmt_new_rx_channel(&channel_config, &channel_));
+
+    rmt_rx_event_callbacks_t callbacks = {};
+    callbacks.on_recv_done = receiveDoneCallback;
+    ESP_ERROR_CHECK(rmt_rx_register_event_callbacks(channel_, &callbacks, this));
+    ESP_ERROR_CHECK(rmt_enable(channel_));
+
+    receive_config_.signal_range_min_ns = std::min(decoder_.minPulseNsec(), kMaxFilterNsec);
+    receive_config_.signal_range_max_ns = decoder_.maxIdleNsec();
+
+    // Buffers are written by DMA so must be in internal DMA capable memory
+    for (auto &buffer : buffers_) {
+        buffer = (rmt_symbol_word_t *)heap_caps_calloc(
+            max_symbols_, sizeof(rmt_symbol_word_t), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    }
+    pulses_ = new pulse_t[max_symbols_ * 2];
+
+    done_queue_ = xQueueCreate(2, sizeof(received_frame_t));
+    task_exited_ = xSemaphoreCreateBinary();
+    if (xTaskCreate(decodeTask, "pulse_decode", 3072, this, task_priority, &task_) != pdPASS) {
+        ERROR("Could not create pulse_decode task so pulses will not be decoded");
+        task_ = nullptr;
+    }
+}
+
+PulseReceiver::~PulseReceiver() {
+    continuous_ = false;
+    rmt_disable(channel_);
+
+    // The task might be in the middle of decoding, so instead of deleting it ask it to
+    // exit once it gets to the exit message and wait until it has
+    if (task_) {
+        const received_frame_t exit_frame = {kExitTask, 0};
+        xQueueSend(done_queue_, &exit_frame, portMAX_DELAY);
+        xSemaphoreTake(task_exited_, portMAX_DELAY);
+    }
+
+    rmt_del_channel(channel_);
+    vSemaphoreDelete(task_exited_);
+    vQueueDelete(done_queue_);
+    for (auto &buffer : buffers_) heap_caps_free(buffer);
+    delete[] pulses_;
+}
+
+esp_err_t PulseReceiver::arm() {
+    rmt_symbol_word_t *buffer = buffers_[next_buffer_];
+    next_buffer_ ^= 1;
+    return rmt_receive(channel_, buffer, max_symbols_ * sizeof(rmt_symbol_word_t),
+                       &receive_config_);
+}
+
+esp_err_t PulseReceiver::startContinuous() {
+    continuous_ = true;
+    return arm();
+}
+
+esp_err_t PulseReceiver::measure(pulse_trigger_function_t trigger_function, void *arg) {
+    esp_err_t err = arm();
+    if (err != ESP_OK) return err;
+
+    if (trigger_function) trigger_function(arg);
+    return ESP_OK;
+}
+
+/* static */
+bool IRAM_ATTR PulseReceiver::receiveDoneCallback(rmt_channel_handle_t channel,
+                                                  const rmt_rx_done_event_data_t *edata,
+                                                  void *user_ctx) {
+    PulseReceiver *receiver = (PulseReceiver *)user_ctx;
+
+    received_frame_t frame;
+    frame.buffer = edata->received_symbols == receiver->buffers_[0] ? 0 : 1;
+    frame.num_symbols = edata->num_symbols;
+
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    xQueueSendFromISR(receiver->done_queue_, &frame, &higher_priority_task_woken);
+    return higher_priority_task_woken == pdTRUE;
+}
+
+/* static */
+void PulseReceiver::decodeTask(void *arg) {
+    PulseReceiver *receiver = (PulseReceiver *)arg;
+
+    while (true) {
+        received_frame_t frame;
+        if (xQueueReceive(receiver->done_queue_, &frame, portMAX_DELAY) != pdTRUE) continue;
+        if (frame.buffer == kExitTask) break;
+
+        // Re-arm into the other buffer first so that the next frame isn't missed
+        if (receiver->continuous_) receiver->arm();
+
+        // Convert the symbols, each two levels, to pulses in microseconds. A duration
+        // of 0 marks the end of the frame.
+        const rmt_symbol_word_t *symbols = receiver->buffers_[frame.buffer];
+        const uint32_t resolution_hz = receiver->decoder_.resolutionHz();
+        size_t count = 0;
+        for (size_t i = 0; i < frame.num_symbols; ++i) {
+            const rmt_symbol_word_t &symbol = symbols[i];
+            if (symbol.duration0 == 0) break;
+            receiver->pulses_[count++] = {(uint8_t)symbol.level0,
+                                          (uint16_t)(symbol.duration0 * 1000000ULL / resolution_hz)};
+            if (symbol.duration1 == 0) break;
+            receiver->pulses_[count++] = {(uint8_t)symbol.level1,
+                                          (uint16_t)(symbol.duration1 * 1000000ULL / resolution_hz)};
+        }
+
+        receiver->stats_.frames++;
+        if (receiver->decoder_.decode(receiver->pulses_, count)) {
+            receiver->stats_.decoded++;
+            receiver->decoded_function_(receiver->decoder_, receiver->decoded_arg_);
+        } else {
+            receiver->stats_.failures++;
+            VERBOSE("%s decoder rejected frame of %d pulses", receiver->decoder_.name(), count);
+        }
+    }
+
+    // Destructor is waiting for this. Must not touch the receiver afterwards.
+    xSemaphoreGive(receiver->task_exited_);
+    vTaskDelete(nullptr);
+}
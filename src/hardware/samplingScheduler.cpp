@@ -0,0 +1,238 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/hardware/samplingScheduler.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+#include "idfx/utils/log.hpp"
+
+using namespace idfx;
+
+// Gives the semaphore passed as arg. Used by waitForTimerCallbacks().
+static void giveSemaphoreCallback(void *arg) {
+    xSemaphoreGive((SemaphoreHandle_t)arg);
+}
+
+/**
+ * esp_timer_stop() doesn't wait for a callback that has already been dispatched. Since the
+ * esp_timer task runs callbacks one at a time, once a callback scheduled now has run any
+ * earlier callback is certainly done.
+ */
+static void waitForTimerCallbacks() {
+    SemaphoreHandle_t done = xSemaphoreCreateBinary();
+    esp_timer_create_args_t barrier_args = {};
+    barrier_args.callback = giveSemaphoreCallback;
+    barrier_args.arg = done;
+    barrier_args.dispatch_method = ESP_TIMER_TASK;
+    barrier_args.name = "sampling_barrier";
+    esp_timer_handle_t barrier;
+    ESP_ERROR_CHECK(esp_timer_create(&barrier_args, &barrier));
+    ESP_ERROR_CHECK(esp_timer_start_once(barrier, 0));
+    xSemaphoreTake(done, portMAX_DELAY);
+    esp_timer_delete(barrier);
+    vSemaphoreDelete(done);
+}
+
+SamplingScheduler::SamplingScheduler(sample_batch_function_t batch_function, void *arg,
+                                     uint32_t min_slot_usec)
+    : batch_function_(batch_function),
+      batch_arg_(arg),
+      min_slot_usec_(std::max<uint32_t>(min_slot_usec, 1)),
+      slot_usec_(0),
+      start_usec_(0),
+      timer_(nullptr),
+      task_(nullptr),
+      task_exited_(nullptr),
+      running_(false),
+      stats_({}) {}
+
+SamplingScheduler::~SamplingScheduler() {
+    stop();
+}
+
+int SamplingScheduler::addSensor(const char *name, sensor_read_function_t read_function,
+                                 void *arg, uint32_t period_usec, uint32_t phase_usec, int bus) {
+    ASSERT_MSG(!running_, "SamplingScheduler::addSensor() called after start()");
+    ASSERT_MSG(period_usec > 0, "Sensor period must be greater than 0");
+
+    const int id = sensors_.size();
+    INFO("Adding sensor %d (%s) with period_usec=%lu phase_usec=%lu bus=%d", id, name,
+         period_usec, phase_usec, bus);
+
+    sensors_.push_back({id, name, read_function, arg, period_usec, phase_usec % period_usec, bus});
+    return id;
+}
+
+esp_err_t SamplingScheduler::start(UBaseType_t task_priority, BaseType_t core_id) {
+    if (running_ || sensors_.empty()) return ESP_ERR_INVALID_STATE;
+
+    // Slot is the largest length that all periods and phases are a multiple of, so that
+    // each sensor is read exactly on its schedule. But periods like 10000 and 33333 would
+    // give a slot of just 1 usec, so the slot is at least min_slot_usec_ and due times
+    // are then rounded to the nearest slot.
+    // The slot is never longer than the shortest period so that no read is left out.
+    uint32_t slot_usec = 0;
+    uint32_t min_slot_usec = min_slot_usec_;
+    for (const sensor_t &sensor : sensors_) {
+        slot_usec = std::gcd(slot_usec, sensor.period_usec);
+        if (sensor.phase_usec) slot_usec = std::gcd(slot_usec, sensor.phase_usec);
+        min_slot_usec = std::min(min_slot_usec, sensor.period_usec);
+    }
+    if (slot_usec < min_slot_usec) {
+        INFO("Common divisor of sensor periods of %lu usec is less than min slot so reads "
+             "are rounded to slots of %lu usec", slot_usec, min_slot_usec);
+        slot_usec = min_slot_usec;
+    }
+    slot_usec_ = slot_usec;
+
+    // Read the sensors on the same bus consecutively. Stable so that sensors on a bus
+    // are read in the order they were added.
+    std::stable_sort(sensors_.begin(), sensors_.end(),
+                     [](const sensor_t &a, const sensor_t &b) { return a.bus < b.bus; });
+    samples_.resize(sensors_.size());
+
+    INFO("Starting sampling scheduler for %d sensors with slot of %lu usec", (int)sensors_.size(),
+         slot_usec_);
+
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = timerCallback;
+    timer_args.arg = this;
+    timer_args.dispatch_method = ESP_TIMER_TASK;
+    timer_args.name = "sampling";
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer_));
+    task_exited_ = xSemaphoreCreateBinary();
+
+    running_ = true;
+    stats_ = {};
+    start_usec_ = esp_timer_get_time();
+    if (xTaskCreatePinnedToCore(schedulerTask, "sampling", 4096, this, task_priority, &task_,
+                                core_id) != pdPASS) {
+        ERROR("Could not create sampling task so sampling scheduler not started");
+        running_ = false;
+        task_ = nullptr;
+        esp_timer_delete(timer_);
+        timer_ = nullptr;
+        vSemaphoreDelete(task_exited_);
+        task_exited_ = nullptr;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void SamplingScheduler::stop() {
+    if (!running_) return;
+
+    // Ask the task to exit, waking it in case it is waiting for the next slot, and wait
+    // until it has. It finishes reading the current slot first.
+    running_ = false;
+    xTaskNotifyGive(task_);
+    xSemaphoreTake(task_exited_, portMAX_DELAY);
+    task_ = nullptr;
+
+    // The task has already stopped the timer, so nothing uses it anymore
+    esp_timer_delete(timer_);
+    timer_ = nullptr;
+    vSemaphoreDelete(task_exited_);
+    task_exited_ = nullptr;
+}
+
+uint64_t SamplingScheduler::nextDueSlot(const sensor_t &sensor, uint64_t slot) const {
+    // Due times are rounded to the nearest slot, so reads due from half a slot before the
+    // start of the slot onwards are in the slot or later. Computed from the exact due
+    // times so that the rounding doesn't accumulate into drift.
+    const int64_t from_usec = (int64_t)(slot * slot_usec_) - slot_usec_ / 2;
+    uint64_t read_num = 0;
+    if (from_usec > (int64_t)sensor.phase_usec) {
+        read_num = (from_usec - sensor.phase_usec + sensor.period_usec - 1) / sensor.period_usec;
+    }
+    const uint64_t due_usec = sensor.phase_usec + read_num * sensor.period_usec;
+    return (due_usec + slot_usec_ / 2) / slot_usec_;
+}
+
+uint64_t SamplingScheduler::nextBusySlot(uint64_t slot) const {
+    uint64_t next_slot = UINT64_MAX;
+    for (const sensor_t &sensor : sensors_) {
+        next_slot = std::min(next_slot, nextDueSlot(sensor, slot));
+    }
+    return next_slot;
+}
+
+/* static */
+void SamplingScheduler::timerCallback(void *arg) {
+    SamplingScheduler *scheduler = (SamplingScheduler *)arg;
+    xTaskNotifyGive(scheduler->task_);
+}
+
+/* static */
+void SamplingScheduler::schedulerTask(void *arg) {
+    SamplingScheduler *scheduler = (SamplingScheduler *)arg;
+
+    uint64_t slot = 0;
+    while (scheduler->running_) {
+        // If the previous slot ran long then skip the slots that have already passed, and
+        // the one already under way, instead of reading late. Only the skipped slots in
+        // which a sensor was due are overruns.
+        const int64_t now_usec = esp_timer_get_time();
+        const uint64_t current_slot =
+            (uint64_t)(now_usec - scheduler->start_usec_) / scheduler->slot_usec_;
+        if (current_slot > slot) {
+            for (uint64_t missed = scheduler->nextBusySlot(slot); missed <= current_slot;
+                 missed = scheduler->nextBusySlot(missed + 1)) {
+                scheduler->stats_.overruns++;
+            }
+            slot = current_slot + 1;
+        }
+
+        // Sleep until the next slot in which a sensor is due, so no wakeups for empty slots
+        const uint64_t next_slot = scheduler->nextBusySlot(slot);
+        const int64_t due_usec = scheduler->start_usec_ + next_slot * scheduler->slot_usec_;
+        const int64_t wait_usec = due_usec - esp_timer_get_time();
+        if (wait_usec > 0) {
+            esp_timer_start_once(scheduler->timer_, wait_usec);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+        if (!scheduler->running_) break;
+
+        // Keep track of how late the slot started
+        const uint32_t jitter_usec = std::max<int64_t>(esp_timer_get_time() - due_usec, 0);
+        scheduler->stats_.max_jitter_usec = std::max(scheduler->stats_.max_jitter_usec, jitter_usec);
+        scheduler->stats_.total_jitter_usec += jitter_usec;
+
+        scheduler->runSlot(next_slot);
+        slot = next_slot + 1;
+    }
+
+    // Stop the timer, and make sure its callback isn't still about to notify this task,
+    // before telling stop() that the task is done and deleting it
+    esp_timer_stop(scheduler->timer_);
+    waitForTimerCallbacks();
+    xSemaphoreGive(scheduler->task_exited_);
+    vTaskDelete(nullptr);
+}
+
+void SamplingScheduler::runSlot(uint64_t slot) {
+    stats_.wakeups++;
+
+    size_t count = 0;
+    for (const sensor_t &sensor : sensors_) {
+        if (nextDueSlot(sensor, slot) != slot) continue;
+
+        sample_t &sample = samples_[count++];
+        sample.sensor_id = sensor.id;
+        sample.num_values = 0;
+        sample.timestamp_usec = esp_timer_get_time();
+        sample.ok = sensor.read_function(sensor.arg, sample.values, sample.num_values);
+        sample.num_values = std::min<uint8_t>(sample.num_values, kMaxValues);
+
+        stats_.reads++;
+        if (!sample.ok) {
+            stats_.failures++;
+            VERBOSE("Reading sensor %d (%s) failed", sensor.id, sensor.name);
+        }
+    }
+
+    batch_function_(samples_.data(), count, batch_arg_);
+}
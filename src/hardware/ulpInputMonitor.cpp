@@ -0,0 +1,241 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/hardware/ulpInputMonitor.hpp"
+
+#include "driver/rtc_io.h"
+#include "esp_sleep.h"
+#include "idfx/utils/log.hpp"
+#include "sdkconfig.h"
+#include "soc/soc.h"
+
+#if CONFIG_ULP_COPROC_TYPE_FSM
+#include "soc/rtc_cntl_reg.h"
+#include "soc/rtc_io_reg.h"
+#include "ulp.h"
+#endif
+
+using namespace idfx;
+
+// ULP can read the RTC GPIO input register 16 bits at a time, so only RTC GPIOs 0-15
+static const int kMaxRtcNum = 15;
+
+#if CONFIG_ULP_COPROC_TYPE_FSM
+
+// Layout of the data at the start of the ULP reserved area of RTC slow memory, in 32 bit
+// words, of which the ULP uses the low 16 bits. Words 0-7 are claimed for the data and
+// the program is loaded right after.
+static const int kLastRaw = 0;      // inputs at previous sample
+static const int kStableCount = 1;  // number of samples the inputs have been the same
+static const int kState = 2;        // last debounced state
+static const int kEvents = 3;       // inputs with qualifying events, cleared by main CPU
+static const int kWakeCount = 4;    // number of times the ULP woke the SoC
+static const int kProgramOffset = 8;
+
+static volatile uint32_t *const rtc_slow_mem_ = (volatile uint32_t *)SOC_RTC_DATA_LOW;
+
+#endif
+
+UlpInputMonitor::UlpInputMonitor() {}
+
+esp_err_t UlpInputMonitor::addInput(const InputBit &input, wake_condition_t condition,
+                                    bool pullup) {
+    const gpio_num_t gpio_num = input.gpioNum();
+    if (gpio_num == GPIO_NUM_NC || !rtc_gpio_is_valid_gpio(gpio_num)) {
+        ERROR("Input is not an RTC GPIO so cannot be monitored by the ULP");
+        return ESP_ERR_INVALID_ARG;
+    }
+    const int rtc_num = rtc_io_number_get(gpio_num);
+    if (rtc_num > kMaxRtcNum) {
+        ERROR("GPIO %d is RTC GPIO %d but ULP can only monitor RTC GPIOs 0-%d", gpio_num,
+              rtc_num, kMaxRtcNum);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    DEBUG("Adding GPIO %d (RTC GPIO %d) with wake condition %d", gpio_num, rtc_num, condition);
+    inputs_.push_back({gpio_num, rtc_num, condition, pullup});
+    return ESP_OK;
+}
+
+/* static */
+uint64_t UlpInputMonitor::rtcMaskToGpioMask(uint16_t rtc_mask) {
+    uint64_t gpio_mask = 0;
+    for (int gpio = 0; gpio < GPIO_NUM_MAX; ++gpio) {
+        if (!rtc_gpio_is_valid_gpio((gpio_num_t)gpio)) continue;
+        const int rtc_num = rtc_io_number_get((gpio_num_t)gpio);
+        if (rtc_num <= kMaxRtcNum && (rtc_mask >> rtc_num) & 1) gpio_mask |= 1ULL << gpio;
+    }
+    return gpio_mask;
+}
+
+/* static */
+bool UlpInputMonitor::wokeByUlp() {
+    return esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_ULP;
+}
+
+#if CONFIG_ULP_COPROC_TYPE_FSM
+
+/* static */
+uint64_t UlpInputMonitor::takeEvents() {
+    const uint16_t events = rtc_slow_mem_[kEvents] & 0xFFFF;
+    rtc_slow_mem_[kEvents] = 0;
+    return rtcMaskToGpioMask(events);
+}
+
+/* static */
+uint64_t UlpInputMonitor::state() {
+    return rtcMaskToGpioMask(rtc_slow_mem_[kState] & 0xFFFF);
+}
+
+/* static */
+uint16_t UlpInputMonitor::wakeCount() {
+    return rtc_slow_mem_[kWakeCount] & 0xFFFF;
+}
+
+esp_err_t UlpInputMonitor::start(uint32_t sample_period_usec, uint16_t debounce_samples) {
+    if (inputs_.empty()) return ESP_ERR_INVALID_STATE;
+    INFO("Starting ULP monitoring of %d inputs every %ld usec with debounce of %d samples",
+         (int)inputs_.size(), sample_period_usec, debounce_samples);
+
+    // Hand the pins over to the RTC domain so that they can be read during deep sleep
+    uint16_t input_mask = 0;
+    uint16_t rising_mask = 0;
+    uint16_t falling_mask = 0;
+    uint16_t initial_state = 0;
+    for (const input_t &input : inputs_) {
+        ESP_ERROR_CHECK(rtc_gpio_init(input.gpio_num));
+        ESP_ERROR_CHECK(rtc_gpio_set_direction(input.gpio_num, RTC_GPIO_MODE_INPUT_ONLY));
+        if (input.pullup) {
+            rtc_gpio_pullup_en(input.gpio_num);
+        } else {
+            rtc_gpio_pullup_dis(input.gpio_num);
+        }
+        rtc_gpio_pulldown_dis(input.gpio_num);
+        rtc_gpio_hold_en(input.gpio_num);
+
+        const uint16_t bit = 1 << input.rtc_num;
+        input_mask |= bit;
+        if (input.condition & kRising) rising_mask |= bit;
+        if (input.condition & kFalling) falling_mask |= bit;
+        if (rtc_gpio_get_level(input.gpio_num)) initial_state |= bit;
+    }
+
+    // Labels
+    enum { kSame = 1, kWaitForSleep, kHalt };
+
+    // R3 is the base address of the data and is 0. The ULP has no XOR so
+    // changed = (new | old) - (new & old).
+    const ulp_insn_t program[] = {
+        I_MOVI(R3, 0),
+
+        // Read the inputs and compare with the previous sample
+        I_RD_REG(RTC_GPIO_IN_REG, RTC_GPIO_IN_NEXT_S, RTC_GPIO_IN_NEXT_S + kMaxRtcNum),
+        I_ANDI(R0, R0, input_mask),
+        I_LD(R1, R3, kLastRaw),
+        I_SUBR(R2, R0, R1),
+        M_BXZ(kSame),
+
+        // Inputs changed so they are bouncing. Restart the stable count.
+        I_ST(R0, R3, kLastRaw),
+        I_MOVI(R2, 0),
+        I_ST(R2, R3, kStableCount),
+        I_HALT(),
+
+        // Same as the previous sample. Once stable for exactly debounce_samples samples
+        // evaluate the debounced value, which is in R1.
+        M_LABEL(kSame),
+        I_LD(R0, R3, kStableCount),
+        M_BGE(kHalt, debounce_samples),
+        I_ADDI(R0, R0, 1),
+        I_ST(R0, R3, kStableCount),
+        M_BL(kHalt, debounce_samples),
+
+        I_LD(R2, R3, kState),
+        I_ST(R1, R3, kState),
+        I_ORR(R0, R1, R2),
+        I_ANDR(R2, R1, R2),
+        I_SUBR(R2, R0, R2),  // R2 = changed inputs
+        I_ANDR(R0, R2, R1),
+        I_ANDI(R0, R0, rising_mask),  // R0 = qualifying rising edges
+        I_ANDR(R1, R2, R1),
+        I_SUBR(R1, R2, R1),
+        I_ANDI(R1, R1, falling_mask),  // R1 = qualifying falling edges
+        I_ORR(R0, R0, R1),
+        M_BXZ(kHalt),
+
+        // Record the events and wake the SoC
+        I_LD(R1, R3, kEvents),
+        I_ORR(R0, R0, R1),
+        I_ST(R0, R3, kEvents),
+        I_LD(R0, R3, kWakeCount),
+        I_ADDI(R0, R0, 1),
+        I_ST(R0, R3, kWakeCount),
+
+        // Can only wake once the SoC is actually asleep. If it is awake then the wake
+        // happens as soon as it goes to sleep.
+        M_LABEL(kWaitForSleep),
+        I_RD_REG(RTC_CNTL_LOW_POWER_ST_REG, RTC_CNTL_RDY_FOR_WAKEUP_S, RTC_CNTL_RDY_FOR_WAKEUP_S),
+        M_BL(kWaitForSleep, 1),
+        I_WAKE(),
+
+        M_LABEL(kHalt),
+        I_HALT(),
+    };
+
+    // Initial state is the current levels, already debounced, so no wake for them
+    rtc_slow_mem_[kLastRaw] = initial_state;
+    rtc_slow_mem_[kStableCount] = debounce_samples;
+    rtc_slow_mem_[kState] = initial_state;
+    rtc_slow_mem_[kEvents] = 0;
+    rtc_slow_mem_[kWakeCount] = 0;
+
+    size_t size = sizeof(program) / sizeof(ulp_insn_t);
+    esp_err_t err = ulp_process_macros_and_load(kProgramOffset, program, &size);
+    if (err != ESP_OK) {
+        ERROR("Could not load ULP program: %s", esp_err_to_name(err));
+        return err;
+    }
+    DEBUG("Loaded ULP program of %d words", (int)size);
+
+    ESP_ERROR_CHECK(ulp_set_wakeup_period(0, sample_period_usec));
+    ESP_ERROR_CHECK(esp_sleep_enable_ulp_wakeup());
+    return ulp_run(kProgramOffset);
+}
+
+void UlpInputMonitor::stop() {
+    ulp_timer_stop();
+    for (const input_t &input : inputs_) {
+        rtc_gpio_hold_dis(input.gpio_num);
+        rtc_gpio_deinit(input.gpio_num);
+    }
+}
+
+#else
+
+esp_err_t UlpInputMonitor::start(uint32_t sample_period_usec, uint16_t debounce_samples) {
+    ERROR("UlpInputMonitor requires CONFIG_ULP_COPROC_ENABLED with the FSM coprocessor type");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void UlpInputMonitor::stop() {}
+
+// Without the ULP there is no data in RTC slow memory, and the memory might not even be
+// reserved for the ULP, so must not be accessed
+
+/* static */
+uint64_t UlpInputMonitor::takeEvents() {
+    return 0;
+}
+
+/* static */
+uint64_t UlpInputMonitor::state() {
+    return 0;
+}
+
+/* static */
+uint16_t UlpInputMonitor::wakeCount() {
+    return 0;
+}
+
+#endif
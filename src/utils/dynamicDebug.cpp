@@ -0,0 +1,218 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "idfx/utils/dynamicDebug.hpp"
+
+#include <fnmatch.h>
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "idfx/utils/log.hpp"
+
+using namespace idfx;
+
+log_call_site_t *DynamicDebug::call_sites_ = nullptr;
+std::vector<DynamicDebug::rule_t> DynamicDebug::rules_;
+std::mutex DynamicDebug::mutex_;
+
+/* Returns true if the call site is logged unless a rule disables it */
+static bool enabledByDefault(const log_call_site_t *site) {
+    return site->letter != 'D' && site->letter != 'V';
+}
+
+/* Returns the esp_log level to log the call site at */
+static esp_log_level_t logLevel(const log_call_site_t *site) {
+    switch (site->letter) {
+        case 'I':
+            return ESP_LOG_INFO;
+        case 'W':
+            return ESP_LOG_WARN;
+        default:
+            // Errors, and DEBUG() and VERBOSE() call sites that were explicitly enabled
+            return ESP_LOG_ERROR;
+    }
+}
+
+/* Returns just the file name part of the path */
+static const char *baseName(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+/* static */
+bool DynamicDebug::parse(const char *query_str, query_t &query) {
+    query = {"*", "*", "*", 0, INT32_MAX};
+
+    std::vector<std::string> tokens;
+    char buffer[128];
+    strlcpy(buffer, query_str, sizeof(buffer));
+    char *saveptr;
+    for (char *token = strtok_r(buffer, " \t", &saveptr); token;
+         token = strtok_r(nullptr, " \t", &saveptr)) {
+        tokens.push_back(token);
+    }
+
+    if (tokens.size() == 1 && tokens[0] == "all") return true;
+
+    if (tokens.empty() || tokens.size() % 2 != 0) return false;
+    for (int i = 0; i < tokens.size(); i += 2) {
+        const std::string &keyword = tokens[i];
+        const std::string &value = tokens[i + 1];
+        if (keyword == "file") {
+            query.file = value;
+        } else if (keyword == "func") {
+            query.func = value;
+        } else if (keyword == "format") {
+            query.format = value;
+        } else if (keyword == "line") {
+            char *end;
+            query.first_line = strtol(value.c_str(), &end, 10);
+            query.last_line = *end == '-' ? strtol(end + 1, &end, 10) : query.first_line;
+            if (*end != '\0') return false;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* static */
+bool DynamicDebug::matches(const query_t &query, const log_call_site_t *site) {
+    return site->line >= query.first_line && site->line <= query.last_line &&
+           fnmatch(query.file.c_str(), baseName(site->file), 0) == 0 &&
+           fnmatch(query.func.c_str(), site->func, 0) == 0 &&
+           fnmatch(query.format.c_str(), site->format, 0) == 0;
+}
+
+/* static */
+int DynamicDebug::setEnabled(const char *query_str, bool enabled) {
+    query_t query;
+    if (!parse(query_str, query)) return -1;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    int count = 0;
+    for (log_call_site_t *site = call_sites_; site; site = site->next) {
+        if (matches(query, site)) {
+            site->state = enabled ? kCallSiteEnabled : kCallSiteDisabled;
+            count++;
+        }
+    }
+
+    // Remember the rule for call sites not yet registered. A rule that matches everything
+    // supersedes all earlier ones, which keeps the list from growing without bound.
+    if (query.file == "*" && query.func == "*" && query.format == "*" && query.first_line == 0 &&
+        query.last_line == INT32_MAX) {
+        rules_.clear();
+    }
+    rules_.push_back({query, enabled});
+
+    return count;
+}
+
+/* static */
+void DynamicDebug::list(const char *query_str) {
+    query_t query;
+    if (*query_str != '\0' && !parse(query_str, query)) {
+        printf("Invalid query \"%s\"\n", query_str);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    int count = 0;
+    for (const log_call_site_t *site = call_sites_; site; site = site->next) {
+        if (*query_str != '\0' && !matches(query, site)) continue;
+
+        printf("%c %c %s:%d %s() \"%s\"\n", site->state == kCallSiteEnabled ? '+' : '-',
+               site->letter, baseName(site->file), site->line, site->func, site->format);
+        count++;
+    }
+    printf("%d call sites. Call sites are only listed once they have been reached.\n", count);
+}
+
+/* static */
+bool DynamicDebug::registerCallSite(log_call_site_t *site) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Another task could have registered it while waiting for the lock
+    if (site->state != kCallSiteUnregistered) return site->state == kCallSiteEnabled;
+
+    // Last matching rule wins
+    bool enabled = enabledByDefault(site);
+    for (const rule_t &rule : rules_) {
+        if (matches(rule.query, site)) enabled = rule.enabled;
+    }
+
+    site->next = call_sites_;
+    call_sites_ = site;
+    site->state = enabled ? kCallSiteEnabled : kCallSiteDisabled;
+    return enabled;
+}
+
+/* static */
+void DynamicDebug::log(const log_call_site_t *site, const char *format, ...) {
+    // Format into a single buffer so that output from different tasks doesn't get
+    // interleaved
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    const std::string tag = threadId();
+    esp_log_write(logLevel(site), tag.c_str(), "%c (%lu) %s: %s%s:%s%s\n", site->letter,
+                  esp_log_timestamp(), tag.c_str(), functionName(site->func).c_str(),
+                  fileName(site->file).c_str(), lineNumber(site->line).c_str(), message);
+}
+
+/* static */
+int DynamicDebug::consoleCommand(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: dyndbg list|enable|disable [all | file <glob>] [func <glob>] "
+               "[line <n>[-<m>]] [format <glob>]\n");
+        return 1;
+    }
+
+    // Join the remaining arguments back into a single query
+    std::string query;
+    for (int i = 2; i < argc; ++i) {
+        if (!query.empty()) query += " ";
+        query += argv[i];
+    }
+
+    if (strcmp(argv[1], "list") == 0) {
+        list(query.c_str());
+        return 0;
+    }
+
+    bool enabled = strcmp(argv[1], "enable") == 0;
+    if (!enabled && strcmp(argv[1], "disable") != 0) {
+        printf("Unknown subcommand \"%s\"\n", argv[1]);
+        return 1;
+    }
+
+    int count = setEnabled(query.c_str(), enabled);
+    if (count < 0) {
+        printf("Invalid query \"%s\"\n", query.c_str());
+        return 1;
+    }
+    printf("%s %d call sites\n", enabled ? "Enabled" : "Disabled", count);
+    return 0;
+}
+
+/* static */
+void DynamicDebug::registerConsoleCommand() {
+    esp_console_cmd_t command = {};
+    command.command = "dyndbg";
+    command.help = "List, enable, or disable individual log call sites";
+    command.hint = "list|enable|disable <query>";
+    command.func = consoleCommand;
+    ESP_ERROR_CHECK(esp_console_cmd_register(&command));
+}
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+"""
+Packs images into run length encoded idfx images that can be decoded at runtime by
+idfx::ImageDecoder. Generates a C file defining an lv_image_dsc_t for each image.
+See include/idfx/display/imageDecoder.hpp for a description of the format.
+
+Usage: idfx_image_pack.py [--no-alpha] [--raw] -o images.c image1.png image2.png ...
+
+Requires Pillow.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+from PIL import Image
+
+MAGIC = 0x49584449  # "IDXI"
+MAX_COUNT = 128
+
+
+def rle_encode(values, value_size):
+    """Run length encodes a list of values. Runs of 2 or more identical values are
+    encoded as repeats, everything else as literals."""
+    fmt = "<H" if value_size == 2 else "<B"
+    out = bytearray()
+    i = 0
+    n = len(values)
+    while i < n:
+        run = 1
+        while i + run < n and run < MAX_COUNT and values[i + run] == values[i]:
+            run += 1
+        if run >= 2:
+            out.append(0x80 | (run - 1))
+            out += struct.pack(fmt, values[i])
+            i += run
+            continue
+
+        # Collect literals until the next run or the maximum count
+        start = i
+        while i < n and i - start < MAX_COUNT:
+            if i + 1 < n and values[i + 1] == values[i]:
+                break
+            i += 1
+        out.append(i - start - 1)
+        for v in values[start:i]:
+            out += struct.pack(fmt, v)
+    return bytes(out)
+
+
+def rgb565(r, g, b):
+    return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3)
+
+
+def pack_image(path, keep_alpha, compress):
+    img = Image.open(path).convert("RGBA")
+    width, height = img.size
+    pixels = img.load()
+
+    has_alpha = keep_alpha and any(
+        pixels[x, y][3] != 255 for y in range(height) for x in range(width))
+
+    offsets = []
+    lines = bytearray()
+    for y in range(height):
+        offsets.append(len(lines))
+        rgb = [rgb565(*pixels[x, y][:3]) for x in range(width)]
+        alpha = [pixels[x, y][3] for x in range(width)]
+        if compress:
+            lines += rle_encode(rgb, 2)
+            if has_alpha:
+                lines += rle_encode(alpha, 1)
+        else:
+            lines += struct.pack("<%dH" % width, *rgb)
+            if has_alpha:
+                lines += bytes(alpha)
+
+    header = struct.pack("<IHHBBH", MAGIC, width, height, int(has_alpha),
+                         1 if compress else 0, 0)
+    data = header + struct.pack("<%dI" % height, *offsets) + bytes(lines)
+    return width, height, has_alpha, data
+
+
+def c_name(path):
+    name = os.path.splitext(os.path.basename(path))[0]
+    return re.sub(r"\W", "_", name)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Pack images for idfx::ImageDecoder")
+    parser.add_argument("-o", "--output", required=True, help="C file to generate")
+    parser.add_argument("--no-alpha", action="store_true", help="drop the alpha channel")
+    parser.add_argument("--raw", action="store_true", help="don't compress")
+    parser.add_argument("images", nargs="+")
+    args = parser.parse_args()
+
+    with open(args.output, "w") as f:
+        f.write("/* Generated by idfx_image_pack.py, do not edit */\n\n")
+        f.write('#include "lvgl.h"\n')
+
+        for path in args.images:
+            width, height, has_alpha, data = pack_image(path, not args.no_alpha, not args.raw)
+            name = c_name(path)
+            raw_size = width * height * (3 if has_alpha else 2)
+            print("%s: %dx%d %d bytes (%.0f%% of raw)" %
+                  (path, width, height, len(data), 100.0 * len(data) / raw_size))
+
+            f.write("\nstatic const uint8_t %s_data[] __attribute__((aligned(4))) = {\n" % name)
+            for i in range(0, len(data), 16):
+                f.write("    " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",\n")
+            f.write("};\n\n")
+            f.write("const lv_image_dsc_t %s = {\n" % name)
+            f.write("    .header = {\n")
+            f.write("        .magic = LV_IMAGE_HEADER_MAGIC,\n")
+            f.write("        .cf = %s,\n" %
+                    ("LV_COLOR_FORMAT_RAW_ALPHA" if has_alpha else "LV_COLOR_FORMAT_RAW"))
+            f.write("        .w = %d,\n" % width)
+            f.write("        .h = %d,\n" % height)
+            f.write("    },\n")
+            f.write("    .data_size = sizeof(%s_data),\n" % name)
+            f.write("    .data = %s_data,\n" % name)
+            f.write("};\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())